@@ -0,0 +1,164 @@
+/* times swizzle_image against the per-texel tiling loops driver_3ds.cpp used before it, and checks that both give the
+   same tiles and so does the transfer engine for the formats CAELINA_TRANSFER_TILING hands it, run through
+   "make -f MakefileHost bench" */
+
+#include <3ds.h>
+#include "swizzle.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static u8 tileOrder[] = {0,1,8,9,2,3,10,11,16,17,24,25,18,19,26,27,4,5,12,13,6,7,14,15,20,21,28,29,22,23,30,31,32,33,40,41,34,35,42,43,48,49,56,57,50,51,58,59,36,37,44,45,38,39,46,47,52,53,60,61,54,55,62,63};
+
+static unsigned long htonl_legacy(unsigned long v)
+{
+    u8* v2=(u8*)&v;
+    return (v2[0]<<24)|(v2[1]<<16)|(v2[2]<<8)|(v2[3]);
+}
+
+// the RGBA8 only loop, byte swapping every texel
+static void tileImage32(u32* src, u32* dst, int width, int height)
+{
+    int i, j, k, l;
+    l=0;
+    for(j=0; j<height; j+=8)
+    {
+        for(i=0; i<width; i+=8)
+        {
+            for(k=0; k<8*8; k++)
+            {
+                int x=i+tileOrder[k]%8;
+                int y=j+(tileOrder[k]-(x-i))/8;
+                u32 v=src[x+(height-1-y)*width];
+                dst[l++]=htonl_legacy(v);
+            }
+        }
+    }
+}
+
+// the loop for texels already stored in the PICA's byte order
+static void tileImage(const u8* src, u8* dst, int width, int height, u32 size)
+{
+    int i, j, k;
+    for(j=0; j<height; j+=8)
+    {
+        for(i=0; i<width; i+=8)
+        {
+            for(k=0; k<8*8; k++)
+            {
+                int x=i+tileOrder[k]%8;
+                int y=j+tileOrder[k]/8;
+                const u8* texel=src+(x+(height-1-y)*width)*size;
+                switch(size)
+                {
+                    case 1: *dst=*texel; break;
+                    case 2: *(u16*)dst=*(const u16*)texel; break;
+                    case 4: *(u32*)dst=*(const u32*)texel; break;
+                    default: memcpy(dst, texel, size); break;
+                }
+                dst+=size;
+            }
+        }
+    }
+}
+
+typedef std::chrono::steady_clock bench_clock;
+
+/* megabytes of texels per second over enough runs to fill about 200ms */
+template <typename F>
+static double throughput(u32 bytes, F f) {
+    u32 runs = 0;
+    bench_clock::time_point start = bench_clock::now();
+    double seconds = 0;
+    do {
+        f();
+        ++runs;
+        seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    } while (seconds < 0.2);
+    return (double)bytes * runs / seconds / (1024 * 1024);
+}
+
+/* tiles one image with the transfer engine of the host stand-in the way repack_texture does, true if the result
+   matches swizzle_image */
+static bool transfer_matches(GPU_TEXCOLOR format, u32 texel, u32 width, u32 height) {
+    GX_TRANSFER_FORMAT transfer;
+    if (!transfer_format(format, transfer)) return false;
+
+    u32 bytes = width * height * texel;
+    u8 *src = (u8 *)linearAlloc(bytes);
+    u8 *dst = (u8 *)linearAlloc(bytes);
+    u8 *expected = (u8 *)malloc(bytes);
+    for (u32 i = 0; i < bytes; ++i) src[i] = (u8)(i * 61 + (i >> 7));
+
+    swizzle_image(src, expected, width, height, texel);
+    GSPGPU_FlushDataCache(src, bytes);
+    GX_DisplayTransfer((u32 *)src, GX_BUFFER_DIM(width, height), (u32 *)dst, GX_BUFFER_DIM(width, height),
+                       TEXTURE_TRANSFER_FLAGS | GX_TRANSFER_IN_FORMAT(transfer) | GX_TRANSFER_OUT_FORMAT(transfer));
+    gspWaitForPPF();
+    bool same = memcmp(expected, dst, bytes) == 0;
+
+    linearFree(src);
+    linearFree(dst);
+    free(expected);
+    return same;
+}
+
+int main() {
+    static const u32 sizes[] = {64, 256, 1024};
+    int failed = 0;
+
+    printf("%-6s %-5s %12s %12s %12s %8s\n", "size", "texel", "tileImage32", "tileImage", "swizzle", "speedup");
+    for (u32 s : sizes) {
+        for (u32 texel = 1; texel <= 4; ++texel) {
+            u32 bytes = s * s * texel;
+            u8 *src = (u8 *)malloc(bytes);
+            u8 *expected = (u8 *)malloc(bytes);
+            u8 *dst = (u8 *)malloc(bytes);
+            for (u32 i = 0; i < bytes; ++i) src[i] = (u8)(i * 131 + (i >> 9));
+
+            tileImage(src, expected, s, s, texel);
+            memset(dst, 0, bytes);
+            swizzle_image(src, dst, s, s, texel);
+            bool same = memcmp(expected, dst, bytes) == 0;
+            failed += !same;
+
+            double legacy32 = 0;
+            if (texel == 4) legacy32 = throughput(bytes, [&] { tileImage32((u32 *)src, (u32 *)expected, s, s); });
+            double legacy = throughput(bytes, [&] { tileImage(src, expected, s, s, texel); });
+            double swizzle = throughput(bytes, [&] { swizzle_image(src, dst, s, s, texel); });
+
+            char column[16] = "-";
+            if (legacy32) snprintf(column, sizeof(column), "%.0f MB/s", legacy32);
+            printf("%-6u %-5u %12s %7.0f MB/s %7.0f MB/s %7.1fx%s\n", s, texel, column, legacy, swizzle,
+                   swizzle / legacy, same ? "" : "  MISMATCH");
+
+            free(src);
+            free(expected);
+            free(dst);
+        }
+    }
+
+    static const struct {
+        GPU_TEXCOLOR format;
+        u32 texel;
+        const char *name;
+    } transfers[] = {
+        {GPU_RGBA8, 4, "RGBA8"},
+        {GPU_RGB8, 3, "RGB8"},
+        {GPU_RGB565, 2, "RGB565"},
+        {GPU_RGBA5551, 2, "RGBA5551"},
+        {GPU_RGBA4, 2, "RGBA4"},
+    };
+    static const u32 dims[][2] = {{64, 64}, {256, 128}, {1024, 1024}};
+
+    printf("\n%-9s %-9s %s\n", "size", "format", "transfer tiling");
+    for (auto& d : dims) {
+        for (auto& t : transfers) {
+            bool same = transfer_matches(t.format, t.texel, d[0], d[1]);
+            failed += !same;
+            printf("%4ux%-4u %-9s %s\n", d[0], d[1], t.name, same ? "same tiles" : "MISMATCH");
+        }
+    }
+    return failed != 0;
+}
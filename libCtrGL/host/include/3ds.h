@@ -0,0 +1,673 @@
+/**
+ * @file 3ds.h
+ * @brief Host stand-in for the subset of libctru used by libCtrGL and its examples.
+ * @description Builds the library for an ordinary desktop target. GPU command lists,
+ * linear/VRAM allocations and GX transfers are recorded instead of executed on a PICA200,
+ * see ctrgl_host.h for inspecting the recording.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t   s8;
+typedef int16_t  s16;
+typedef int32_t  s32;
+typedef int64_t  s64;
+typedef volatile u32 vu32;
+
+typedef s32 Result;
+typedef u32 Handle;
+
+#define BIT(n) (1U<<(n))
+#define R_SUCCEEDED(res) ((res)>=0)
+#define R_FAILED(res)    ((res)<0)
+
+#define SYSCLOCK_ARM11 268111856
+
+/* ---------------------------------------------------------------------------
+ * GPU enums (3ds/gpu/enums.h)
+ * ------------------------------------------------------------------------- */
+
+#define GPU_TEXTURE_MAG_FILTER(v) (((v)&0x1)<<1)
+#define GPU_TEXTURE_MIN_FILTER(v) (((v)&0x1)<<2)
+#define GPU_TEXTURE_MIP_FILTER(v) (((v)&0x1)<<24)
+#define GPU_TEXTURE_WRAP_S(v)     (((v)&0x3)<<12)
+#define GPU_TEXTURE_WRAP_T(v)     (((v)&0x3)<<8)
+#define GPU_TEXTURE_MODE(v)       (((v)&0x7)<<28)
+#define GPU_TEXTURE_ETC1_PARAM    BIT(5)
+
+typedef enum
+{
+	GPU_NEAREST = 0x0,
+	GPU_LINEAR  = 0x1,
+} GPU_TEXTURE_FILTER_PARAM;
+
+typedef enum
+{
+	GPU_CLAMP_TO_EDGE   = 0x0,
+	GPU_CLAMP_TO_BORDER = 0x1,
+	GPU_REPEAT          = 0x2,
+	GPU_MIRRORED_REPEAT = 0x3,
+} GPU_TEXTURE_WRAP_PARAM;
+
+typedef enum
+{
+	GPU_TEXUNIT0 = 0x1,
+	GPU_TEXUNIT1 = 0x2,
+	GPU_TEXUNIT2 = 0x4,
+} GPU_TEXUNIT;
+
+typedef enum
+{
+	GPU_RGBA8    = 0x0,
+	GPU_RGB8     = 0x1,
+	GPU_RGBA5551 = 0x2,
+	GPU_RGB565   = 0x3,
+	GPU_RGBA4    = 0x4,
+	GPU_LA8      = 0x5,
+	GPU_HILO8    = 0x6,
+	GPU_L8       = 0x7,
+	GPU_A8       = 0x8,
+	GPU_LA4      = 0x9,
+	GPU_L4       = 0xA,
+	GPU_A4       = 0xB,
+	GPU_ETC1     = 0xC,
+	GPU_ETC1A4   = 0xD,
+} GPU_TEXCOLOR;
+
+typedef enum
+{
+	GPU_NEVER    = 0,
+	GPU_ALWAYS   = 1,
+	GPU_EQUAL    = 2,
+	GPU_NOTEQUAL = 3,
+	GPU_LESS     = 4,
+	GPU_LEQUAL   = 5,
+	GPU_GREATER  = 6,
+	GPU_GEQUAL   = 7,
+} GPU_TESTFUNC;
+
+typedef enum
+{
+	GPU_SCISSOR_DISABLE = 0,
+	GPU_SCISSOR_INVERT  = 1,
+	GPU_SCISSOR_NORMAL  = 3,
+} GPU_SCISSORMODE;
+
+typedef enum
+{
+	GPU_STENCIL_KEEP      = 0,
+	GPU_STENCIL_ZERO      = 1,
+	GPU_STENCIL_REPLACE   = 2,
+	GPU_STENCIL_INCR      = 3,
+	GPU_STENCIL_DECR      = 4,
+	GPU_STENCIL_INVERT    = 5,
+	GPU_STENCIL_INCR_WRAP = 6,
+	GPU_STENCIL_DECR_WRAP = 7,
+} GPU_STENCILOP;
+
+typedef enum
+{
+	GPU_WRITE_RED   = 0x01,
+	GPU_WRITE_GREEN = 0x02,
+	GPU_WRITE_BLUE  = 0x04,
+	GPU_WRITE_ALPHA = 0x08,
+	GPU_WRITE_DEPTH = 0x10,
+	GPU_WRITE_COLOR = 0x0F,
+	GPU_WRITE_ALL   = 0x1F,
+} GPU_WRITEMASK;
+
+typedef enum
+{
+	GPU_BLEND_ADD              = 0,
+	GPU_BLEND_SUBTRACT         = 1,
+	GPU_BLEND_REVERSE_SUBTRACT = 2,
+	GPU_BLEND_MIN              = 3,
+	GPU_BLEND_MAX              = 4,
+} GPU_BLENDEQUATION;
+
+typedef enum
+{
+	GPU_ZERO                     = 0,
+	GPU_ONE                      = 1,
+	GPU_SRC_COLOR                = 2,
+	GPU_ONE_MINUS_SRC_COLOR      = 3,
+	GPU_DST_COLOR                = 4,
+	GPU_ONE_MINUS_DST_COLOR      = 5,
+	GPU_SRC_ALPHA                = 6,
+	GPU_ONE_MINUS_SRC_ALPHA      = 7,
+	GPU_DST_ALPHA                = 8,
+	GPU_ONE_MINUS_DST_ALPHA      = 9,
+	GPU_CONSTANT_COLOR           = 10,
+	GPU_ONE_MINUS_CONSTANT_COLOR = 11,
+	GPU_CONSTANT_ALPHA           = 12,
+	GPU_ONE_MINUS_CONSTANT_ALPHA = 13,
+	GPU_SRC_ALPHA_SATURATE       = 14,
+} GPU_BLENDFACTOR;
+
+typedef enum
+{
+	GPU_LOGICOP_CLEAR = 0,
+	GPU_LOGICOP_AND   = 1,
+	GPU_LOGICOP_COPY  = 3,
+	GPU_LOGICOP_SET   = 4,
+	GPU_LOGICOP_NOOP  = 6,
+} GPU_LOGICOP;
+
+typedef enum
+{
+	GPU_BYTE          = 0,
+	GPU_UNSIGNED_BYTE = 1,
+	GPU_SHORT         = 2,
+	GPU_FLOAT         = 3,
+} GPU_FORMATS;
+
+typedef enum
+{
+	GPU_CULL_NONE      = 0,
+	GPU_CULL_FRONT_CCW = 1,
+	GPU_CULL_BACK_CCW  = 2,
+} GPU_CULLMODE;
+
+#define GPU_ATTRIBFMT(i, n, f) (((((n)-1)<<2)|((f)&3))<<((i)*4))
+
+typedef enum
+{
+	GPU_PRIMARY_COLOR           = 0x00,
+	GPU_FRAGMENT_PRIMARY_COLOR  = 0x01,
+	GPU_FRAGMENT_SECONDARY_COLOR = 0x02,
+	GPU_TEXTURE0                = 0x03,
+	GPU_TEXTURE1                = 0x04,
+	GPU_TEXTURE2                = 0x05,
+	GPU_TEXTURE3                = 0x06,
+	GPU_PREVIOUS_BUFFER         = 0x0D,
+	GPU_CONSTANT                = 0x0E,
+	GPU_PREVIOUS                = 0x0F,
+} GPU_TEVSRC;
+
+typedef enum
+{
+	GPU_REPLACE      = 0x00,
+	GPU_MODULATE     = 0x01,
+	GPU_ADD          = 0x02,
+	GPU_ADD_SIGNED   = 0x03,
+	GPU_INTERPOLATE  = 0x04,
+	GPU_SUBTRACT     = 0x05,
+	GPU_DOT3_RGB     = 0x06,
+	GPU_DOT3_RGBA    = 0x07,
+	GPU_MULTIPLY_ADD = 0x08,
+	GPU_ADD_MULTIPLY = 0x09,
+} GPU_COMBINEFUNC;
+
+#define GPU_TEVSOURCES(a,b,c)  (((a))|((b)<<4)|((c)<<8))
+#define GPU_TEVOPERANDS(a,b,c) (((a))|((b)<<4)|((c)<<8))
+
+typedef enum
+{
+	GPU_TRIANGLES      = 0x0000,
+	GPU_TRIANGLE_STRIP = 0x0100,
+	GPU_TRIANGLE_FAN   = 0x0200,
+	GPU_GEOMETRY_PRIM  = 0x0300,
+} GPU_Primitive_t;
+
+typedef enum
+{
+	GPU_VERTEX_SHADER   = 0x0,
+	GPU_GEOMETRY_SHADER = 0x1,
+} GPU_SHADER_TYPE;
+
+/* ---------------------------------------------------------------------------
+ * GPU registers (3ds/gpu/registers.h), the subset used by libCtrGL
+ * ------------------------------------------------------------------------- */
+
+#define GPUREG_0000                          0x0000
+#define GPUREG_FINALIZE                      0x0010
+#define GPUREG_FACECULLING_CONFIG            0x0040
+#define GPUREG_VIEWPORT_WIDTH                0x0041
+#define GPUREG_VIEWPORT_INVW                 0x0042
+#define GPUREG_VIEWPORT_HEIGHT               0x0043
+#define GPUREG_VIEWPORT_INVH                 0x0044
+#define GPUREG_DEPTHMAP_SCALE                0x004D
+#define GPUREG_DEPTHMAP_OFFSET               0x004E
+#define GPUREG_SH_OUTMAP_TOTAL               0x004F
+#define GPUREG_SH_OUTMAP_O0                  0x0050
+#define GPUREG_EARLYDEPTH_FUNC               0x0061
+#define GPUREG_EARLYDEPTH_TEST1              0x0062
+#define GPUREG_EARLYDEPTH_CLEAR              0x0063
+#define GPUREG_SH_OUTATTR_MODE               0x0064
+#define GPUREG_SCISSORTEST_MODE              0x0065
+#define GPUREG_SCISSORTEST_POS               0x0066
+#define GPUREG_SCISSORTEST_DIM               0x0067
+#define GPUREG_VIEWPORT_XY                   0x0068
+#define GPUREG_EARLYDEPTH_DATA               0x006A
+#define GPUREG_DEPTHMAP_ENABLE               0x006D
+#define GPUREG_RENDERBUF_DIM                 0x006E
+#define GPUREG_SH_OUTATTR_CLOCK              0x006F
+#define GPUREG_TEXUNIT_CONFIG                0x0080
+#define GPUREG_TEXUNIT0_BORDER_COLOR         0x0081
+#define GPUREG_TEXUNIT0_DIM                  0x0082
+#define GPUREG_TEXUNIT0_PARAM                0x0083
+#define GPUREG_TEXUNIT0_LOD                  0x0084
+#define GPUREG_TEXUNIT0_ADDR1                0x0085
+#define GPUREG_TEXUNIT0_TYPE                 0x008E
+#define GPUREG_TEXUNIT1_BORDER_COLOR         0x0091
+#define GPUREG_TEXUNIT1_DIM                  0x0092
+#define GPUREG_TEXUNIT1_PARAM                0x0093
+#define GPUREG_TEXUNIT1_LOD                  0x0094
+#define GPUREG_TEXUNIT1_ADDR                 0x0095
+#define GPUREG_TEXUNIT1_TYPE                 0x0096
+#define GPUREG_TEXUNIT2_BORDER_COLOR         0x0099
+#define GPUREG_TEXUNIT2_DIM                  0x009A
+#define GPUREG_TEXUNIT2_PARAM                0x009B
+#define GPUREG_TEXUNIT2_LOD                  0x009C
+#define GPUREG_TEXUNIT2_ADDR                 0x009D
+#define GPUREG_TEXUNIT2_TYPE                 0x009E
+#define GPUREG_TEXENV0_SOURCE                0x00C0
+#define GPUREG_TEXENV1_SOURCE                0x00C8
+#define GPUREG_TEXENV2_SOURCE                0x00D0
+#define GPUREG_TEXENV3_SOURCE                0x00D8
+#define GPUREG_TEXENV_UPDATE_BUFFER          0x00E0
+#define GPUREG_TEXENV4_SOURCE                0x00F0
+#define GPUREG_TEXENV5_SOURCE                0x00F8
+#define GPUREG_TEXENV_BUFFER_COLOR           0x00FD
+#define GPUREG_COLOR_OPERATION               0x0100
+#define GPUREG_BLEND_FUNC                    0x0101
+#define GPUREG_LOGIC_OP                      0x0102
+#define GPUREG_BLEND_COLOR                   0x0103
+#define GPUREG_FRAGOP_ALPHA_TEST             0x0104
+#define GPUREG_STENCIL_TEST                  0x0105
+#define GPUREG_STENCIL_OP                    0x0106
+#define GPUREG_DEPTH_COLOR_MASK              0x0107
+#define GPUREG_FRAMEBUFFER_INVALIDATE        0x0110
+#define GPUREG_FRAMEBUFFER_FLUSH             0x0111
+#define GPUREG_COLORBUFFER_READ              0x0112
+#define GPUREG_COLORBUFFER_WRITE             0x0113
+#define GPUREG_DEPTHBUFFER_READ              0x0114
+#define GPUREG_DEPTHBUFFER_WRITE             0x0115
+#define GPUREG_DEPTHBUFFER_FORMAT            0x0116
+#define GPUREG_COLORBUFFER_FORMAT            0x0117
+#define GPUREG_EARLYDEPTH_TEST2              0x0118
+#define GPUREG_FRAMEBUFFER_BLOCK32           0x011B
+#define GPUREG_DEPTHBUFFER_LOC               0x011C
+#define GPUREG_COLORBUFFER_LOC               0x011D
+#define GPUREG_FRAMEBUFFER_DIM               0x011E
+#define GPUREG_ATTRIBBUFFERS_LOC             0x0200
+#define GPUREG_ATTRIBBUFFERS_FORMAT_LOW      0x0201
+#define GPUREG_ATTRIBBUFFERS_FORMAT_HIGH     0x0202
+#define GPUREG_ATTRIBBUFFER0_OFFSET          0x0203
+#define GPUREG_ATTRIBBUFFER0_CONFIG1         0x0204
+#define GPUREG_ATTRIBBUFFER0_CONFIG2         0x0205
+#define GPUREG_INDEXBUFFER_CONFIG            0x0227
+#define GPUREG_NUMVERTICES                   0x0228
+#define GPUREG_GEOSTAGE_CONFIG               0x0229
+#define GPUREG_VERTEX_OFFSET                 0x022A
+#define GPUREG_POST_VERTEX_CACHE_NUM         0x022D
+#define GPUREG_DRAWARRAYS                    0x022E
+#define GPUREG_DRAWELEMENTS                  0x022F
+#define GPUREG_VTX_FUNC                      0x0231
+#define GPUREG_FIXEDATTRIB_INDEX             0x0232
+#define GPUREG_FIXEDATTRIB_DATA0             0x0233
+#define GPUREG_FIXEDATTRIB_DATA1             0x0234
+#define GPUREG_FIXEDATTRIB_DATA2             0x0235
+#define GPUREG_CMDBUF_SIZE0                  0x0238
+#define GPUREG_CMDBUF_SIZE1                  0x0239
+#define GPUREG_CMDBUF_ADDR0                  0x023A
+#define GPUREG_CMDBUF_ADDR1                  0x023B
+#define GPUREG_CMDBUF_JUMP0                  0x023C
+#define GPUREG_CMDBUF_JUMP1                  0x023D
+#define GPUREG_VSH_NUM_ATTR                  0x0242
+#define GPUREG_VSH_COM_MODE                  0x0244
+#define GPUREG_START_DRAW_FUNC0              0x0245
+#define GPUREG_VSH_OUTMAP_TOTAL1             0x024A
+#define GPUREG_VSH_OUTMAP_TOTAL2             0x0251
+#define GPUREG_GSH_MISC0                     0x0252
+#define GPUREG_GEOSTAGE_CONFIG2              0x0253
+#define GPUREG_GSH_MISC1                     0x0254
+#define GPUREG_PRIMITIVE_CONFIG              0x025E
+#define GPUREG_RESTART_PRIMITIVE             0x025F
+#define GPUREG_GSH_BOOLUNIFORM               0x0280
+#define GPUREG_VSH_BOOLUNIFORM               0x02B0
+#define GPUREG_VSH_INTUNIFORM_I0             0x02B1
+#define GPUREG_VSH_INPUTBUFFER_CONFIG        0x02B9
+#define GPUREG_VSH_ENTRYPOINT                0x02BA
+#define GPUREG_VSH_ATTRIBUTES_PERMUTATION_LOW  0x02BB
+#define GPUREG_VSH_ATTRIBUTES_PERMUTATION_HIGH 0x02BC
+#define GPUREG_VSH_OUTMAP_MASK               0x02BD
+#define GPUREG_VSH_CODETRANSFER_END          0x02BF
+#define GPUREG_VSH_FLOATUNIFORM_CONFIG       0x02C0
+#define GPUREG_VSH_FLOATUNIFORM_DATA         0x02C1
+#define GPUREG_VSH_CODETRANSFER_CONFIG       0x02CB
+#define GPUREG_VSH_CODETRANSFER_DATA         0x02CC
+#define GPUREG_VSH_OPDESCS_CONFIG            0x02D5
+#define GPUREG_VSH_OPDESCS_DATA              0x02D6
+
+/* ---------------------------------------------------------------------------
+ * GPU command buffer (3ds/gpu/gpu.h)
+ * ------------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern u32* gpuCmdBuf;
+extern u32 gpuCmdBufSize;
+extern u32 gpuCmdBufOffset;
+
+static inline void GPUCMD_SetBuffer(u32* buf, u32 size, u32 offset)
+{
+	gpuCmdBuf = buf;
+	gpuCmdBufSize = size;
+	gpuCmdBufOffset = offset;
+}
+
+static inline void GPUCMD_SetBufferOffset(u32 offset)
+{
+	gpuCmdBufOffset = offset;
+}
+
+static inline void GPUCMD_GetBuffer(u32** addr, u32* size, u32* offset)
+{
+	if(addr) *addr = gpuCmdBuf;
+	if(size) *size = gpuCmdBufSize;
+	if(offset) *offset = gpuCmdBufOffset;
+}
+
+void GPUCMD_AddRawCommands(const u32* cmd, u32 size);
+void GPUCMD_Add(u32 header, const u32* param, u32 paramlength);
+void GPUCMD_Split(u32** addr, u32* size);
+u32 f32tof24(float f);
+u32 f32tof31(float f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define GPUCMD_HEADER(incremental, mask, reg) (((incremental)<<31)|(((mask)&0xF)<<16)|((reg)&0x3FF))
+
+static inline void GPUCMD_AddSingleParam(u32 header, u32 param)
+{
+	GPUCMD_Add(header, &param, 1);
+}
+
+#define GPUCMD_AddMaskedWrite(reg, mask, val) GPUCMD_AddSingleParam(GPUCMD_HEADER(0, (mask), (reg)), (val))
+#define GPUCMD_AddWrite(reg, val) GPUCMD_AddMaskedWrite((reg), 0xF, (val))
+#define GPUCMD_AddMaskedWrites(reg, mask, vals, num) GPUCMD_Add(GPUCMD_HEADER(0, (mask), (reg)), (vals), (num))
+#define GPUCMD_AddWrites(reg, vals, num) GPUCMD_AddMaskedWrites((reg), 0xF, (vals), (num))
+#define GPUCMD_AddMaskedIncrementalWrites(reg, mask, vals, num) GPUCMD_Add(GPUCMD_HEADER(1, (mask), (reg)), (vals), (num))
+#define GPUCMD_AddIncrementalWrites(reg, vals, num) GPUCMD_AddMaskedIncrementalWrites((reg), 0xF, (vals), (num))
+
+/* ---------------------------------------------------------------------------
+ * Shader binaries and programs (3ds/gpu/shbin.h, 3ds/gpu/shaderProgram.h)
+ * ------------------------------------------------------------------------- */
+
+typedef enum
+{
+	VERTEX_SHDR   = GPU_VERTEX_SHADER,
+	GEOMETRY_SHDR = GPU_GEOMETRY_SHADER,
+} DVLE_type;
+
+typedef enum
+{
+	DVLE_CONST_BOOL    = 0x0,
+	DVLE_CONST_u8      = 0x1,
+	DVLE_CONST_FLOAT24 = 0x2,
+} DVLE_constantType;
+
+typedef enum
+{
+	RESULT_POSITION   = 0x0,
+	RESULT_NORMALQUAT = 0x1,
+	RESULT_COLOR      = 0x2,
+	RESULT_TEXCOORD0  = 0x3,
+	RESULT_TEXCOORD0W = 0x4,
+	RESULT_TEXCOORD1  = 0x5,
+	RESULT_TEXCOORD2  = 0x6,
+	RESULT_VIEW       = 0x8,
+	RESULT_DUMMY      = 0x9,
+} DVLE_outputAttribute_t;
+
+typedef struct
+{
+	u32 codeSize;
+	u32* codeData;
+	u32 opdescSize;
+	u32* opcdescData;
+} DVLP_s;
+
+typedef struct
+{
+	u16 type;
+	u16 id;
+	u32 data[4];
+} DVLE_constEntry_s;
+
+typedef struct
+{
+	u16 type;
+	u16 regID;
+	u8 mask;
+	u8 unk[3];
+} DVLE_outEntry_s;
+
+typedef struct
+{
+	u32 symbolOffset;
+	u16 startReg;
+	u16 endReg;
+} DVLE_uniformEntry_s;
+
+typedef struct
+{
+	DVLE_type type;
+	bool mergeOutmaps;
+	DVLP_s* dvlp;
+	u32 mainOffset;
+	u32 endmainOffset;
+	u32 constTableSize;
+	DVLE_constEntry_s* constTableData;
+	u32 outTableSize;
+	DVLE_outEntry_s* outTableData;
+	u32 uniformTableSize;
+	DVLE_uniformEntry_s* uniformTableData;
+	char* symbolTableData;
+	u8 outmapMask;
+	u32 outmapData[8];
+	u32 outmapMode;
+	u32 outmapClock;
+} DVLE_s;
+
+typedef struct
+{
+	u32 numDVLE;
+	DVLP_s DVLP;
+	DVLE_s* DVLE;
+} DVLB_s;
+
+typedef struct
+{
+	u32 id;
+	u32 data[3];
+} float24Uniform_s;
+
+typedef struct
+{
+	DVLE_s* dvle;
+	u16 boolUniforms;
+	u16 boolUniformMask;
+	u32 intUniforms[4];
+	float24Uniform_s* float24Uniforms;
+	u8 intUniformMask;
+	u8 numFloat24Uniforms;
+} shaderInstance_s;
+
+typedef struct
+{
+	shaderInstance_s* vertexShader;
+	shaderInstance_s* geometryShader;
+	u32 geoShaderInputPermutation[2];
+	u8 geoShaderInputStride;
+} shaderProgram_s;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+DVLB_s* DVLB_ParseFile(u32* shbinData, u32 shbinSize);
+void DVLB_Free(DVLB_s* dvlb);
+s8 DVLE_GetUniformRegister(DVLE_s* dvle, const char* name);
+void DVLE_GenerateOutmap(DVLE_s* dvle);
+
+Result shaderInstanceInit(shaderInstance_s* si, DVLE_s* dvle);
+Result shaderInstanceFree(shaderInstance_s* si);
+Result shaderInstanceSetBool(shaderInstance_s* si, int id, bool value);
+Result shaderInstanceGetBool(shaderInstance_s* si, int id, bool* value);
+s8 shaderInstanceGetUniformLocation(shaderInstance_s* si, const char* name);
+Result shaderProgramInit(shaderProgram_s* sp);
+Result shaderProgramFree(shaderProgram_s* sp);
+Result shaderProgramSetVsh(shaderProgram_s* sp, DVLE_s* dvle);
+Result shaderProgramConfigure(shaderProgram_s* sp, bool sendVshCode, bool sendGshCode);
+Result shaderProgramUse(shaderProgram_s* sp);
+
+/* ---------------------------------------------------------------------------
+ * Memory (3ds/allocator/linear.h, 3ds/allocator/vram.h, 3ds/os.h)
+ * ------------------------------------------------------------------------- */
+
+void* linearAlloc(size_t size);
+void* linearMemAlign(size_t size, size_t alignment);
+void* linearRealloc(void* mem, size_t size);
+size_t linearGetSize(void* mem);
+void linearFree(void* mem);
+u32 linearSpaceFree(void);
+
+void* vramAlloc(size_t size);
+void* vramMemAlign(size_t size, size_t alignment);
+void vramFree(void* mem);
+u32 vramSpaceFree(void);
+
+u32 osConvertVirtToPhys(const void* vaddr);
+
+/* ---------------------------------------------------------------------------
+ * GSP (3ds/services/gspgpu.h)
+ * ------------------------------------------------------------------------- */
+
+typedef enum
+{
+	GSPGPU_EVENT_PSC0 = 0,
+	GSPGPU_EVENT_PSC1,
+	GSPGPU_EVENT_VBlank0,
+	GSPGPU_EVENT_VBlank1,
+	GSPGPU_EVENT_PPF,
+	GSPGPU_EVENT_P3D,
+	GSPGPU_EVENT_DMA,
+	GSPGPU_EVENT_MAX,
+} GSPGPU_Event;
+
+typedef void (*ThreadFunc)(void *);
+
+void gspSetEventCallback(GSPGPU_Event id, ThreadFunc cb, void* data, bool oneShot);
+void gspWaitForEvent(GSPGPU_Event id, bool nextEvent);
+GSPGPU_Event gspWaitForAnyEvent(void);
+
+#define gspWaitForPSC0()  gspWaitForEvent(GSPGPU_EVENT_PSC0, false)
+#define gspWaitForPSC1()  gspWaitForEvent(GSPGPU_EVENT_PSC1, false)
+#define gspWaitForVBlank() gspWaitForVBlank0()
+#define gspWaitForVBlank0() gspWaitForEvent(GSPGPU_EVENT_VBlank0, true)
+#define gspWaitForVBlank1() gspWaitForEvent(GSPGPU_EVENT_VBlank1, true)
+#define gspWaitForPPF()   gspWaitForEvent(GSPGPU_EVENT_PPF, false)
+#define gspWaitForP3D()   gspWaitForEvent(GSPGPU_EVENT_P3D, false)
+#define gspWaitForDMA()   gspWaitForEvent(GSPGPU_EVENT_DMA, false)
+
+Result GSPGPU_FlushDataCache(const void* adr, u32 size);
+Result GSPGPU_InvalidateDataCache(const void* adr, u32 size);
+
+u64 svcGetSystemTick(void);
+
+/* ---------------------------------------------------------------------------
+ * Screens, input and applet loop, enough to run the examples headless
+ * ------------------------------------------------------------------------- */
+
+typedef enum
+{
+	GFX_TOP    = 0,
+	GFX_BOTTOM = 1,
+} gfxScreen_t;
+
+typedef enum
+{
+	GFX_LEFT  = 0,
+	GFX_RIGHT = 1,
+} gfx3dSide_t;
+
+typedef enum
+{
+	KEY_A      = BIT(0),
+	KEY_B      = BIT(1),
+	KEY_SELECT = BIT(2),
+	KEY_START  = BIT(3),
+	KEY_DRIGHT = BIT(4),
+	KEY_DLEFT  = BIT(5),
+	KEY_DUP    = BIT(6),
+	KEY_DDOWN  = BIT(7),
+	KEY_R      = BIT(8),
+	KEY_L      = BIT(9),
+	KEY_X      = BIT(10),
+	KEY_Y      = BIT(11),
+	KEY_ZL     = BIT(14),
+	KEY_ZR     = BIT(15),
+	KEY_TOUCH  = BIT(20),
+	KEY_CSTICK_RIGHT = BIT(24),
+	KEY_CSTICK_LEFT  = BIT(25),
+	KEY_CSTICK_UP    = BIT(26),
+	KEY_CSTICK_DOWN  = BIT(27),
+	KEY_CPAD_RIGHT = BIT(28),
+	KEY_CPAD_LEFT  = BIT(29),
+	KEY_CPAD_UP    = BIT(30),
+	KEY_CPAD_DOWN  = BIT(31),
+
+	KEY_UP    = KEY_DUP    | KEY_CPAD_UP,
+	KEY_DOWN  = KEY_DDOWN  | KEY_CPAD_DOWN,
+	KEY_LEFT  = KEY_DLEFT  | KEY_CPAD_LEFT,
+	KEY_RIGHT = KEY_DRIGHT | KEY_CPAD_RIGHT,
+} PAD_KEY;
+
+typedef enum
+{
+	GSP_RGBA8_OES   = 0,
+	GSP_BGR8_OES    = 1,
+	GSP_RGB565_OES  = 2,
+	GSP_RGB5_A1_OES = 3,
+	GSP_RGBA4_OES   = 4,
+} GSPGPU_FramebufferFormats;
+
+void gfxInitDefault(void);
+void gfxSetScreenFormat(gfxScreen_t screen, GSPGPU_FramebufferFormats format);
+void gfxExit(void);
+u8* gfxGetFramebuffer(gfxScreen_t screen, gfx3dSide_t side, u16* width, u16* height);
+void gfxFlushBuffers(void);
+void gfxSwapBuffers(void);
+void gfxSwapBuffersGpu(void);
+
+Result hidInit(void);
+void hidExit(void);
+void hidScanInput(void);
+u32 hidKeysDown(void);
+u32 hidKeysHeld(void);
+#define keysDown hidKeysDown
+#define keysHeld hidKeysHeld
+
+bool aptMainLoop(void);
+
+Result romfsInit(void);
+Result romfsExit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "3ds/gpu/gx.h"
@@ -0,0 +1,104 @@
+/**
+ * @file ctrgl_host.h
+ * @brief Inspection interface of the host stand-in for libctru.
+ * @description Every command list handed to GX is decoded into register writes, and every
+ * allocation, fill, transfer and frame boundary is appended to one event stream. Tests read
+ * the stream or the per-run counters to measure what the library sends to the GPU.
+ *
+ * Environment variables read by the stand-in:
+ *  - CTRGL_HOST_FRAMES: number of frames before aptMainLoop() returns false (default 10, 0 = forever)
+ *  - CTRGL_HOST_TRACE:  file the event stream is written to when gfxExit() is called
+ *  - CTRGL_HOST_STATS:  if set, the counters are printed to stderr when gfxExit() is called
+ *  - CTRGL_HOST_SCREEN: file the top screen is written to as a PPM when gfxExit() is called
+ *  - CTRGL_HOST_DEVICE: "sw" creates every device with CAELINA_SOFTWARE_DEVICE
+ *  - CTRGL_SW_THREADS:  threads the software device rasterizes with (default: one per core)
+ */
+#pragma once
+
+#include <3ds.h>
+#include <stdio.h>
+
+typedef enum
+{
+	CTRGL_HOST_EVENT_REG_WRITE = 0,    ///< a: register, b: value after the write, c: byte mask
+	CTRGL_HOST_EVENT_DRAW,             ///< a: vertex count, b: first vertex, c: 1 if indexed
+	CTRGL_HOST_EVENT_CMDLIST,          ///< a: physical address, b: size in bytes, c: flags
+	CTRGL_HOST_EVENT_LINEAR_ALLOC,     ///< a: physical address, b: size in bytes
+	CTRGL_HOST_EVENT_LINEAR_FREE,      ///< a: physical address, b: size in bytes
+	CTRGL_HOST_EVENT_VRAM_ALLOC,       ///< a: physical address, b: size in bytes
+	CTRGL_HOST_EVENT_VRAM_FREE,        ///< a: physical address, b: size in bytes
+	CTRGL_HOST_EVENT_MEMORY_FILL,      ///< a: physical address, b: size in bytes, c: fill value
+	CTRGL_HOST_EVENT_DISPLAY_TRANSFER, ///< a: source address, b: destination address, c: flags
+	CTRGL_HOST_EVENT_TEXTURE_COPY,     ///< a: source address, b: destination address, c: size in bytes
+	CTRGL_HOST_EVENT_DMA,              ///< a: source address, b: destination address, c: size in bytes
+	CTRGL_HOST_EVENT_CACHE_FLUSH,      ///< a: address, b: size in bytes
+	CTRGL_HOST_EVENT_FRAME,            ///< a: number of the frame that ended
+	CTRGL_HOST_EVENT_COUNT,
+} ctrglHostEventType;
+
+#define CTRGL_HOST_EVENTS_ALL 0xFFFFFFFF
+
+/// One entry of the recorded stream. Addresses are the fake physical addresses of the stand-in.
+typedef struct
+{
+	u32 type;  ///< ctrglHostEventType
+	u32 frame; ///< frame the event happened in
+	u32 a, b, c;
+} ctrglHostEvent;
+
+/// Counters accumulated since the start of the run or the last ctrglHostResetStats().
+typedef struct
+{
+	u32 frames;
+	u32 cmdLists;
+	u32 cmdBytes;
+	u32 regWrites;
+	u32 draws;
+	u32 vertices;
+	u32 shaderCodeWords; ///< words sent to the vertex shader code memory
+	u32 uniformWords;    ///< words sent to the vertex shader float uniforms
+	u32 linearAllocs;
+	u32 linearFrees;
+	u32 linearBytes;     ///< currently allocated
+	u32 linearPeak;
+	u32 vramAllocs;
+	u32 vramFrees;
+	u32 vramBytes;       ///< currently allocated
+	u32 vramPeak;
+	u32 fills;
+	u32 transfers;
+	u32 dmas;
+	u32 cacheFlushes;
+} ctrglHostStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Selects the event types that are recorded, as a mask of (1 << ctrglHostEventType).
+void ctrglHostSetEventMask(u32 mask);
+u32 ctrglHostEventCount(void);
+const ctrglHostEvent* ctrglHostEvents(void);
+void ctrglHostClearEvents(void);
+const char* ctrglHostEventName(u32 type);
+void ctrglHostWriteEvents(FILE* out);
+
+void ctrglHostGetStats(ctrglHostStats* stats);
+void ctrglHostResetStats(void);
+void ctrglHostPrintStats(FILE* out);
+
+/// Value of a PICA register after the last command list that was processed.
+u32 ctrglHostGetRegister(u16 reg);
+/// Maps a physical address of the linear heap or VRAM back to a host pointer, NULL otherwise.
+void* ctrglHostPhysToVirt(u32 paddr);
+
+/// Number of frames before aptMainLoop() returns false, 0 runs forever.
+void ctrglHostSetFrameLimit(u32 frames);
+/// Keys reported by hidKeysDown()/hidKeysHeld() after the next hidScanInput().
+void ctrglHostSetKeys(u32 down, u32 held);
+/// Writes the last frame shown on a screen as a binary PPM.
+bool ctrglHostWriteScreen(gfxScreen_t screen, const char* path);
+
+#ifdef __cplusplus
+}
+#endif
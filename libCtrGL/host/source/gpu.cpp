@@ -0,0 +1,73 @@
+#include "host_internal.h"
+#include <cstring>
+
+u32* gpuCmdBuf;
+u32 gpuCmdBufSize;
+u32 gpuCmdBufOffset;
+
+extern "C" {
+
+void GPUCMD_AddRawCommands(const u32* cmd, u32 size) {
+    if (!cmd || !size) return;
+    memcpy(&gpuCmdBuf[gpuCmdBufOffset], cmd, size*4);
+    gpuCmdBufOffset += size;
+}
+
+void GPUCMD_Add(u32 header, const u32* param, u32 paramlength) {
+    if (!paramlength) paramlength = 1;
+    if (!gpuCmdBuf || gpuCmdBufOffset+paramlength+1 > gpuCmdBufSize) return;
+
+    u32 zero = 0;
+    if (!param) param = &zero;
+
+    gpuCmdBuf[gpuCmdBufOffset] = param[0];
+    gpuCmdBuf[gpuCmdBufOffset+1] = header|((paramlength-1)<<20);
+
+    if (paramlength > 1) memcpy(&gpuCmdBuf[gpuCmdBufOffset+2], &param[1], (paramlength-1)*4);
+
+    gpuCmdBufOffset += paramlength+1;
+
+    if (!(paramlength&1)) gpuCmdBuf[gpuCmdBufOffset++] = 0x00000000; // alignment
+}
+
+void GPUCMD_Split(u32** addr, u32* size) {
+    GPUCMD_AddWrite(GPUREG_FINALIZE, 0x12345678);
+    if (gpuCmdBufOffset & 3) GPUCMD_AddWrite(GPUREG_FINALIZE, 0x12345678); // not 16-byte aligned
+
+    if (addr) *addr = gpuCmdBuf;
+    if (size) *size = gpuCmdBufOffset;
+
+    gpuCmdBuf += gpuCmdBufOffset;
+    gpuCmdBufSize -= gpuCmdBufOffset;
+    gpuCmdBufOffset = 0;
+}
+
+u32 f32tof24(float f) {
+    if (!f) return 0;
+
+    u32 v;
+    memcpy(&v, &f, 4);
+
+    u8 s = v>>31;
+    s32 exp = ((v>>23) & 0xFF) - 0x40;
+    u32 man = (v>>7) & 0xFFFF;
+
+    if (exp >= 0) return man | (exp<<16) | (s<<23);
+    else return s<<23;
+}
+
+u32 f32tof31(float f) {
+    if (!f) return 0;
+
+    u32 v;
+    memcpy(&v, &f, 4);
+
+    u8 s = v>>31;
+    s32 exp = ((v>>23) & 0xFF) - 0x40;
+    u32 man = v & 0x7FFFFF;
+
+    if (exp >= 0) return man | (exp<<23) | (s<<30);
+    else return s<<30;
+}
+
+}
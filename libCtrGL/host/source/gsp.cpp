@@ -0,0 +1,265 @@
+#include "host_internal.h"
+#include <cstring>
+
+struct host_callback {
+    ThreadFunc func = nullptr;
+    void *data = nullptr;
+    bool oneShot = false;
+};
+
+static host_callback callbacks[GSPGPU_EVENT_MAX];
+static u32 regs[0x400]; // PICA register file as left by the processed command lists
+
+void host_signal(GSPGPU_Event id) {
+    host_callback& cb = callbacks[id];
+    if (!cb.func) return;
+    ThreadFunc func = cb.func;
+    void *data = cb.data;
+    if (cb.oneShot) cb.func = nullptr;
+    func(data);
+}
+
+static void host_write_register(u16 reg, u32 value, u8 mask) {
+    u32 bytes = 0;
+    for (int i = 0; i < 4; i++) if (mask & (1 << i)) bytes |= 0xFFu << (i * 8);
+    regs[reg] = (regs[reg] & ~bytes) | (value & bytes);
+
+    ctrglHostStats& s = host_stats();
+    ++s.regWrites;
+    host_record(CTRGL_HOST_EVENT_REG_WRITE, reg, regs[reg], mask);
+
+    switch (reg) {
+        case GPUREG_VSH_CODETRANSFER_DATA ... GPUREG_VSH_CODETRANSFER_DATA + 7:
+            ++s.shaderCodeWords;
+            break;
+        case GPUREG_VSH_FLOATUNIFORM_DATA ... GPUREG_VSH_FLOATUNIFORM_DATA + 7:
+            ++s.uniformWords;
+            break;
+        case GPUREG_DRAWARRAYS:
+        case GPUREG_DRAWELEMENTS:
+            ++s.draws;
+            s.vertices += regs[GPUREG_NUMVERTICES];
+            host_record(CTRGL_HOST_EVENT_DRAW, regs[GPUREG_NUMVERTICES], regs[GPUREG_VERTEX_OFFSET], reg == GPUREG_DRAWELEMENTS);
+            break;
+    }
+}
+
+/* walks a command list the way the PICA command processor does: a parameter word, a header
+   word, then the remaining parameters padded to an even count */
+void host_process_command_list(const u32 *list, u32 words) {
+    u32 i = 0;
+    while (i + 1 < words) {
+        u32 header = list[i + 1];
+        u16 reg = header & 0x3FF;
+        u8 mask = (header >> 16) & 0xF;
+        u32 count = ((header >> 20) & 0xFF) + 1;
+        bool incremental = header >> 31;
+
+        for (u32 j = 0; j < count; j++) {
+            u32 value = j == 0 ? list[i] : list[i + 1 + j];
+            host_write_register(reg, value, mask);
+            if (incremental) reg = (reg + 1) & 0x3FF;
+        }
+
+        i += 1 + count;
+        i = (i + 1) & ~1;
+    }
+}
+
+static const u32 transfer_bpp[] = {4, 3, 2, 2, 2};
+
+// offset of pixel (x, y) in a buffer of 8x8 tiles, pixels inside a tile in Morton order
+static u32 tiled_offset(u32 x, u32 y, u32 width) {
+    u32 morton = (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) | ((x & 4) << 2) | ((y & 4) << 3);
+    return ((y >> 3) * (width >> 3) + (x >> 3)) * 64 + morton;
+}
+
+void host_decode_pixel(const u8 *p, u32 format, u8 rgba[4]) {
+    u16 v = p[0] | (p[1] << 8);
+    switch (format) {
+        case GX_TRANSFER_FMT_RGBA8:
+            rgba[0] = p[3]; rgba[1] = p[2]; rgba[2] = p[1]; rgba[3] = p[0];
+            break;
+        case GX_TRANSFER_FMT_RGB8:
+            rgba[0] = p[2]; rgba[1] = p[1]; rgba[2] = p[0]; rgba[3] = 0xFF;
+            break;
+        case GX_TRANSFER_FMT_RGB565:
+            rgba[0] = ((v >> 11) & 0x1F) * 255 / 31;
+            rgba[1] = ((v >> 5) & 0x3F) * 255 / 63;
+            rgba[2] = (v & 0x1F) * 255 / 31;
+            rgba[3] = 0xFF;
+            break;
+        case GX_TRANSFER_FMT_RGB5A1:
+            rgba[0] = ((v >> 11) & 0x1F) * 255 / 31;
+            rgba[1] = ((v >> 6) & 0x1F) * 255 / 31;
+            rgba[2] = ((v >> 1) & 0x1F) * 255 / 31;
+            rgba[3] = (v & 1) * 0xFF;
+            break;
+        default:
+            rgba[0] = ((v >> 12) & 0xF) * 0x11;
+            rgba[1] = ((v >> 8) & 0xF) * 0x11;
+            rgba[2] = ((v >> 4) & 0xF) * 0x11;
+            rgba[3] = (v & 0xF) * 0x11;
+            break;
+    }
+}
+
+static void encode_pixel(u8 *p, u32 format, const u8 rgba[4]) {
+    u16 v;
+    switch (format) {
+        case GX_TRANSFER_FMT_RGBA8:
+            p[0] = rgba[3]; p[1] = rgba[2]; p[2] = rgba[1]; p[3] = rgba[0];
+            return;
+        case GX_TRANSFER_FMT_RGB8:
+            p[0] = rgba[2]; p[1] = rgba[1]; p[2] = rgba[0];
+            return;
+        case GX_TRANSFER_FMT_RGB565:
+            v = ((rgba[0] >> 3) << 11) | ((rgba[1] >> 2) << 5) | (rgba[2] >> 3);
+            break;
+        case GX_TRANSFER_FMT_RGB5A1:
+            v = ((rgba[0] >> 3) << 11) | ((rgba[1] >> 3) << 6) | ((rgba[2] >> 3) << 1) | (rgba[3] >> 7);
+            break;
+        default:
+            v = ((rgba[0] >> 4) << 12) | ((rgba[1] >> 4) << 8) | ((rgba[2] >> 4) << 4) | (rgba[3] >> 4);
+            break;
+    }
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+extern "C" {
+
+u32 ctrglHostGetRegister(u16 reg) {
+    return reg < 0x400 ? regs[reg] : 0;
+}
+
+void gspSetEventCallback(GSPGPU_Event id, ThreadFunc cb, void* data, bool oneShot) {
+    if (id >= GSPGPU_EVENT_MAX) return;
+    callbacks[id].func = cb;
+    callbacks[id].data = data;
+    callbacks[id].oneShot = oneShot;
+}
+
+// every request completes before returning, so there is never anything to wait for
+void gspWaitForEvent(GSPGPU_Event id, bool nextEvent) {
+}
+
+GSPGPU_Event gspWaitForAnyEvent(void) {
+    return GSPGPU_EVENT_P3D;
+}
+
+Result GX_ProcessCommandList(u32* buf0a, u32 buf0s, u8 flags) {
+    ctrglHostStats& s = host_stats();
+    ++s.cmdLists;
+    s.cmdBytes += buf0s;
+    host_record(CTRGL_HOST_EVENT_CMDLIST, host_virt_to_phys(buf0a), buf0s, flags);
+
+    host_process_command_list(buf0a, buf0s / 4);
+    host_signal(GSPGPU_EVENT_P3D);
+    return 0;
+}
+
+static void host_fill(u32* start, u32 value, u32* end, u16 control) {
+    u8 *p = (u8*)start;
+    u8 *e = (u8*)end;
+    if (control & GX_FILL_32BIT_DEPTH) {
+        for (; p + 4 <= e; p += 4) memcpy(p, &value, 4);
+    } else if (control & GX_FILL_24BIT_DEPTH) {
+        for (; p + 3 <= e; p += 3) memcpy(p, &value, 3);
+    } else {
+        u16 v = value;
+        for (; p + 2 <= e; p += 2) memcpy(p, &v, 2);
+    }
+
+    ++host_stats().fills;
+    host_record(CTRGL_HOST_EVENT_MEMORY_FILL, host_virt_to_phys(start), e - (u8*)start, value);
+}
+
+Result GX_MemoryFill(u32* buf0a, u32 buf0v, u32* buf0e, u16 control0, u32* buf1a, u32 buf1v, u32* buf1e, u16 control1) {
+    if (buf0a) {
+        host_fill(buf0a, buf0v, buf0e, control0);
+        host_signal(GSPGPU_EVENT_PSC0);
+    }
+    if (buf1a) {
+        host_fill(buf1a, buf1v, buf1e, control1);
+        host_signal(GSPGPU_EVENT_PSC1);
+    }
+    return 0;
+}
+
+/* the transfer engine converts between the tiled layout the GPU renders to and the linear
+   layout of framebuffers, with optional format conversion, downscaling and vertical flip */
+Result GX_DisplayTransfer(u32* inadr, u32 indim, u32* outadr, u32 outdim, u32 flags) {
+    u32 inW = indim & 0xFFFF, inH = indim >> 16;
+    u32 outW = outdim & 0xFFFF, outH = outdim >> 16;
+    u32 inFmt = (flags >> 8) & 7, outFmt = (flags >> 12) & 7;
+    u32 scale = (flags >> 24) & 3;
+    bool flip = flags & GX_TRANSFER_FLIP_VERT(1);
+    bool outTiled = flags & GX_TRANSFER_OUT_TILED(1);
+    if (inFmt > GX_TRANSFER_FMT_RGBA4) inFmt = GX_TRANSFER_FMT_RGBA8;
+    if (outFmt > GX_TRANSFER_FMT_RGBA4) outFmt = GX_TRANSFER_FMT_RGBA8;
+
+    const u8 *src = (const u8*)inadr;
+    u8 *dst = (u8*)outadr;
+
+    if (flags & GX_TRANSFER_RAW_COPY(1)) {
+        memcpy(dst, src, inW * inH * transfer_bpp[inFmt]);
+    } else {
+        u32 sx = scale != GX_TRANSFER_SCALE_NO ? 2 : 1;
+        u32 sy = scale == GX_TRANSFER_SCALE_XY ? 2 : 1;
+        u32 w = inW / sx < outW ? inW / sx : outW;
+        u32 h = inH / sy < outH ? inH / sy : outH;
+
+        for (u32 y = 0; y < h; y++) {
+            for (u32 x = 0; x < w; x++) {
+                // box filter over the source pixels of a downscaled pixel
+                u32 sum[4] = {0, 0, 0, 0};
+                for (u32 j = 0; j < sy; j++) {
+                    for (u32 i = 0; i < sx; i++) {
+                        u32 ix = x * sx + i, iy = y * sy + j;
+                        u32 in = outTiled ? iy * inW + ix : tiled_offset(ix, iy, inW);
+                        u8 rgba[4];
+                        host_decode_pixel(src + in * transfer_bpp[inFmt], inFmt, rgba);
+                        for (int c = 0; c < 4; c++) sum[c] += rgba[c];
+                    }
+                }
+                u8 rgba[4];
+                for (int c = 0; c < 4; c++) rgba[c] = sum[c] / (sx * sy);
+
+                u32 oy = flip ? h - 1 - y : y;
+                u32 out = outTiled ? tiled_offset(x, oy, outW) : oy * outW + x;
+                encode_pixel(dst + out * transfer_bpp[outFmt], outFmt, rgba);
+            }
+        }
+    }
+
+    ++host_stats().transfers;
+    host_record(CTRGL_HOST_EVENT_DISPLAY_TRANSFER, host_virt_to_phys(inadr), host_virt_to_phys(outadr), flags);
+    host_signal(GSPGPU_EVENT_PPF);
+    return 0;
+}
+
+Result GX_TextureCopy(u32* inadr, u32 indim, u32* outadr, u32 outdim, u32 size, u32 flags) {
+    memcpy(outadr, inadr, size);
+    ++host_stats().transfers;
+    host_record(CTRGL_HOST_EVENT_TEXTURE_COPY, host_virt_to_phys(inadr), host_virt_to_phys(outadr), size);
+    host_signal(GSPGPU_EVENT_PPF);
+    return 0;
+}
+
+Result GX_RequestDma(u32* src, u32* dst, u32 length) {
+    memcpy(dst, src, length);
+    ++host_stats().dmas;
+    host_record(CTRGL_HOST_EVENT_DMA, host_virt_to_phys(src), host_virt_to_phys(dst), length);
+    host_signal(GSPGPU_EVENT_DMA);
+    return 0;
+}
+
+Result GX_FlushCacheRegions(u32* buf0a, u32 buf0s, u32* buf1a, u32 buf1s, u32* buf2a, u32 buf2s) {
+    if (buf0a) GSPGPU_FlushDataCache(buf0a, buf0s);
+    if (buf1a) GSPGPU_FlushDataCache(buf1a, buf1s);
+    if (buf2a) GSPGPU_FlushDataCache(buf2a, buf2s);
+    return 0;
+}
+
+}
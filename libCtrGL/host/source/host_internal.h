@@ -0,0 +1,29 @@
+#ifndef HOST_INTERNAL_H
+#define HOST_INTERNAL_H
+
+#include <3ds.h>
+#include <ctrgl_host.h>
+
+#define HOST_LINEAR_BASE 0x20000000
+#define HOST_LINEAR_SIZE 0x04000000
+#define HOST_VRAM_BASE   0x18000000
+#define HOST_VRAM_SIZE   0x00600000
+
+/* recorder.cpp */
+void host_record(ctrglHostEventType type, u32 a, u32 b = 0, u32 c = 0);
+ctrglHostStats& host_stats();
+u32 host_frame();
+
+/* memory.cpp */
+u32 host_virt_to_phys(const void *addr);
+
+/* gsp.cpp */
+void host_signal(GSPGPU_Event id);
+void host_process_command_list(const u32 *list, u32 words);
+void host_decode_pixel(const u8 *p, u32 format, u8 rgba[4]);
+
+/* system.cpp */
+void host_init_env();
+void host_exit_env();
+
+#endif
@@ -0,0 +1,155 @@
+#include "host_internal.h"
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+/* linear heap and VRAM are two host arenas mapped to fake physical addresses, so the 32-bit
+   addresses the library puts into command lists can be translated back */
+struct host_arena {
+    ctrglHostEventType allocEvent;
+    u32 base; // physical address of the first byte
+    u32 size;
+    u8 *data = nullptr;
+    std::map<u32, u32> blocks; // offset -> size of every live allocation
+
+    host_arena(ctrglHostEventType ev, u32 b, u32 s) : allocEvent(ev), base(b), size(s) {}
+
+    void *alloc(size_t bytes, size_t alignment) {
+        if (!data) {
+            data = (u8*)aligned_alloc(0x1000, size);
+            if (!data) return nullptr;
+        }
+        if (bytes == 0) bytes = 1;
+        if (alignment < 0x80) alignment = 0x80;
+        bytes = (bytes + 0x7F) & ~0x7F;
+
+        // first fit over the gaps between live blocks
+        u32 offset = 0;
+        for (auto it = blocks.begin(); ; ++it) {
+            u32 start = (offset + alignment - 1) & ~(alignment - 1);
+            u32 end = it == blocks.end() ? size : it->first;
+            if (start <= end && end - start >= bytes) {
+                blocks[start] = bytes;
+                record(true, start, bytes);
+                return data + start;
+            }
+            if (it == blocks.end()) return nullptr;
+            offset = it->first + it->second;
+        }
+    }
+
+    bool owns(const void *mem) const {
+        return data && (const u8*)mem >= data && (const u8*)mem < data + size;
+    }
+
+    u32 block_size(const void *mem) const {
+        auto it = blocks.find((const u8*)mem - data);
+        return it == blocks.end() ? 0 : it->second;
+    }
+
+    void free(void *mem) {
+        auto it = blocks.find((u8*)mem - data);
+        if (it == blocks.end()) return;
+        record(false, it->first, it->second);
+        blocks.erase(it);
+    }
+
+    u32 space_free() const {
+        u32 used = 0;
+        for (auto& b : blocks) used += b.second;
+        return size - used;
+    }
+
+    void record(bool alloc, u32 offset, u32 bytes) {
+        ctrglHostStats& s = host_stats();
+        bool linear = allocEvent == CTRGL_HOST_EVENT_LINEAR_ALLOC;
+        u32& live = linear ? s.linearBytes : s.vramBytes;
+        u32& peak = linear ? s.linearPeak : s.vramPeak;
+        if (alloc) {
+            ++(linear ? s.linearAllocs : s.vramAllocs);
+            live += bytes;
+            if (live > peak) peak = live;
+        } else {
+            ++(linear ? s.linearFrees : s.vramFrees);
+            live -= bytes;
+        }
+        host_record((ctrglHostEventType)(allocEvent + (alloc ? 0 : 1)), base + offset, bytes);
+    }
+};
+
+static host_arena linearHeap(CTRGL_HOST_EVENT_LINEAR_ALLOC, HOST_LINEAR_BASE, HOST_LINEAR_SIZE);
+static host_arena vramHeap(CTRGL_HOST_EVENT_VRAM_ALLOC, HOST_VRAM_BASE, HOST_VRAM_SIZE);
+
+u32 host_virt_to_phys(const void *addr) {
+    if (linearHeap.owns(addr)) return linearHeap.base + ((const u8*)addr - linearHeap.data);
+    if (vramHeap.owns(addr)) return vramHeap.base + ((const u8*)addr - vramHeap.data);
+    return 0;
+}
+
+extern "C" {
+
+void* linearAlloc(size_t size) {
+    return linearHeap.alloc(size, 0x80);
+}
+
+void* linearMemAlign(size_t size, size_t alignment) {
+    return linearHeap.alloc(size, alignment);
+}
+
+void* linearRealloc(void* mem, size_t size) {
+    return NULL; // not implemented by libctru either
+}
+
+size_t linearGetSize(void* mem) {
+    return linearHeap.block_size(mem);
+}
+
+void linearFree(void* mem) {
+    if (mem) linearHeap.free(mem);
+}
+
+u32 linearSpaceFree(void) {
+    return linearHeap.space_free();
+}
+
+void* vramAlloc(size_t size) {
+    return vramHeap.alloc(size, 0x80);
+}
+
+void* vramMemAlign(size_t size, size_t alignment) {
+    return vramHeap.alloc(size, alignment);
+}
+
+void vramFree(void* mem) {
+    if (mem) vramHeap.free(mem);
+}
+
+u32 vramSpaceFree(void) {
+    return vramHeap.space_free();
+}
+
+u32 osConvertVirtToPhys(const void* vaddr) {
+    return host_virt_to_phys(vaddr);
+}
+
+void* ctrglHostPhysToVirt(u32 paddr) {
+    if (linearHeap.data && paddr >= linearHeap.base && paddr - linearHeap.base < linearHeap.size) {
+        return linearHeap.data + (paddr - linearHeap.base);
+    }
+    if (vramHeap.data && paddr >= vramHeap.base && paddr - vramHeap.base < vramHeap.size) {
+        return vramHeap.data + (paddr - vramHeap.base);
+    }
+    return NULL;
+}
+
+Result GSPGPU_FlushDataCache(const void* adr, u32 size) {
+    ++host_stats().cacheFlushes;
+    host_record(CTRGL_HOST_EVENT_CACHE_FLUSH, host_virt_to_phys(adr), size);
+    return 0;
+}
+
+Result GSPGPU_InvalidateDataCache(const void* adr, u32 size) {
+    return 0;
+}
+
+}
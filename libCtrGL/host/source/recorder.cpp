@@ -0,0 +1,100 @@
+#include "host_internal.h"
+#include <cstring>
+#include <vector>
+
+static std::vector<ctrglHostEvent> events;
+static u32 eventMask = CTRGL_HOST_EVENTS_ALL;
+static ctrglHostStats stats;
+
+static const char *event_names[CTRGL_HOST_EVENT_COUNT] = {
+    "reg_write",
+    "draw",
+    "cmdlist",
+    "linear_alloc",
+    "linear_free",
+    "vram_alloc",
+    "vram_free",
+    "memory_fill",
+    "display_transfer",
+    "texture_copy",
+    "dma",
+    "cache_flush",
+    "frame",
+};
+
+void host_record(ctrglHostEventType type, u32 a, u32 b, u32 c) {
+    if (!(eventMask & (1u << type))) return;
+    ctrglHostEvent ev;
+    ev.type = type;
+    ev.frame = stats.frames;
+    ev.a = a;
+    ev.b = b;
+    ev.c = c;
+    events.push_back(ev);
+}
+
+ctrglHostStats& host_stats() {
+    return stats;
+}
+
+u32 host_frame() {
+    return stats.frames;
+}
+
+extern "C" {
+
+void ctrglHostSetEventMask(u32 mask) {
+    eventMask = mask;
+}
+
+u32 ctrglHostEventCount(void) {
+    return events.size();
+}
+
+const ctrglHostEvent* ctrglHostEvents(void) {
+    return events.empty() ? NULL : &events[0];
+}
+
+void ctrglHostClearEvents(void) {
+    events.clear();
+}
+
+const char* ctrglHostEventName(u32 type) {
+    return type < CTRGL_HOST_EVENT_COUNT ? event_names[type] : "unknown";
+}
+
+void ctrglHostWriteEvents(FILE* out) {
+    for (const ctrglHostEvent& ev : events) {
+        fprintf(out, "%u %s 0x%08X 0x%08X 0x%08X\n", ev.frame, ctrglHostEventName(ev.type), ev.a, ev.b, ev.c);
+    }
+}
+
+void ctrglHostGetStats(ctrglHostStats* out) {
+    *out = stats;
+}
+
+void ctrglHostResetStats(void) {
+    // live allocation sizes carry over, everything else restarts from zero
+    u32 linearBytes = stats.linearBytes;
+    u32 vramBytes = stats.vramBytes;
+    memset(&stats, 0, sizeof(stats));
+    stats.linearBytes = stats.linearPeak = linearBytes;
+    stats.vramBytes = stats.vramPeak = vramBytes;
+}
+
+void ctrglHostPrintStats(FILE* out) {
+    fprintf(out, "frames          %u\n", stats.frames);
+    fprintf(out, "command lists   %u (%u bytes)\n", stats.cmdLists, stats.cmdBytes);
+    fprintf(out, "register writes %u\n", stats.regWrites);
+    fprintf(out, "draws           %u (%u vertices)\n", stats.draws, stats.vertices);
+    fprintf(out, "shader code     %u words\n", stats.shaderCodeWords);
+    fprintf(out, "float uniforms  %u words\n", stats.uniformWords);
+    fprintf(out, "linear          %u allocs, %u frees, %u bytes live, %u peak\n", stats.linearAllocs, stats.linearFrees, stats.linearBytes, stats.linearPeak);
+    fprintf(out, "vram            %u allocs, %u frees, %u bytes live, %u peak\n", stats.vramAllocs, stats.vramFrees, stats.vramBytes, stats.vramPeak);
+    fprintf(out, "fills           %u\n", stats.fills);
+    fprintf(out, "transfers       %u\n", stats.transfers);
+    fprintf(out, "dma             %u\n", stats.dmas);
+    fprintf(out, "cache flushes   %u\n", stats.cacheFlushes);
+}
+
+}
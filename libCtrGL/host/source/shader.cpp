@@ -0,0 +1,290 @@
+#include "host_internal.h"
+#include <cstdlib>
+#include <cstring>
+
+/* shader binary parsing and program setup, following libctru's shbin.c and shaderProgram.c so
+   the recorded command lists match what the console build sends */
+
+extern "C" {
+
+DVLB_s* DVLB_ParseFile(u32* shbinData, u32 shbinSize) {
+    if (!shbinData) return NULL;
+    DVLB_s* ret = (DVLB_s*)malloc(sizeof(DVLB_s));
+    if (!ret) return NULL;
+
+    // DVLB
+    ret->numDVLE = shbinData[1];
+    ret->DVLE = (DVLE_s*)malloc(sizeof(DVLE_s)*ret->numDVLE);
+    if (!ret->DVLE) {
+        free(ret);
+        return NULL;
+    }
+
+    // DVLP
+    u32* dvlpData = &shbinData[2+ret->numDVLE];
+    ret->DVLP.codeSize = dvlpData[3];
+    ret->DVLP.codeData = &dvlpData[dvlpData[2]/4];
+    ret->DVLP.opdescSize = dvlpData[5];
+    ret->DVLP.opcdescData = (u32*)malloc(sizeof(u32)*ret->DVLP.opdescSize);
+    if (!ret->DVLP.opcdescData) {
+        free(ret->DVLE);
+        free(ret);
+        return NULL;
+    }
+    for (u32 i = 0; i < ret->DVLP.opdescSize; i++) ret->DVLP.opcdescData[i] = dvlpData[dvlpData[4]/4+i*2];
+
+    // DVLE
+    for (u32 i = 0; i < ret->numDVLE; i++) {
+        DVLE_s* dvle = &ret->DVLE[i];
+        u32* dvleData = &shbinData[shbinData[2+i]/4];
+
+        dvle->dvlp = &ret->DVLP;
+
+        dvle->type = (DVLE_type)((dvleData[1]>>16)&0xFF);
+        dvle->mergeOutmaps = (dvleData[1]>>24)&1;
+        dvle->mainOffset = dvleData[2];
+        dvle->endmainOffset = dvleData[3];
+
+        dvle->constTableSize = dvleData[7];
+        dvle->constTableData = (DVLE_constEntry_s*)&dvleData[dvleData[6]/4];
+
+        dvle->outTableSize = dvleData[11];
+        dvle->outTableData = (DVLE_outEntry_s*)&dvleData[dvleData[10]/4];
+
+        dvle->uniformTableSize = dvleData[13];
+        dvle->uniformTableData = (DVLE_uniformEntry_s*)&dvleData[dvleData[12]/4];
+
+        dvle->symbolTableData = (char*)&dvleData[dvleData[14]/4];
+
+        DVLE_GenerateOutmap(dvle);
+    }
+
+    return ret;
+}
+
+void DVLB_Free(DVLB_s* dvlb) {
+    if (!dvlb) return;
+    if (dvlb->DVLP.opcdescData) free(dvlb->DVLP.opcdescData);
+    if (dvlb->DVLE) free(dvlb->DVLE);
+    free(dvlb);
+}
+
+s8 DVLE_GetUniformRegister(DVLE_s* dvle, const char* name) {
+    if (!dvle || !name) return -1;
+    DVLE_uniformEntry_s* u = dvle->uniformTableData;
+    for (u32 i = 0; i < dvle->uniformTableSize; i++, u++) {
+        if (!strcmp(&dvle->symbolTableData[u->symbolOffset], name)) return (s8)u->startReg-0x10;
+    }
+    return -1;
+}
+
+void DVLE_GenerateOutmap(DVLE_s* dvle) {
+    if (!dvle) return;
+
+    memset(dvle->outmapData, 0x1F, sizeof(dvle->outmapData));
+
+    u8 numAttr = 0;
+    u8 attrMask = 0;
+    u32 attrMode = 0;
+    u32 attrClock = 0;
+
+    for (u32 i = 0; i < dvle->outTableSize; i++) {
+        u32* out = &dvle->outmapData[dvle->outTableData[i].regID+1];
+        u32 mask = 0;
+        u8 tmpmask = dvle->outTableData[i].mask;
+        for (int j = 0; j < 4; j++, tmpmask <<= 1) mask = (mask<<8)|((tmpmask&8) ? 0xFF : 0x00);
+
+        if (*out == 0x1F1F1F1F) numAttr++;
+
+        u32 val = 0x1F1F1F1F;
+        switch (dvle->outTableData[i].type) {
+            case RESULT_POSITION:   val = 0x03020100; break;
+            case RESULT_NORMALQUAT: val = 0x07060504; attrClock |= BIT(24); break;
+            case RESULT_COLOR:      val = 0x0B0A0908; attrClock |= BIT(1); break;
+            case RESULT_TEXCOORD0:  val = 0x1F1F0D0C; attrMode = 1; attrClock |= BIT(8); break;
+            case RESULT_TEXCOORD0W: val = 0x10101010; attrMode = 1; attrClock |= BIT(16); break;
+            case RESULT_TEXCOORD1:  val = 0x1F1F0F0E; attrMode = 1; attrClock |= BIT(9); break;
+            case RESULT_TEXCOORD2:  val = 0x1F1F1716; attrMode = 1; attrClock |= BIT(10); break;
+            case RESULT_VIEW:       val = 0x1F141312; attrClock |= BIT(24); break;
+            default: break;
+        }
+
+        *out = ((*out)&~mask)|(val&mask);
+        attrMask |= 1<<dvle->outTableData[i].regID;
+    }
+
+    dvle->outmapData[0] = numAttr;
+    dvle->outmapMask = attrMask;
+    dvle->outmapMode = attrMode;
+    dvle->outmapClock = attrClock;
+}
+
+Result shaderInstanceInit(shaderInstance_s* si, DVLE_s* dvle) {
+    if (!si || !dvle) return -1;
+
+    si->dvle = dvle;
+    si->boolUniforms = 0;
+    si->boolUniformMask = 0;
+    memset(si->intUniforms, 0, sizeof(si->intUniforms));
+    si->float24Uniforms = NULL;
+    si->intUniformMask = 0;
+    si->numFloat24Uniforms = 0;
+
+    DVLE_constEntry_s* cnst = dvle->constTableData;
+    if (!cnst) return 0;
+
+    int float24cnt = 0;
+    for (u32 i = 0; i < dvle->constTableSize; i++) {
+        switch (cnst[i].type) {
+            case DVLE_CONST_BOOL:
+                shaderInstanceSetBool(si, cnst[i].id, cnst[i].data[0]&1);
+                si->boolUniformMask |= 1<<cnst[i].id;
+                break;
+            case DVLE_CONST_u8:
+                if (cnst[i].id < 4) {
+                    si->intUniforms[cnst[i].id] = cnst[i].data[0];
+                    si->intUniformMask |= 1<<cnst[i].id;
+                }
+                break;
+            case DVLE_CONST_FLOAT24:
+                float24cnt++;
+                break;
+        }
+    }
+
+    if (float24cnt) {
+        si->float24Uniforms = (float24Uniform_s*)malloc(sizeof(float24Uniform_s)*float24cnt);
+        if (!si->float24Uniforms) return 0;
+
+        float24cnt = 0;
+        for (u32 i = 0; i < dvle->constTableSize; i++) {
+            if (cnst[i].type != DVLE_CONST_FLOAT24) continue;
+
+            // four packed 24 bit components, highest word first
+            u32 rev[3];
+            u8* rev8 = (u8*)rev;
+            memcpy(&rev8[0], &cnst[i].data[0], 3);
+            memcpy(&rev8[3], &cnst[i].data[1], 3);
+            memcpy(&rev8[6], &cnst[i].data[2], 3);
+            memcpy(&rev8[9], &cnst[i].data[3], 3);
+
+            si->float24Uniforms[float24cnt].id = cnst[i].id&0xFF;
+            si->float24Uniforms[float24cnt].data[0] = rev[2];
+            si->float24Uniforms[float24cnt].data[1] = rev[1];
+            si->float24Uniforms[float24cnt].data[2] = rev[0];
+            float24cnt++;
+        }
+        si->numFloat24Uniforms = float24cnt;
+    }
+
+    return 0;
+}
+
+Result shaderInstanceFree(shaderInstance_s* si) {
+    if (!si) return -1;
+    if (si->float24Uniforms) free(si->float24Uniforms);
+    free(si);
+    return 0;
+}
+
+Result shaderInstanceSetBool(shaderInstance_s* si, int id, bool value) {
+    if (!si) return -1;
+    if (id < 0 || id > 15) return -2;
+    si->boolUniforms &= ~(1<<id);
+    si->boolUniforms |= (value)<<id;
+    return 0;
+}
+
+Result shaderInstanceGetBool(shaderInstance_s* si, int id, bool* value) {
+    if (!si) return -1;
+    if (id < 0 || id > 15) return -2;
+    if (!value) return -3;
+    *value = (si->boolUniforms>>id)&1;
+    return 0;
+}
+
+s8 shaderInstanceGetUniformLocation(shaderInstance_s* si, const char* name) {
+    if (!si) return -1;
+    return DVLE_GetUniformRegister(si->dvle, name);
+}
+
+Result shaderProgramInit(shaderProgram_s* sp) {
+    if (!sp) return -1;
+    memset(sp, 0, sizeof(*sp));
+    return 0;
+}
+
+Result shaderProgramFree(shaderProgram_s* sp) {
+    if (!sp) return -1;
+    shaderInstanceFree(sp->vertexShader);
+    shaderInstanceFree(sp->geometryShader);
+    sp->vertexShader = sp->geometryShader = NULL;
+    return 0;
+}
+
+Result shaderProgramSetVsh(shaderProgram_s* sp, DVLE_s* dvle) {
+    if (!sp || !dvle) return -1;
+    if (dvle->type != VERTEX_SHDR) return -2;
+
+    if (sp->vertexShader) shaderInstanceFree(sp->vertexShader);
+
+    sp->vertexShader = (shaderInstance_s*)malloc(sizeof(shaderInstance_s));
+    if (!sp->vertexShader) return -3;
+
+    return shaderInstanceInit(sp->vertexShader, dvle);
+}
+
+Result shaderProgramConfigure(shaderProgram_s* sp, bool sendVshCode, bool sendGshCode) {
+    if (!sp || !sp->vertexShader) return -1;
+
+    shaderInstance_s* vsh = sp->vertexShader;
+    DVLE_s* dvle = vsh->dvle;
+    DVLP_s* dvlp = dvle->dvlp;
+
+    // no geometry shader
+    GPUCMD_AddMaskedWrite(GPUREG_GEOSTAGE_CONFIG, 0x3, 0x00000000);
+    GPUCMD_AddMaskedWrite(GPUREG_GEOSTAGE_CONFIG2, 0x3, 0x00000000);
+    GPUCMD_AddWrite(GPUREG_VSH_COM_MODE, 0x00000000);
+
+    if (sendVshCode) {
+        u32 size = dvlp->codeSize < 512 ? dvlp->codeSize : 512;
+        GPUCMD_AddWrite(GPUREG_VSH_CODETRANSFER_CONFIG, 0);
+        for (u32 i = 0; i < size; i += 0x80) {
+            GPUCMD_AddWrites(GPUREG_VSH_CODETRANSFER_DATA, &dvlp->codeData[i], size-i < 0x80 ? size-i : 0x80);
+        }
+        GPUCMD_AddWrite(GPUREG_VSH_CODETRANSFER_END, 1);
+
+        size = dvlp->opdescSize < 128 ? dvlp->opdescSize : 128;
+        GPUCMD_AddWrite(GPUREG_VSH_OPDESCS_CONFIG, 0);
+        for (u32 i = 0; i < size; i += 0x80) {
+            GPUCMD_AddWrites(GPUREG_VSH_OPDESCS_DATA, &dvlp->opcdescData[i], size-i < 0x80 ? size-i : 0x80);
+        }
+    }
+
+    GPUCMD_AddWrite(GPUREG_VSH_ENTRYPOINT, 0x7FFF0000|(dvle->mainOffset&0xFFFF));
+    GPUCMD_AddWrite(GPUREG_VSH_OUTMAP_MASK, dvle->outmapMask);
+
+    GPUCMD_AddWrite(GPUREG_VSH_BOOLUNIFORM, 0x7FFF0000|vsh->boolUniforms);
+    GPUCMD_AddIncrementalWrites(GPUREG_VSH_INTUNIFORM_I0, vsh->intUniforms, 4);
+    for (int i = 0; i < vsh->numFloat24Uniforms; i++) {
+        GPUCMD_AddWrite(GPUREG_VSH_FLOATUNIFORM_CONFIG, vsh->float24Uniforms[i].id);
+        GPUCMD_AddWrites(GPUREG_VSH_FLOATUNIFORM_DATA, vsh->float24Uniforms[i].data, 3);
+    }
+
+    u32 numAttr = dvle->outmapData[0];
+    GPUCMD_AddWrite(GPUREG_VSH_OUTMAP_TOTAL1, numAttr-1);
+    GPUCMD_AddWrite(GPUREG_VSH_OUTMAP_TOTAL2, numAttr-1);
+    GPUCMD_AddMaskedWrite(GPUREG_PRIMITIVE_CONFIG, 0x1, numAttr-1);
+    GPUCMD_AddWrite(GPUREG_SH_OUTMAP_TOTAL, numAttr);
+    GPUCMD_AddIncrementalWrites(GPUREG_SH_OUTMAP_O0, &dvle->outmapData[1], 7);
+    GPUCMD_AddWrite(GPUREG_SH_OUTATTR_MODE, dvle->outmapMode);
+    GPUCMD_AddWrite(GPUREG_SH_OUTATTR_CLOCK, dvle->outmapClock);
+
+    return 0;
+}
+
+Result shaderProgramUse(shaderProgram_s* sp) {
+    return shaderProgramConfigure(sp, true, true);
+}
+
+}
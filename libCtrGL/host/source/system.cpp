@@ -0,0 +1,159 @@
+#include "host_internal.h"
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+struct host_screen {
+    u16 width; // the screens are mounted sideways, width is the short side
+    u16 height;
+    GSPGPU_FramebufferFormats format = GSP_BGR8_OES;
+    u8 *buffers[2] = {nullptr, nullptr}; // left and right
+
+    host_screen(u16 w, u16 h) : width(w), height(h) {}
+};
+
+static host_screen screens[2] = {host_screen(240, 400), host_screen(240, 320)};
+static u32 frameLimit = 10;
+static u32 keysDownNext, keysHeldNext;
+static u32 keysDownNow, keysHeldNow;
+
+void host_init_env() {
+    const char *frames = getenv("CTRGL_HOST_FRAMES");
+    if (frames) frameLimit = strtoul(frames, NULL, 0);
+}
+
+void host_exit_env() {
+    const char *trace = getenv("CTRGL_HOST_TRACE");
+    if (trace) {
+        FILE *out = fopen(trace, "w");
+        if (out) {
+            ctrglHostWriteEvents(out);
+            fclose(out);
+        }
+    }
+    if (getenv("CTRGL_HOST_STATS")) ctrglHostPrintStats(stderr);
+    const char *screen = getenv("CTRGL_HOST_SCREEN");
+    if (screen) ctrglHostWriteScreen(GFX_TOP, screen);
+}
+
+extern "C" {
+
+u64 svcGetSystemTick(void) {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * SYSCLOCK_ARM11 + (u64)ts.tv_nsec * SYSCLOCK_ARM11 / 1000000000ULL;
+}
+
+void gfxInitDefault(void) {
+    host_init_env();
+    for (host_screen& s : screens) {
+        // room for the widest format so gfxSetScreenFormat never has to reallocate
+        for (int side = 0; side < (&s == &screens[GFX_TOP] ? 2 : 1); side++) {
+            if (!s.buffers[side]) s.buffers[side] = (u8*)linearAlloc(s.width * s.height * 4);
+        }
+    }
+}
+
+void gfxSetScreenFormat(gfxScreen_t screen, GSPGPU_FramebufferFormats format) {
+    screens[screen].format = format;
+}
+
+void gfxExit(void) {
+    host_exit_env();
+    for (host_screen& s : screens) {
+        for (u8 *&buf : s.buffers) {
+            linearFree(buf);
+            buf = nullptr;
+        }
+    }
+}
+
+u8* gfxGetFramebuffer(gfxScreen_t screen, gfx3dSide_t side, u16* width, u16* height) {
+    host_screen& s = screens[screen];
+    if (width) *width = s.width;
+    if (height) *height = s.height;
+    u8 *buf = s.buffers[side];
+    return buf ? buf : s.buffers[GFX_LEFT];
+}
+
+void gfxFlushBuffers(void) {
+    for (host_screen& s : screens) {
+        if (s.buffers[GFX_LEFT]) GSPGPU_FlushDataCache(s.buffers[GFX_LEFT], s.width * s.height * 4);
+    }
+}
+
+void gfxSwapBuffers(void) {
+    ctrglHostStats& s = host_stats();
+    host_record(CTRGL_HOST_EVENT_FRAME, s.frames);
+    ++s.frames;
+}
+
+void gfxSwapBuffersGpu(void) {
+    gfxSwapBuffers();
+}
+
+Result hidInit(void) {
+    return 0;
+}
+
+void hidExit(void) {
+}
+
+void hidScanInput(void) {
+    keysDownNow = keysDownNext;
+    keysHeldNow = keysHeldNext;
+    keysDownNext = 0;
+}
+
+u32 hidKeysDown(void) {
+    return keysDownNow;
+}
+
+u32 hidKeysHeld(void) {
+    return keysHeldNow;
+}
+
+bool aptMainLoop(void) {
+    return frameLimit == 0 || host_frame() < frameLimit;
+}
+
+Result romfsInit(void) {
+    return 0;
+}
+
+Result romfsExit(void) {
+    return 0;
+}
+
+void ctrglHostSetFrameLimit(u32 frames) {
+    frameLimit = frames;
+}
+
+void ctrglHostSetKeys(u32 down, u32 held) {
+    keysDownNext = down;
+    keysHeldNext = held;
+}
+
+bool ctrglHostWriteScreen(gfxScreen_t screen, const char* path) {
+    host_screen& s = screens[screen];
+    if (!s.buffers[GFX_LEFT]) return false;
+    FILE *out = fopen(path, "wb");
+    if (!out) return false;
+
+    static const u32 bpp[] = {4, 3, 2, 2, 2};
+    u32 b = bpp[s.format];
+
+    // rotate the sideways framebuffer back into a landscape image
+    fprintf(out, "P6\n%u %u\n255\n", s.height, s.width);
+    for (u32 y = 0; y < s.width; y++) {
+        for (u32 x = 0; x < s.height; x++) {
+            u8 rgba[4];
+            host_decode_pixel(s.buffers[GFX_LEFT] + (x * s.width + (s.width - 1 - y)) * b, s.format, rgba);
+            fwrite(rgba, 1, 3, out);
+        }
+    }
+    fclose(out);
+    return true;
+}
+
+}
@@ -0,0 +1,81 @@
+/* checks what the 3ds device sends to the GPU for draws whose state didn't change, run through
+   "make -f MakefileHost test" */
+
+#include <3ds.h>
+#include <GL/gl.h>
+#include <gfx_device.h>
+#include <ctrgl_host.h>
+#include <cstdio>
+
+static int failed = 0;
+
+#define CHECK(cond, ...) \
+    if (!(cond)) { \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        ++failed; \
+    }
+
+/* counters of one call to draw */
+template <typename F>
+static ctrglHostStats measure(F draw) {
+    ctrglHostResetStats();
+    draw();
+    ctrglHostStats stats;
+    ctrglHostGetStats(&stats);
+    return stats;
+}
+
+int main() {
+    gfxInitDefault();
+    void *device = gfxCreateDevice(240, 400, 0);
+    gfxMakeCurrent(device);
+
+    glViewport(0, 0, 240, 400);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glFrustum(-0.1, 0.1, -0.1, 0.1, 0.1, 100);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glTranslatef(0, 0, -2);
+    glEnable(GL_DEPTH_TEST);
+
+    GLfloat *vertices = (GLfloat *)linearAlloc(9 * sizeof(GLfloat));
+    const GLfloat triangle[9] = {1, 0, 0, 0, 1, 0, -1, 0, 0};
+    for (int i = 0; i < 9; ++i) vertices[i] = triangle[i];
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, vertices);
+
+    auto draw = [] { glDrawArrays(GL_TRIANGLES, 0, 3); };
+    ctrglHostStats first = measure(draw);
+    ctrglHostSetEventMask(1 << CTRGL_HOST_EVENT_REG_WRITE);
+    ctrglHostClearEvents();
+    ctrglHostStats again = measure(draw);
+
+    // rasterizer, texture and fragment state all sit in 0x040-0x10F, only the end of the list touches them
+    u32 stateWrites = 0;
+    for (u32 i = 0; i < ctrglHostEventCount(); ++i) {
+        u32 reg = ctrglHostEvents()[i].a;
+        if (reg >= GPUREG_FACECULLING_CONFIG && reg < GPUREG_FRAMEBUFFER_INVALIDATE && reg != GPUREG_EARLYDEPTH_CLEAR) {
+            printf("register %03x written again\n", reg);
+            ++stateWrites;
+        }
+    }
+    printf("register writes: %u for the first draw, %u for the same draw again\n", first.regWrites, again.regWrites);
+
+    CHECK(first.draws == 1 && again.draws == 1, "draws %u and %u", first.draws, again.draws);
+    CHECK(again.vertices == 3, "%u vertices", again.vertices);
+    CHECK(again.regWrites < first.regWrites, "%u register writes after %u", again.regWrites, first.regWrites);
+    CHECK(stateWrites == 0, "%u state registers written again", stateWrites);
+    CHECK(again.shaderCodeWords == 0, "%u shader code words uploaded again", again.shaderCodeWords);
+    CHECK(again.uniformWords == 0, "%u uniform words uploaded again", again.uniformWords);
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    linearFree(vertices);
+    gfxDestroyDevice(device);
+    gfxExit();
+
+    printf("%s\n", failed ? "FAILED" : "ok");
+    return failed != 0;
+}
@@ -24,6 +24,23 @@ GLAPI void APIENTRY glScissorMode( GLenum mode );
 #define GL_DMP_scissor_mode
 #endif
 
+#ifndef GL_OES_vertex_array_object
+#define GL_OES_vertex_array_object 1
+#define GL_VERTEX_ARRAY_BINDING_OES             0x85B5
+
+GLAPI void APIENTRY glBindVertexArrayOES( GLuint array );
+GLAPI void APIENTRY glDeleteVertexArraysOES( GLsizei n, const GLuint *arrays );
+GLAPI void APIENTRY glGenVertexArraysOES( GLsizei n, GLuint *arrays );
+GLAPI GLboolean APIENTRY glIsVertexArrayOES( GLuint array );
+#endif
+
+#ifndef GL_ETC1_RGB8_OES
+#define GL_ETC1_RGB8_OES                        0x8D64
+#endif
+
+/* ETC1 blocks each preceded by a little endian 64 bit word of 4 bit alphas, pixel (x, y) at bit 4 * (x * 4 + y) */
+#define GL_ETC1_ALPHA4_RGB8_DMP                 0x6753
+
 
 #ifdef __cplusplus
 }
@@ -9,12 +9,45 @@ extern "C" {
 
 #define CAELINA_SHARED_TEXTURES       (1 << 0)
 #define CAELINA_SHARED_DISPLAY_LISTS  (1 << 1)
+/* Record draws for the whole frame and submit them from gfxFlush, glFlush and glFinish
+   instead of stalling on every draw. Arrays passed to glVertexPointer must stay valid
+   until the frame has been flushed. */
+#define CAELINA_DEFERRED_SUBMIT       (1 << 2)
+/* Number of command buffers the device cycles through (default 1), so that recording
+   continues while the GPU executes previously submitted lists. */
+#define CAELINA_COMMAND_BUFFERS(n)    (((n) & 0xF) << 8)
+#define CAELINA_MAX_COMMAND_BUFFERS   8
+/* Render with the multithreaded software rasterizer instead of the PICA200, for reference
+   images and throughput comparisons. Only available in the host build. */
+#define CAELINA_SOFTWARE_DEVICE       (1 << 3)
+/* Let the GX transfer engine tile RGBA8, RGB8, RGB565, RGBA5551 and RGBA4 textures of at least
+   64x64 texels straight from the upload into texture memory. Other formats and smaller textures
+   are still tiled on the CPU. */
+#define CAELINA_TRANSFER_TILING       (1 << 4)
+
+typedef struct {
+    unsigned int fence;             /* sequence number of the last list submitted from this buffer */
+    unsigned long long submitTick;  /* system tick the list was handed to the GPU at */
+    unsigned long long retireTick;  /* system tick the GPU finished it at, 0 while in flight or unknown */
+} gfx_command_buffer_stats;
+
+typedef struct {
+    unsigned int numBuffers;
+    unsigned int submitted;         /* command lists submitted by all devices */
+    unsigned int retired;           /* command lists the GPU has finished */
+    unsigned int stalls;            /* times recording waited for a buffer still in use by the GPU */
+    unsigned long long stallTicks;  /* system ticks spent in those waits */
+    gfx_command_buffer_stats buffers[CAELINA_MAX_COMMAND_BUFFERS];
+} gfx_device_stats;
 
 void *gfxCreateDevice(int width, int height, int flags);
 void  gfxDestroyDevice(void* device);
 void *gfxMakeCurrent(void* device);
 void  gfxResize(int new_width, int new_height);
+/* Queues the transfer of the frame into fb behind the draws that render it and returns without
+   waiting for the GPU, fb holds the frame once they are done. glFinish waits for it. */
 void  gfxFlush(unsigned char* fb, int out_width, int out_height, int format);
+void  gfxGetDeviceStats(void* device, gfx_device_stats* stats);
 
 #ifdef __cplusplus
 }
@@ -1,40 +1,63 @@
 #include "glImpl.h"
 
+#ifdef CTRGL_HOST
+#include <cstdlib>
+#include <cstring>
+#endif
+
 gfx_state* g_state = NULL;
 
 extern "C" {
 void* gfxCreateDevice(int width, int height, int flags) {
-  gfx_device_3ds *dev = new gfx_device_3ds(new gfx_state(), width, height);
-  dev->g_state->flags = flags;
+  if (g_state) g_state->device->submit();
+  gfx_state *state = new gfx_state();
+  state->flags = flags;
+  gfx_device *dev;
+#ifdef CTRGL_HOST
+  const char *device = getenv("CTRGL_HOST_DEVICE");
+  if (device && !strcmp(device, "sw")) flags |= CAELINA_SOFTWARE_DEVICE;
+  if (flags & CAELINA_SOFTWARE_DEVICE) dev = new gfx_device_sw(state, width, height);
+  else
+#endif
+  dev = new gfx_device_3ds(state, width, height);
   dev->g_state->device = dev;
+  if (g_state) g_state->device->bind();
   return dev;
 }
 
 void gfxDestroyDevice(void* device) {
-  if(device) delete (gfx_device*)device;
+  CHECK_NULL(device);
+
+  gfx_device *current = g_state ? g_state->device : NULL;
+  if (current && current != device) current->submit();
+  delete (gfx_device*)device;
+  if (current && current != device) current->bind();
 }
 
 
 void *gfxMakeCurrent(void* device) {
   void *previous = g_state;
+  if (g_state && g_state->device != device) {
+    // recording always goes to the current device's buffers
+    g_state->device->submit();
+  }
   if (!device) {
     g_state = NULL;
     return previous;
   }
+  if (g_state != ((gfx_device*)device)->g_state) {
+    // the other device's draws changed the registers behind this state's back
+    ((gfx_device*)device)->g_state->dirty = GFX_DIRTY_ALL;
+  }
   g_state = ((gfx_device*)device)->g_state;
+  g_state->device->bind();
   return previous;
 }
 
 void gfxResize(int new_width, int new_height) {
   CHECK_NULL(g_state);
 
-  gfx_device_3ds *state = (gfx_device_3ds*) g_state->device;
-  vramFree(state->gpuOut);
-  vramFree(state->gpuDOut);
-  state->gpuOut = (u32*)vramAlloc(new_width * new_height * 4);
-  state->gpuDOut = (u32*)vramAlloc(new_width * new_height * 4);
-  state->width = new_width;
-  state->height = new_height;
+  g_state->device->resize(new_width, new_height);
 }
 
 void gfxFlush(unsigned char* fb, int out_width, int out_height, int format) {
@@ -44,4 +67,11 @@ void gfxFlush(unsigned char* fb, int out_width, int out_height, int format) {
   g_state->device->flush(fb, out_width, out_height, format);
 }
 
+void gfxGetDeviceStats(void* device, gfx_device_stats* stats) {
+  CHECK_NULL(device);
+  CHECK_NULL(stats);
+
+  ((gfx_device*)device)->get_stats(stats);
+}
+
 } // extern "C"
@@ -1,55 +1,28 @@
 #include <3ds.h>
 #include <3ds/gpu/gx.h>
 #include "glImpl.h"
+#include "etc1.h"
+#include "swizzle.h"
+#include <algorithm>
 #include <cstring>
+#include <cstdlib>
 #include "default_3ds_vsh_shbin.h"
 #include "clear_shader_vsh_shbin.h"
 #include "vertex_lighting_3ds_vsh_shbin.h"
 
-static
-void SetAttributeBuffers(u8 totalAttributes, u32* baseAddress,
-                         u64 attributeFormats, u16 attributeMask,
-                         u64 attributePermutation, u8 numBuffers,
-                         u32 bufferOffsets, u64 bufferPermutations, u8 bufferNumAttributes) {
-    GPU_SetAttributeBuffers(totalAttributes, baseAddress, attributeFormats, attributeMask, attributePermutation, numBuffers,
-                            &bufferOffsets, &bufferPermutations, &bufferNumAttributes);
-}
-
-static //stolen from smea who stole it from staplebutt :P
-void GPU_SetDummyTexEnv(u8 num)
-{
-    GPU_SetTexEnv(num,
-                  GPU_TEVSOURCES(GPU_PREVIOUS, 0, 0),
-                  GPU_TEVSOURCES(GPU_PREVIOUS, 0, 0),
-                  GPU_TEVOPERANDS(0,0,0),
-                  GPU_TEVOPERANDS(0,0,0),
-                  GPU_REPLACE,
-                  GPU_REPLACE,
-                  0xFFFFFFFF);
-}
-
-
-struct _3ds_vec3 {
-    float x, y, z;
-};
-
-struct _3ds_vertex {
-    _3ds_vec3 pos;
-    vec4 texCoord;
-    vec4 color;
-    vec4 normal;
-};
 
 struct VBO {
     u8* data;
     u32 currentSize; // in bytes
     u32 maxSize; // in bytes
     u32 numVertices;
+    u8 format;
 
-    VBO(u32 size) {
-        data = (u8 *)linearAlloc(size * sizeof(_3ds_vertex));
+    VBO(u32 size, u8 fmt) {
+        format = fmt;
+        data = (u8 *)linearAlloc(size * gfx_vertex_stride(format));
         currentSize = 0;
-        maxSize = size * sizeof(_3ds_vertex);
+        maxSize = size * gfx_vertex_stride(format);
         numVertices = 0;
     }
 
@@ -58,40 +31,376 @@ struct VBO {
     }
 
     int set_data(sbuffer<vertex>& vdat) {
-        currentSize = vdat.size() * sizeof(_3ds_vertex);
+        currentSize = vdat.size() * gfx_vertex_stride(format);
         numVertices = vdat.size();
         if (currentSize > maxSize) return -1;
-        _3ds_vertex *ver = (_3ds_vertex *)data;
+        u8 *ver = data;
         for (unsigned int i = 0; i < vdat.size(); ++i) {
-            ver[i].color = vec4(vdat[i].color);
-            ver[i].texCoord = vec4(vdat[i].textureCoord);
-            ver[i].pos.x = vdat[i].position.x;
-            ver[i].pos.y = vdat[i].position.y;
-            ver[i].pos.z = vdat[i].position.z;
-            ver[i].normal = vec4(vdat[i].normal);
+            gfx_vertex_attributes attr;
+            attr.texCoord = vdat[i].textureCoord;
+            attr.color = vdat[i].color;
+            attr.normal = vdat[i].normal;
+            ver = gfx_pack_vertex(ver, format, vdat[i].position.x, vdat[i].position.y, vdat[i].position.z, attr);
         }
+        GSPGPU_FlushDataCache(data, currentSize);
 
         return 0;
     }
     
 };
 
-static u32 *gpuCmd = nullptr;
-static u32 gpuCmdSize = 0;
-static shaderProgram_s shader;
-static shaderProgram_s clear_shader;
-static shaderProgram_s vertex_lighting_shader;
+/* uniforms of the built-in programs */
+enum gfx_uniform {
+    UNIFORM_PROJECTION = 0,
+    UNIFORM_MODELVIEW,
+    UNIFORM_NORMAL_MTX,
+    UNIFORM_LIGHT0_AMBIENT,
+    UNIFORM_LIGHT0_DIFFUSE,
+    UNIFORM_LIGHT0_SPECULAR,
+    UNIFORM_LIGHT0_POSITION,
+    UNIFORM_LIGHT0_SPOTDIR,
+    UNIFORM_LIGHT0_SPOT_CUTOFF,
+    UNIFORM_LIGHT0_ATTENUATION,
+    UNIFORM_MATERIAL_AMBIENT,
+    UNIFORM_MATERIAL_DIFFUSE,
+    UNIFORM_MATERIAL_SPECULAR,
+    UNIFORM_MATERIAL_EMISSIVE,
+    UNIFORM_MATERIAL_SHININESS,
+    UNIFORM_LIGHT_MODEL_AMBIENT,
+    UNIFORM_CLEAR_COLOR,
+    UNIFORM_CLEAR_DEPTH,
+    UNIFORM_COLOR_SCALE,
+    UNIFORM_COUNT
+};
+
+static const char *uniform_names[UNIFORM_COUNT] = {
+    "projection",
+    "modelview",
+    "normal_mtx",
+    "light0_ambient",
+    "light0_diffuse",
+    "light0_specular",
+    "light0_position",
+    "light0_spotdir",
+    "light0_spot_cutoff",
+    "light0_attenuation",
+    "material_ambient",
+    "material_diffuse",
+    "material_specular",
+    "material_emissive",
+    "material_shininess",
+    "light_model_ambient",
+    "clear_color",
+    "clear_depth",
+    "color_scale",
+};
+
+struct gfx_program {
+    shaderProgram_s program;
+    s8 uniforms[UNIFORM_COUNT]; // first float register of each uniform, -1 if the program lacks it
+};
+
+#define PICA_MAX_CODE 512
+#define PICA_MAX_OPDESCS 128
+
+/* one code blob holding every built-in program, so switching only moves the entry point */
+static DVLP_s packedDVLP;
+
+static bool pack_relocate(u32& inst, u32 codeBase, const u8 *descMap) {
+    u32 op = inst >> 26;
+    if ((op >= 0x24 && op <= 0x29) || op == 0x2C || op == 0x2D) {
+        // call, ifu, ifc, loop and jumps address code in bits 10-21
+        u32 dst = ((inst >> 10) & 0xFFF) + codeBase;
+        inst = (inst & ~(0xFFF << 10)) | (dst << 10);
+    } else if (op < 0x20 || op == 0x2E || op == 0x2F) {
+        inst = (inst & ~0x7F) | descMap[inst & 0x7F];
+    } else if (op >= 0x30) {
+        // mad only has 5 bits for its operand descriptor
+        if (descMap[inst & 0x1F] > 0x1F) return false;
+        inst = (inst & ~0x1F) | descMap[inst & 0x1F];
+    }
+    return true;
+}
+
+static bool pack_programs(DVLB_s **dvlbs, int num) {
+    u32 codeSize = 0;
+    for (int i = 0; i < num; ++i) {
+        codeSize += dvlbs[i]->DVLP.codeSize;
+    }
+    if (codeSize > PICA_MAX_CODE) return false;
+
+    u32 *code = (u32*)malloc(codeSize * 4);
+    u32 *descs = (u32*)malloc(PICA_MAX_OPDESCS * 4);
+    u32 numDescs = 0;
+    u32 codeBase = 0;
+    for (int i = 0; i < num; ++i) {
+        DVLP_s *dvlp = &dvlbs[i]->DVLP;
+
+        // operand descriptors are shared between programs where they match
+        u8 descMap[PICA_MAX_OPDESCS] = {0};
+        for (u32 j = 0; j < dvlp->opdescSize && j < PICA_MAX_OPDESCS; ++j) {
+            u32 k = 0;
+            while (k < numDescs && descs[k] != dvlp->opcdescData[j]) ++k;
+            if (k == numDescs) {
+                if (numDescs == PICA_MAX_OPDESCS) goto fail;
+                descs[numDescs++] = dvlp->opcdescData[j];
+            }
+            descMap[j] = k;
+        }
+
+        for (u32 j = 0; j < dvlp->codeSize; ++j) {
+            code[codeBase + j] = dvlp->codeData[j];
+            if (!pack_relocate(code[codeBase + j], codeBase, descMap)) goto fail;
+        }
+        codeBase += dvlp->codeSize;
+    }
+
+    packedDVLP.codeSize = codeSize;
+    packedDVLP.codeData = code;
+    packedDVLP.opdescSize = numDescs;
+    packedDVLP.opcdescData = descs;
+
+    codeBase = 0;
+    for (int i = 0; i < num; ++i) {
+        for (u32 j = 0; j < dvlbs[i]->numDVLE; ++j) {
+            DVLE_s *dvle = &dvlbs[i]->DVLE[j];
+            dvle->dvlp = &packedDVLP;
+            dvle->mainOffset += codeBase;
+            dvle->endmainOffset += codeBase;
+        }
+        codeBase += dvlbs[i]->DVLP.codeSize;
+    }
+    return true;
+
+fail:
+    free(code);
+    free(descs);
+    return false;
+}
+
+static void init_program(gfx_program& prog, DVLB_s *dvlb) {
+    shaderProgramInit(&prog.program);
+    shaderProgramSetVsh(&prog.program, &dvlb->DVLE[0]);
+    for (int i = 0; i < UNIFORM_COUNT; ++i) {
+        prog.uniforms[i] = shaderInstanceGetUniformLocation(prog.program.vertexShader, uniform_names[i]);
+    }
+}
+
+/* last value written to each float uniform register, shared by all programs. the
+   constants baked into the shaders live in c89-c95 and never alias a named uniform */
+static u32 uniformRegs[96][4];
+static u32 uniformKnown[96/32];
+
+static void set_uniform(const gfx_program& prog, gfx_uniform id, const void *data, u32 num) {
+    if (prog.uniforms[id] < 0) return;
+    const u32 *words = (const u32*)data;
+    u32 reg = prog.uniforms[id];
+
+    // only upload the registers in between the first and the last one that changed
+    int first = -1, last = -1;
+    for (u32 i = 0; i < num; ++i) {
+        u32 r = reg + i;
+        if ((uniformKnown[r / 32] & (1 << (r % 32))) && !memcmp(uniformRegs[r], &words[i * 4], 16)) continue;
+        memcpy(uniformRegs[r], &words[i * 4], 16);
+        uniformKnown[r / 32] |= 1 << (r % 32);
+        if (first < 0) first = i;
+        last = i;
+    }
+    if (first < 0) return;
+
+    GPU_SetFloatUniform(GPU_VERTEX_SHADER, reg + first, (u32*)&words[first * 4], last - first + 1);
+}
+
+struct gpu_release {
+    void *data;
+    bool vram;
+    u32 fence; // list that last references data
+};
+
+enum gpu_op_type {
+    GPU_OP_LIST,
+    GPU_OP_TRANSFER,
+    GPU_OP_FILL,
+};
+
+/* a GX operation waiting for the ones queued before it */
+struct gpu_op {
+    gpu_op_type type;
+    u32 *src; // command list, transfer source or first fill buffer
+    u32 *dst; // transfer destination or second fill buffer
+    u32 srcArg; // list size in bytes, source dimensions or first fill value
+    u32 dstArg; // destination dimensions or second fill value
+    u32 flags; // transfer flags or words per fill buffer
+};
+
+#define GPU_FENCE_HISTORY 32
+#define GPU_OP_QUEUE 16 // GX operations waiting for the hardware
+#define GPU_DRAW_RESERVE 0x800 // upper bound of the words a draw records, shader upload included
+#define GPU_SUBMIT_RESERVE 0x10 // framebuffer flush and finalize added by submit()
+#define GPU_STREAM_SIZE 0x40000 // bytes of the immediate mode vertex ring, grown for larger batches
+#define GPU_QUAD_BATCH 0x4000 // quads per indexed draw, their u16 indices run up to 0xFFFF
+
+static const u32 gpuCmdSize = 0x40000; // per command buffer, in words
+static u32 gpuSubmitted = 0; // command lists handed to GX
+static volatile u32 gpuRetired = 0; // command lists the GPU has finished, counted from the P3D interrupt
+static volatile u64 gpuRetireTicks[GPU_FENCE_HISTORY]; // system tick each recent list finished at
+static sbuffer<gpu_release> gpuReleases; // buffers freed while still referenced by recorded commands
+static gfx_program shader;
+static gfx_program clear_shader;
+static gfx_program vertex_lighting_shader;
 static DVLB_s* dvlb_default = nullptr;
 static DVLB_s* dvlb_lighting = nullptr;
 static DVLB_s* dvlb_clear = nullptr;
 static VBO *clearQuadVBO = nullptr;
+static u16 *quadIndices = nullptr; // 0 1 2 0 2 3 for every quad, shared by all devices
+static u32 quadIndexQuads = 0;
+/* GX operations run one after another, each one kicked from the interrupt of the one before, so a display
+   transfer reads a finished frame and the lists recorded meanwhile wait for it in turn */
+static gpu_op gpuOps[GPU_OP_QUEUE];
+static volatile u32 gpuOpHead = 0; // next operation to run, advanced when the running one is done
+static volatile u32 gpuOpTail = 0;
+static u32 gpuOpRunning = 0; // 1 while an operation is on the hardware
+static volatile u32 gpuOpSignals = 0; // interrupts the running operation still raises
+
+static void gpu_run(const gpu_op& op) {
+    switch (op.type) {
+        case GPU_OP_LIST:
+            gpuOpSignals = 1;
+            GX_ProcessCommandList(op.src, op.srcArg, GX_CMDLIST_FLUSH);
+            break;
+        case GPU_OP_TRANSFER:
+            gpuOpSignals = 1;
+            GX_DisplayTransfer(op.src, op.srcArg, op.dst, op.dstArg, op.flags);
+            break;
+        case GPU_OP_FILL: {
+            u16 control = GX_FILL_TRIGGER | GX_FILL_32BIT_DEPTH;
+            gpuOpSignals = op.dst ? 2 : 1;
+            GX_MemoryFill(op.src, op.srcArg, op.src + op.flags, control,
+                          op.dst, op.dstArg, op.dst ? op.dst + op.flags : NULL, op.dst ? control : 0);
+            break;
+        }
+    }
+}
+
+/* starts the next operation unless one is running, called by the queue's producer and its interrupts */
+static void gpu_kick() {
+    while (gpuOpHead != gpuOpTail && !__atomic_exchange_n(&gpuOpRunning, 1, __ATOMIC_ACQ_REL)) {
+        if (gpuOpHead == gpuOpTail) {
+            // drained between the check and the claim, a push in between retries through the loop
+            __atomic_store_n(&gpuOpRunning, 0, __ATOMIC_RELEASE);
+            continue;
+        }
+        gpu_run(gpuOps[gpuOpHead % GPU_OP_QUEUE]);
+        return;
+    }
+}
+
+static void gpu_op_signal(void *) {
+    // transfers and fills the application started itself are none of the queue's business
+    if (!gpuOpSignals || --gpuOpSignals) return;
+    ++gpuOpHead;
+    __atomic_store_n(&gpuOpRunning, 0, __ATOMIC_RELEASE);
+    gpu_kick();
+}
+
+/* queues an operation, returns the count of operations pushed so far that gpu_op_done takes */
+static u32 gpu_push(const gpu_op& op) {
+    while (gpuOpTail - gpuOpHead >= GPU_OP_QUEUE) {
+        gspWaitForAnyEvent();
+    }
+    gpuOps[gpuOpTail % GPU_OP_QUEUE] = op;
+    u32 pushed = gpuOpTail + 1;
+    __atomic_store_n(&gpuOpTail, pushed, __ATOMIC_RELEASE);
+    gpu_kick();
+    return pushed;
+}
+
+static void gpu_push_list(u32 *list, u32 bytes) {
+    gpu_op op = {GPU_OP_LIST, list, NULL, bytes, 0, 0};
+    gpu_push(op);
+}
+
+static u32 gpu_push_transfer(u32 *src, u32 srcDim, u32 *dst, u32 dstDim, u32 flags) {
+    gpu_op op = {GPU_OP_TRANSFER, src, dst, srcDim, dstDim, flags};
+    return gpu_push(op);
+}
+
+/* fills words of one buffer or two with 32 bit values */
+static void gpu_push_fill(u32 *buf0, u32 value0, u32 *buf1, u32 value1, u32 words) {
+    gpu_op op = {GPU_OP_FILL, buf0, buf1, value0, value1, words};
+    gpu_push(op);
+}
+
+/* waits until every queued operation is done */
+static void gpu_drain() {
+    while (gpuOpHead != gpuOpTail) {
+        gspWaitForAnyEvent();
+    }
+}
+
+static bool gpu_op_done(u32 pushed) {
+    return (s32)(gpuOpHead - pushed) >= 0;
+}
+
+/* waits for one operation and the ones queued before it, not for anything pushed since */
+static void gpu_op_wait(u32 pushed) {
+    while (!gpu_op_done(pushed)) {
+        gspWaitForAnyEvent();
+    }
+}
+
+static void gpu_retire(void *) {
+    gpuRetireTicks[(gpuRetired + 1) % GPU_FENCE_HISTORY] = svcGetSystemTick();
+    ++gpuRetired;
+    gpu_op_signal(NULL);
+}
+
+static bool gpu_retired(u32 fence) {
+    return (s32)(gpuRetired - fence) >= 0;
+}
+
+static void gpu_wait(u32 fence) {
+    while (!gpu_retired(fence)) {
+        gspWaitForP3D();
+    }
+}
+
+static u64 gpu_retire_tick(u32 fence) {
+    if (!gpu_retired(fence) || gpuRetired - fence >= GPU_FENCE_HISTORY) return 0;
+    return gpuRetireTicks[fence % GPU_FENCE_HISTORY];
+}
+
+/* reported to the GL call that ran out of linear memory or VRAM */
+static void out_of_memory() {
+#ifndef DISABLE_ERRORS
+    setError(GL_OUT_OF_MEMORY);
+#endif
+}
+
+static void gpu_collect() {
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < gpuReleases.size(); ++i) {
+        gpu_release rel = gpuReleases[i];
+        if (!gpu_retired(rel.fence)) {
+            gpuReleases[kept++] = rel;
+        } else if (rel.vram) {
+            vramFree(rel.data);
+        } else {
+            linearFree(rel.data);
+        }
+    }
+    while (gpuReleases.size() > kept) {
+        gpuReleases.erase(&gpuReleases[gpuReleases.size() - 1]);
+    }
+}
 
 gfx_device_3ds::gfx_device_3ds(gfx_state *state, int w, int h) : gfx_device(state, w, h) {
-    if (!gpuCmd) {
-      gpuCmdSize = 0x40000;
-      gpuCmd = (u32*)linearAlloc(gpuCmdSize*4);
+    if (!clearQuadVBO) {
       GPU_Init(NULL);
-      GPU_Reset(NULL, gpuCmd, gpuCmdSize);
+      gspSetEventCallback(GSPGPU_EVENT_P3D, gpu_retire, NULL, false);
+      gspSetEventCallback(GSPGPU_EVENT_PPF, gpu_op_signal, NULL, false);
+      gspSetEventCallback(GSPGPU_EVENT_PSC0, gpu_op_signal, NULL, false);
+      gspSetEventCallback(GSPGPU_EVENT_PSC1, gpu_op_signal, NULL, false);
       sbuffer<vertex> clearQuad;
       clearQuad.push(vertex(vec4(-1, -1)));
       clearQuad.push(vertex(vec4(1, -1)));
@@ -99,59 +408,373 @@ gfx_device_3ds::gfx_device_3ds(gfx_state *state, int w, int h) : gfx_device(stat
       clearQuad.push(vertex(vec4(-1, -1)));
       clearQuad.push(vertex(vec4(1, 1)));
       clearQuad.push(vertex(vec4(-1, 1)));
-      clearQuadVBO = new VBO(clearQuad.size());
+      clearQuadVBO = new VBO(clearQuad.size(), 0);
       clearQuadVBO->set_data(clearQuad);
     }
 
+    numCmdbufs = (state->flags >> 8) & 0xF;
+    if (numCmdbufs < 1) numCmdbufs = 1;
+    if (numCmdbufs > CAELINA_MAX_COMMAND_BUFFERS) numCmdbufs = CAELINA_MAX_COMMAND_BUFFERS;
+    for (u32 i = 0; i < numCmdbufs; ++i) {
+      cmdbufs[i].data = (u32*)linearAlloc(gpuCmdSize*4);
+      cmdbufs[i].size = gpuCmdSize;
+      cmdbufs[i].fence = gpuRetired;
+    }
+    currentCmdbuf = 0;
+    stalls = 0;
+    stallTicks = 0;
+    stencilUsed = false;
+    stencilFillValue = 0;
+    bind();
+
+    streamData = (u8*)linearAlloc(GPU_STREAM_SIZE);
+    streamSize = GPU_STREAM_SIZE;
+    streamLimit = 0;
+    for (u32 i = 0; i < GPU_STREAM_SEGMENTS; ++i) streamFences[i] = gpuRetired;
+    stream_reset(0);
+
     if (!dvlb_default) {
       dvlb_default = DVLB_ParseFile((u32*)default_3ds_vsh_shbin, default_3ds_vsh_shbin_size);
-      shaderProgramInit(&shader);
-      shaderProgramSetVsh(&shader, &dvlb_default->DVLE[0]);
+      init_program(shader, dvlb_default);
 
       dvlb_lighting = DVLB_ParseFile((u32*)vertex_lighting_3ds_vsh_shbin, vertex_lighting_3ds_vsh_shbin_size);
-      shaderProgramInit(&vertex_lighting_shader);
-      shaderProgramSetVsh(&vertex_lighting_shader, &dvlb_lighting->DVLE[0]);
+      init_program(vertex_lighting_shader, dvlb_lighting);
 
       dvlb_clear = DVLB_ParseFile((u32*)clear_shader_vsh_shbin, clear_shader_vsh_shbin_size);
-      shaderProgramInit(&clear_shader);
-      shaderProgramSetVsh(&clear_shader, &dvlb_clear->DVLE[0]);
+      init_program(clear_shader, dvlb_clear);
+
+      // if they do not fit together each switch uploads the code again
+      DVLB_s *dvlbs[] = {dvlb_default, dvlb_lighting, dvlb_clear};
+      pack_programs(dvlbs, 3);
     }
 
     gpuOut=(u32*)vramAlloc(height*width*4);
-    gpuDOut=(u32*)vramAlloc(height*height*4);
+    gpuDOut=(u32*)vramAlloc(height*width*4);
 }
 
 gfx_device_3ds::~gfx_device_3ds() {
+    bind();
+    finish();
+    for (u32 i = 0; i < numCmdbufs; ++i) {
+        linearFree(cmdbufs[i].data);
+    }
+    linearFree(streamData);
+    linearFree(locked.data);
+    GPUCMD_SetBuffer(NULL, 0, 0);
+}
 
+void gfx_device_3ds::bind() {
+    gfx_command_buffer& buf = cmdbufs[currentCmdbuf];
+    // wrapped onto a buffer the GPU is still reading, the only wait recording does
+    wait_fence(buf.fence);
+    if (buf.submitTick && !buf.retireTick) buf.retireTick = gpu_retire_tick(buf.fence);
+    GPUCMD_SetBuffer(buf.data, buf.size, 0);
 }
 
+bool gfx_device_3ds::busy() {
+    return gpuCmdBufOffset != 0 || gpuRetired != gpuSubmitted;
+}
 
-// stolen from smea
-static u8 tileOrder[] = {0,1,8,9,2,3,10,11,16,17,24,25,18,19,26,27,4,5,12,13,6,7,14,15,20,21,28,29,22,23,30,31,32,33,40,41,34,35,42,43,48,49,56,57,50,51,58,59,36,37,44,45,38,39,46,47,52,53,60,61,54,55,62,63};
+void gfx_device_3ds::submit() {
+    if (gpuCmdBufOffset == 0) return;
 
-static
-unsigned long htonl(unsigned long v)
-{
-    u8* v2=(u8*)&v;
-    return (v2[0]<<24)|(v2[1]<<16)|(v2[2]<<8)|(v2[3]);
+    u32 *list;
+    u32 size;
+    GPU_FinishDrawing();
+    GPUCMD_Split(&list, &size);
+    gpu_push_list(list, size * 4);
+
+    gfx_command_buffer& buf = cmdbufs[currentCmdbuf];
+    buf.fence = ++gpuSubmitted;
+    buf.submitTick = svcGetSystemTick();
+    buf.retireTick = 0;
+
+    // keep recording into the next buffer while the GPU consumes this one
+    currentCmdbuf = (currentCmdbuf + 1) % numCmdbufs;
+    bind();
+    gpu_collect();
+}
+
+void gfx_device_3ds::finish() {
+    submit();
+    // transfers and fills queued behind the last list included
+    gpu_drain();
+    gpu_collect();
 }
 
-static void tileImage32(u32* src, u32* dst, int width, int height)
+void gfx_device_3ds::release(void *data, bool vram) {
+    if (!data) return;
+
+    if (busy()) {
+        // recorded but unsubmitted commands end up in the next list
+        gpuReleases.push({data, vram, gpuSubmitted + (gpuCmdBufOffset != 0)});
+    } else if (vram) {
+        vramFree(data);
+    } else {
+        linearFree(data);
+    }
+}
+
+void gfx_device_3ds::resize(int w, int h) {
+    finish();
+    vramFree(gpuOut);
+    vramFree(gpuDOut);
+    gpuOut = (u32*)vramAlloc(w * h * 4);
+    gpuDOut = (u32*)vramAlloc(w * h * 4);
+    width = w;
+    height = h;
+    g_state->dirty |= GFX_DIRTY_FRAMEBUFFER;
+}
+
+/* makes room for words of commands, false with GL_OUT_OF_MEMORY when not even an empty buffer holds them and
+   there is no memory to grow it, the caller records nothing then */
+bool gfx_device_3ds::reserve(u32 words) {
+    words += GPU_SUBMIT_RESERVE;
+    if (gpuCmdBufOffset + words <= gpuCmdBufSize) return true;
+
+    // GPUCMD_Add drops commands that don't fit, so kick what is recorded and
+    // continue in the next buffer. PICA registers keep their values across lists.
+    submit();
+
+    gfx_command_buffer& buf = cmdbufs[currentCmdbuf];
+    if (words <= buf.size) return true;
+
+    u32 size = buf.size;
+    while (size < words) size *= 2;
+    u32 *data = (u32*)linearAlloc(size*4);
+    if (!data) {
+        // the buffer stays as it was, still good for anything that fits
+        out_of_memory();
+        return false;
+    }
+    linearFree(buf.data);
+    buf.data = data;
+    buf.size = size;
+    GPUCMD_SetBuffer(buf.data, buf.size, 0);
+    return true;
+}
+
+void gfx_device_3ds::draw_done() {
+    if (!(g_state->flags & CAELINA_DEFERRED_SUBMIT)) {
+        finish();
+    }
+}
+
+/* waits until the list with the given fence is done, kicking it first if it is still recording */
+void gfx_device_3ds::wait_fence(u32 fence) {
+    if (gpu_retired(fence)) return;
+    if ((s32)(fence - gpuSubmitted) > 0) submit();
+    u64 start = svcGetSystemTick();
+    gpu_wait(fence);
+    stallTicks += svcGetSystemTick() - start;
+    ++stalls;
+}
+
+/* starts a new batch at offset head of the ring, everything before it belongs to the GPU */
+void gfx_device_3ds::stream_reset(u32 head) {
+    if (head >= streamSize) {
+        head = 0;
+        streamLimit = 0;
+    }
+    streamHead = head;
+    stream.base = streamData + head;
+    stream.size = streamLimit > head ? streamLimit - head : 0;
+    stream.count = 0;
+    stream.capacity = stream.size / stream.stride;
+}
+
+/* makes the ring usable up to end, segments still read by the GPU from the last lap are waited for */
+void gfx_device_3ds::stream_acquire(u32 end) {
+    u32 segment = streamSize / GPU_STREAM_SEGMENTS;
+    while (streamLimit < end) {
+        u32 i = streamLimit / segment;
+        wait_fence(streamFences[i]);
+        streamLimit = (i + 1) * segment;
+    }
+}
+
+bool gfx_device_3ds::stream_grow(u32 n) {
+    if (stream_reserve((stream.count + n) * stream.stride)) return true;
+
+    // no memory for a larger ring, the batch so far is drawn and goes on in this one
+    if (stream_split() && stream_reserve((stream.count + n) * stream.stride)) return true;
+
+    // the ring still can't hold the vertices, the batch is dropped rather than written past streamLimit
+    out_of_memory();
+    stream.count = 0;
+    return false;
+}
+
+/* draws the complete primitives of the immediate mode batch, the vertices the ones still to come share with them
+   start it again. false inside a display list, which needs the whole batch */
+bool gfx_device_3ds::stream_split() {
+    u32 count = stream.count;
+#ifndef DISABLE_LISTS
+    if (g_state->withinNewEndListBlock) return false;
+#endif
+    if (count < 4) return false;
+
+    u32 drawn = count; // vertices drawn now
+    u32 from = count; // first vertex carried over
+    bool fan = false;
+    switch (g_state->vertexDrawMode) {
+        case GL_TRIANGLES:
+            drawn = from = count - count % 3;
+            break;
+        case GL_TRIANGLE_STRIP:
+            // the strip goes on from an even vertex so its triangles keep their winding
+            from = (count - 2) & ~1;
+            drawn = from + 2;
+            break;
+        case GL_TRIANGLE_FAN:
+#ifndef SPEC_GLES
+        case GL_POLYGON:
+#endif
+            fan = true;
+            from = count - 1;
+            break;
+#ifndef SPEC_GLES
+        case GL_QUADS:
+            drawn = from = count - count % 4;
+            break;
+        case GL_QUAD_STRIP:
+            drawn = count & ~1;
+            from = drawn - 2;
+            break;
+#endif
+        default:
+            break;
+    }
+
+    // at most the fan's center and two more, or three of a strip
+    u8 carry[4 * 36];
+    u32 stride = stream.stride;
+    u32 kept = 0;
+    if (fan) {
+        memcpy(carry, stream.base, stride);
+        kept = 1;
+    }
+    memcpy(carry + kept * stride, stream.base + from * stride, (count - from) * stride);
+    kept += count - from;
+
+    stream.count = drawn;
+    render_vertices(g_state->projectionMatrixStack[g_state->currentProjectionMatrix],
+                    g_state->modelviewMatrixStack[g_state->currentModelviewMatrix]);
+
+    // a draw that failed to record leaves the batch where it was, it is overwritten
+    stream.count = 0;
+    stream_reserve(kept * stride);
+    memcpy(stream.base, carry, kept * stride);
+    stream.count = kept;
+    return true;
+}
+
+/* makes need bytes at the head of the ring contiguous and usable, the batch so far moves along, false if the ring
+   is smaller and there is no memory for a larger one */
+bool gfx_device_3ds::stream_reserve(u32 need) {
+    u32 bytes = stream.count * stream.stride;
+
+    if (need > streamSize) {
+        // the batch is larger than the ring, continue in a new one
+        u32 size = streamSize;
+        while (size < need) size *= 2;
+        u8 *data = (u8*)linearAlloc(size);
+        if (!data) return false;
+        memcpy(data, stream.base, bytes);
+        release(streamData);
+        streamData = data;
+        streamSize = size;
+        streamLimit = size;
+        for (u32 i = 0; i < GPU_STREAM_SEGMENTS; ++i) streamFences[i] = gpuRetired;
+        streamHead = 0;
+    } else if (streamHead + need > streamSize) {
+        // batches stay contiguous, move it to the start of the ring
+        streamLimit = 0;
+        stream_acquire(need);
+        memmove(streamData, stream.base, bytes);
+        streamHead = 0;
+    } else {
+        stream_acquire(streamHead + need);
+    }
+
+    stream.base = streamData + streamHead;
+    stream.size = streamLimit - streamHead;
+    stream.capacity = stream.size / stream.stride;
+    return true;
+}
+
+/* bytes at the head of the ring are read by the list being recorded, the next batch starts after them */
+void gfx_device_3ds::stream_commit(u32 bytes) {
+    // the segments they live in are free again once this list is done
+    u32 segment = streamSize / GPU_STREAM_SEGMENTS;
+    for (u32 i = streamHead / segment; i <= (streamHead + bytes - 1) / segment; ++i) {
+        streamFences[i] = gpuSubmitted + 1;
+    }
+    // attribute buffers are addressed in 8 byte units
+    stream_reset((streamHead + bytes + 0xF) & ~0xF);
+}
+
+/* room in the ring for data the next draw reads, taken between immediate mode batches. NULL with GL_OUT_OF_MEMORY
+   when the data is larger than the ring can grow to */
+u8 *gfx_device_3ds::stream_stage(u32 bytes) {
+    if (!stream_reserve(bytes)) {
+        out_of_memory();
+        return NULL;
+    }
+    u8 *data = stream.base;
+    stream_commit(bytes);
+    return data;
+}
+
+void gfx_device_3ds::get_stats(gfx_device_stats *stats) {
+    stats->numBuffers = numCmdbufs;
+    stats->submitted = gpuSubmitted;
+    stats->retired = gpuRetired;
+    stats->stalls = stalls;
+    stats->stallTicks = stallTicks;
+    for (u32 i = 0; i < CAELINA_MAX_COMMAND_BUFFERS; ++i) {
+        gfx_command_buffer_stats& out = stats->buffers[i];
+        if (i >= numCmdbufs) {
+            out = {0, 0, 0};
+            continue;
+        }
+        gfx_command_buffer& buf = cmdbufs[i];
+        if (buf.submitTick && !buf.retireTick) buf.retireTick = gpu_retire_tick(buf.fence);
+        out.fence = buf.fence;
+        out.submitTick = buf.submitTick;
+        out.retireTick = buf.retireTick;
+    }
+}
+
+
+/* ETC blocks go in 2x2 block tiles, top left block first, each one little endian and with its rows flipped
+   like the image's, an ETC1A4 alpha word ahead of its block */
+static void tileBlocks(const u8* src, u8* dst, int width, int height, bool alpha)
 {
     if(!src || !dst)return;
 
-    int i, j, k, l;
-    l=0;
-    for(j=0; j<height; j+=8)
+    int bw=width/4, bh=height/4;
+    u32 size=alpha ? 8+ETC1_BLOCK_SIZE : ETC1_BLOCK_SIZE;
+    for(int j=0; j<bh; j+=2)
     {
-        for(i=0; i<width; i+=8)
+        for(int i=0; i<bw; i+=2)
         {
-            for(k=0; k<8*8; k++)
+            for(int k=0; k<4; k++)
             {
-                int x=i+tileOrder[k]%8;
-                int y=j+(tileOrder[k]-(x-i))/8;
-                u32 v=src[x+(height-1-y)*width];
-                dst[l++]=htonl(v);
+                const u8* block=src+((bh-1-(j+k/2))*bw+i+k%2)*size;
+                if(alpha)
+                {
+                    u64 a;
+                    memcpy(&a, block, 8);
+                    a=etc1_flip_alpha(a);
+                    memcpy(dst, &a, 8);
+                    block+=8;
+                    dst+=8;
+                }
+                u8 flipped[ETC1_BLOCK_SIZE];
+                etc1_flip_block(block, flipped);
+                for(int b=0; b<ETC1_BLOCK_SIZE; b++) dst[b]=flipped[ETC1_BLOCK_SIZE-1-b];
+                dst+=ETC1_BLOCK_SIZE;
             }
         }
     }
@@ -161,8 +784,8 @@ static Result GX_RequestDmaFlush(u32* src, u32* dst, u32 length)
 {
     u32 gxCommand[0x8];
     gxCommand[0]=0x00; //CommandID
-    gxCommand[1]=(u32)src; //source address
-    gxCommand[2]=(u32)dst; //destination address
+    gxCommand[1]=(u32)(uintptr_t)src; //source address
+    gxCommand[2]=(u32)(uintptr_t)dst; //destination address
     gxCommand[3]=length; //size
     gxCommand[4]=gxCommand[5]=gxCommand[6]=gxCommand[7]=0x2;
 
@@ -170,33 +793,150 @@ static Result GX_RequestDmaFlush(u32* src, u32* dst, u32 length)
 }
 
 void gfx_device_3ds::repack_texture(gfx_texture &tex) {
-    u32 size = 4*tex.width*tex.height;
-    size = ((size - (size >> (2*(0+1)))) * 4) / 3;
-    u32 *dst = (u32 *)linearMemAlign(size, 0x80);
-    tileImage32((u32*)tex.unpackedColorBuffer, dst, tex.width, tex.height);
-
-    if (size > vramSpaceFree()) {
-        tex.colorBuffer = (GLubyte*)dst;
-        tex.extdata = 0;
-    } else {
-        if (!tex.colorBuffer) tex.colorBuffer = (GLubyte*)vramMemAlign(size, 0x80);
-        GX_RequestDmaFlush(dst, (u32*)tex.colorBuffer, size);
+    u32 size = gfx_image_size(tex.texelFormat, tex.width, tex.height);
+    if (tex.colorBuffer && busy()) {
+        // recorded draws may still sample the old contents
+        finish();
+    }
+
+    // the engine needs lines of at least 64 pixels, smaller textures are cheap to tile on the CPU anyway
+    GX_TRANSFER_FORMAT transfer;
+    bool gpuTiling = (g_state->flags & CAELINA_TRANSFER_TILING) && tex.width >= 64 && tex.height >= 64 &&
+                     transfer_format(tex.texelFormat, transfer);
+
+    u8 *dst = NULL;
+    if (!gpuTiling) {
+        dst = (u8 *)linearMemAlign(size, 0x80);
+        if (!dst) {
+            out_of_memory();
+            return;
+        }
+        if (tex.texelFormat == GPU_ETC1 || tex.texelFormat == GPU_ETC1A4) {
+            tileBlocks(tex.unpackedColorBuffer, dst, tex.width, tex.height, tex.texelFormat == GPU_ETC1A4);
+        } else {
+            swizzle_image(tex.unpackedColorBuffer, dst, tex.width, tex.height, gfx_texel_size(tex.texelFormat));
+        }
+        GSPGPU_FlushDataCache(dst, size);
+    }
+
+    // VRAM is only reused for the same footprint and linear memory only when the engine tiles into it in place
+    if (!tex.colorBuffer || tex.colorBufferSize != size || (!tex.extdata && !gpuTiling)) {
+        u8 *storage = NULL;
+        if (size <= vramSpaceFree()) storage = (u8 *)vramMemAlign(size, 0x80);
+        bool vram = storage != NULL;
+        // the CPU already tiled into linear memory, the engine needs some to tile into
+        if (!storage) storage = gpuTiling ? (u8 *)linearMemAlign(size, 0x80) : dst;
+        if (!storage) {
+            // the texture keeps its old contents
+            out_of_memory();
+            return;
+        }
+        release(tex.colorBuffer, tex.extdata);
+        tex.colorBuffer = storage;
+        tex.colorBufferSize = size;
+        tex.extdata = vram;
+    }
+
+    if (gpuTiling) {
+        // draws recorded from here on are queued behind the transfer, only changing the texels has to wait
+        GSPGPU_FlushDataCache(tex.unpackedColorBuffer, size);
+        tex.transfer = gpu_push_transfer((u32*)tex.unpackedColorBuffer, GX_BUFFER_DIM(tex.width, tex.height),
+                                         (u32*)tex.colorBuffer, GX_BUFFER_DIM(tex.width, tex.height),
+                                         TEXTURE_TRANSFER_FLAGS | GX_TRANSFER_IN_FORMAT(transfer) |
+                                         GX_TRANSFER_OUT_FORMAT(transfer));
+    } else if (tex.colorBuffer != dst) {
+        GX_RequestDmaFlush((u32*)dst, (u32*)tex.colorBuffer, size);
         gspWaitForDMA();
         linearFree(dst);
-        tex.extdata = 1;
     }
+    g_state->dirty |= GFX_DIRTY_TEXTURE;
+}
+
+/* the transfer tiling the texture reads unpackedColorBuffer and writes colorBuffer until it is done */
+void gfx_device_3ds::wait_texture(gfx_texture &tex) {
+    if (!tex.transfer) return;
+    gpu_op_wait(tex.transfer);
+    tex.transfer = 0;
 }
 
 void gfx_device_3ds::free_texture(gfx_texture &tex) {
-    if (tex.extdata) {
-        vramFree(tex.colorBuffer);
-        linearFree(tex.unpackedColorBuffer);
+    wait_texture(tex);
+    linearFree(tex.unpackedColorBuffer);
+    release(tex.colorBuffer, tex.extdata);
+}
+
+/* storage for a buffer object, NULL if neither VRAM nor linear memory has room */
+static u8 *buffer_storage(GLenum usage, u32 size, bool& vram) {
+    u8 *data = NULL;
+    // written once, read by every draw, so it goes where the GPU reads fastest
+    if (usage == GL_STATIC_DRAW) data = (u8*)vramMemAlign(size, 0x80);
+    vram = data != NULL;
+    if (!data) data = (u8*)linearMemAlign(size, 0x80);
+    return data;
+}
+
+void gfx_device_3ds::buffer_data(gfx_buffer& buf, GLsizeiptr size, const GLvoid *data) {
+    // fresh storage, recorded draws keep reading the old one until their list is done
+    free_buffer(buf);
+    if (!size) return;
+
+    buf.data = buffer_storage(buf.usage, size, buf.vram);
+    if (!buf.data) {
+        out_of_memory();
+        return;
+    }
+    buf.size = size;
+    if (!data) return;
+
+    if (buf.vram) {
+        GSPGPU_FlushDataCache(data, size);
+        GX_RequestDmaFlush((u32*)data, (u32*)buf.data, size);
+        gspWaitForDMA();
+    } else {
+        memcpy(buf.data, data, size);
+        GSPGPU_FlushDataCache(buf.data, size);
+    }
+}
+
+void gfx_device_3ds::buffer_sub_data(gfx_buffer& buf, GLintptr offset, GLsizeiptr size, const GLvoid *data) {
+    if (busy()) {
+        // recorded draws may still read the old contents, they keep them and the buffer moves on to a copy
+        bool vram;
+        u8 *copy = buffer_storage(buf.usage, buf.size, vram);
+        if (copy && vram) {
+            GX_RequestDmaFlush((u32*)buf.data, (u32*)copy, buf.size);
+            gspWaitForDMA();
+        } else if (copy) {
+            memcpy(copy, buf.data, buf.size);
+            GSPGPU_FlushDataCache(copy, buf.size);
+        }
+
+        if (copy) {
+            release(buf.data, buf.vram);
+            buf.data = copy;
+            buf.vram = vram;
+            ++g_state->bufferGeneration;
+        } else {
+            // no room for a copy, so the draws have to be done with it first
+            finish();
+        }
+    }
+    if (buf.vram) {
+        GSPGPU_FlushDataCache(data, size);
+        GX_RequestDmaFlush((u32*)data, (u32*)(buf.data + offset), size);
+        gspWaitForDMA();
     } else {
-        linearFree(tex.unpackedColorBuffer);
-        linearFree(tex.colorBuffer);
+        memcpy(buf.data + offset, data, size);
+        GSPGPU_FlushDataCache(buf.data + offset, size);
     }
 }
 
+void gfx_device_3ds::free_buffer(gfx_buffer& buf) {
+    release(buf.data, buf.vram);
+    buf.data = NULL;
+    buf.size = 0;
+}
+
 static GPU_BLENDFACTOR gl_blendfactor(GLenum factor) {
     switch(factor) {
         case GL_ZERO: return GPU_ZERO;
@@ -224,7 +964,8 @@ static GPU_BLENDFACTOR gl_blendfactor(GLenum factor) {
 static GPU_Primitive_t gl_primitive(GLenum mode) {
     switch(mode) {
 #ifndef SPEC_GLES
-        case GL_QUADS:
+        case GL_QUAD_STRIP: return GPU_TRIANGLE_STRIP;
+        case GL_POLYGON: return GPU_TRIANGLE_FAN;
 #endif
         case GL_TRIANGLES: return GPU_TRIANGLES;
         case GL_TRIANGLE_STRIP: return GPU_TRIANGLE_STRIP;
@@ -284,318 +1025,889 @@ static GPU_TESTFUNC gl_depthfunc(GLenum func) {
   return GPU_NEVER;
 }
 
-u8 *gfx_device_3ds::cache_vertex_list(GLuint *size) {
-    VBO vbo = VBO(g_state->vertexBuffer.size());
-    vbo.set_data(g_state->vertexBuffer);
-    *size = vbo.currentSize;
-    return vbo.data;
+/* last values written to the PICA registers, so unchanged state is not sent again */
+#define PICA_NUM_REGS 0x400
+static u32 picaRegs[PICA_NUM_REGS];
+static u32 picaKnown[PICA_NUM_REGS / 32];
+
+static bool pica_equal(u16 reg, u32 value) {
+    return (picaKnown[reg / 32] & (1 << (reg % 32))) && picaRegs[reg] == value;
 }
 
-void gfx_device_3ds::setup_state(const mat4& projection, const mat4& modelview) {
+static void pica_store(u16 reg, u32 value) {
+    picaRegs[reg] = value;
+    picaKnown[reg / 32] |= 1 << (reg % 32);
+}
 
-    if (!g_state->enableLighting) {
-        shaderProgramUse(&shader);
-    } else {
-        shaderProgramUse(&vertex_lighting_shader);
+static void pica_write(u16 reg, u32 value) {
+    if (pica_equal(reg, value)) return;
+    GPUCMD_AddWrite(reg, value);
+    pica_store(reg, value);
+}
+
+static void pica_writes(u16 reg, const u32 *values, u32 num) {
+    u32 i;
+    for (i = 0; i < num; i++) {
+        if (!pica_equal(reg + i, values[i])) break;
+    }
+    if (i == num) return;
+
+    GPUCMD_AddIncrementalWrites(reg, values, num);
+    for (i = 0; i < num; i++) {
+        pica_store(reg + i, values[i]);
     }
+}
 
-    float mu_proj[4*4];
-    float mu_model[4*4];
-    mat4 pica = mat4();
-    pica[0xA] = 0.5;
-    pica[0xB] = -0.5;
+static const gfx_program *boundProgram = nullptr; // program the shader unit is configured for
+static const DVLP_s *residentCode = nullptr; // code blob currently in shader memory
 
-    pica = pica * g_state->viewportMatrix * projection;
-    int i, j;
-    for (i = 0; i < 4; i++) {
-        for (j = 0; j < 4; j++) {
-            mu_proj[i*4 + j] = pica[i*4 + (3-j)];
-        }
+static void use_program(gfx_program& prog) {
+    if (boundProgram == &prog) return;
+
+    const DVLP_s *code = prog.program.vertexShader->dvle->dvlp;
+    shaderProgramConfigure(&prog.program, residentCode != code, false);
+    pica_store(GPUREG_VSH_BOOLUNIFORM, 0x7FFF0000 | prog.program.vertexShader->boolUniforms);
+    residentCode = code;
+    boundProgram = &prog;
+}
+
+static void set_bool_uniform(gfx_program& prog, int id, bool value) {
+    shaderInstanceSetBool(prog.program.vertexShader, id, value);
+    if (boundProgram == &prog) {
+        pica_write(GPUREG_VSH_BOOLUNIFORM, 0x7FFF0000 | prog.program.vertexShader->boolUniforms);
     }
-    for (i = 0; i < 4; i++) {
-        for (j = 0; j < 4; j++) {
-            mu_model[i*4 + j] = modelview.at(i*4 + (3-j));
+}
+
+static void pica_texenv(u8 id, u16 rgbSources, u16 alphaSources, u16 rgbOperands, u16 alphaOperands, GPU_COMBINEFUNC rgbCombine, GPU_COMBINEFUNC alphaCombine, u32 constantColor) {
+    static const u8 texenv_regs[] = {0xC0, 0xC8, 0xD0, 0xD8, 0xF0, 0xF8};
+    u32 param[5];
+    param[0] = (alphaSources << 16) | rgbSources;
+    param[1] = (alphaOperands << 12) | rgbOperands;
+    param[2] = (alphaCombine << 16) | rgbCombine;
+    param[3] = constantColor;
+    param[4] = 0;
+    pica_writes(texenv_regs[id], param, 5);
+}
+
+//stolen from smea who stole it from staplebutt :P
+static void pica_dummy_texenv(u8 id) {
+    pica_texenv(id,
+                GPU_TEVSOURCES(GPU_PREVIOUS, 0, 0),
+                GPU_TEVSOURCES(GPU_PREVIOUS, 0, 0),
+                GPU_TEVOPERANDS(0,0,0),
+                GPU_TEVOPERANDS(0,0,0),
+                GPU_REPLACE,
+                GPU_REPLACE,
+                0xFFFFFFFF);
+}
+
+u8 *gfx_device_3ds::cache_vertex_list(GLuint *size) {
+    u32 bytes = stream.count * stream.stride;
+    *size = bytes + sizeof(gfx_vertex_attributes);
+    u8 *data = (u8*)linearAlloc(*size);
+    memcpy(data, stream.base, bytes);
+    memcpy(data + bytes, &stream.constant, sizeof(gfx_vertex_attributes));
+    GSPGPU_FlushDataCache(data, bytes);
+    return data;
+}
+
+static void transpose_uniform(float *out, const mat4& m) {
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            out[i*4 + j] = m.at(i*4 + (3-j));
         }
     }
+}
 
-    if (g_state->enableLighting) {
-        float mu_normal[4*4];
+static vec4 swizzle_uniform(const vec4& v) {
+    return {v.w, v.z, v.y, v.x};
+}
+
+/* recompute only the uniform values whose source state changed since the last draw */
+void gfx_device_3ds::update_uniforms(const mat4& projection, const mat4& modelview) {
+    gfx_uniform_cache& c = uniforms;
+
+    if (c.projectionGeneration != g_state->projectionGeneration ||
+        c.viewportGeneration != g_state->viewportGeneration) {
+        mat4 pica = mat4();
+        pica[0xA] = 0.5;
+        pica[0xB] = -0.5;
+        transpose_uniform(c.projection, pica * g_state->viewportMatrix * projection);
+        c.projectionGeneration = g_state->projectionGeneration;
+        c.viewportGeneration = g_state->viewportGeneration;
+    }
+
+    if (c.modelviewGeneration != g_state->modelviewGeneration) {
+        transpose_uniform(c.modelview, modelview);
         mat4 normal_mtx = mat4(modelview);
         normal_mtx[0 + 3] = 0.0;
         normal_mtx[4 + 3] = 0.0;
         normal_mtx[8 + 3] = 0.0;
         // normal_mtx = normal_mtx.inverse().transpose();
-        for (i = 0; i < 4; i++) {
-            for (j = 0; j < 4; j++) {
-                mu_normal[i*4 + j] = normal_mtx[i*4 + (3-j)];
-            }
+        transpose_uniform(c.normal_mtx, normal_mtx);
+        c.modelviewGeneration = g_state->modelviewGeneration;
+    }
+
+    if (!g_state->enableLighting) return;
+
+    gfx_light *light = &g_state->lights[0];
+    if (c.lightGeneration != light->generation) {
+        c.light[0] = swizzle_uniform(light->ambient);
+        c.light[1] = swizzle_uniform(light->diffuse);
+        c.light[2] = swizzle_uniform(light->specular);
+        c.light[3] = swizzle_uniform(light->position);
+        c.light[4] = swizzle_uniform(light->spotlightDirection);
+        c.light[5] = {0.0f, light->spotlightExpo, cosf(light->spotlightCutoff), light->spotlightCutoff};
+        c.light[6] = {0.0f, light->quadraticAttenuation, cosf(light->linearAttenuation), light->constantAttenuation};
+        c.lightGeneration = light->generation;
+    }
+
+    gfx_material *mat = &g_state->material;
+    c.material[0] = swizzle_uniform(mat->ambientColor);
+    c.material[1] = swizzle_uniform(mat->diffuseColor);
+    c.material[2] = swizzle_uniform(mat->specularColor);
+    c.material[3] = swizzle_uniform(mat->emissiveColor);
+    c.material[4] = {0.0f, 0.0f, 0.0f, mat->specularExpo};
+    c.lightModelAmbient = swizzle_uniform(g_state->lightModelAmbient);
+}
+
+void gfx_device_3ds::setup_state(const mat4& projection, const mat4& modelview) {
+
+    if (g_state->enableLighting) {
+        set_bool_uniform(vertex_lighting_shader, 0, g_state->enableLight[0]);
+        use_program(vertex_lighting_shader);
+    } else {
+        use_program(shader);
+    }
+
+    if (g_state->enableStencilTest) stencilUsed = true;
+
+    update_uniforms(projection, modelview);
+    gfx_uniform_cache& c = uniforms;
+
+    if (g_state->enableLighting) {
+        set_uniform(vertex_lighting_shader, UNIFORM_PROJECTION, c.projection, 4);
+        set_uniform(vertex_lighting_shader, UNIFORM_MODELVIEW, c.modelview, 4);
+        set_uniform(vertex_lighting_shader, UNIFORM_NORMAL_MTX, c.normal_mtx, 4);
+
+        for (int i = 0; i < 7; ++i) {
+            set_uniform(vertex_lighting_shader, (gfx_uniform)(UNIFORM_LIGHT0_AMBIENT + i), &c.light[i][0], 1);
         }
-        shaderInstanceSetBool(vertex_lighting_shader.vertexShader, 0, g_state->enableLight[0]);
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(vertex_lighting_shader.vertexShader, "projection"), (u32*)mu_proj, 4);
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(vertex_lighting_shader.vertexShader, "modelview"), (u32*)mu_model, 4);
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(vertex_lighting_shader.vertexShader, "normal_mtx"), (u32*)mu_normal, 4);
-
-        gfx_light *light = &g_state->lights[0];
-        vec4 vtemp = light->ambient;
-        vtemp = {vtemp.w, vtemp.z, vtemp.y, vtemp.x};
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(vertex_lighting_shader.vertexShader, "light0_ambient"), (u32*)&vtemp[0], 1);
-        vtemp = light->diffuse;
-        vtemp = {vtemp.w, vtemp.z, vtemp.y, vtemp.x};
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(vertex_lighting_shader.vertexShader, "light0_diffuse"), (u32*)&vtemp[0], 1);
-        vtemp = light->specular;
-        vtemp = {vtemp.w, vtemp.z, vtemp.y, vtemp.x};
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(vertex_lighting_shader.vertexShader, "light0_specular"), (u32*)&vtemp[0], 1);
-        vtemp = light->position;
-        vtemp = {vtemp.w, vtemp.z, vtemp.y, vtemp.x};
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(vertex_lighting_shader.vertexShader, "light0_position"), (u32*)&vtemp[0], 1);
-        vtemp = light->spotlightDirection;
-        vtemp = {vtemp.w, vtemp.z, vtemp.y, vtemp.x};
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(vertex_lighting_shader.vertexShader, "light0_spotdir"), (u32*)&vtemp[0], 1);
-        vtemp = {0.0f, light->spotlightExpo, cosf(light->spotlightCutoff), light->spotlightCutoff};
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(vertex_lighting_shader.vertexShader, "light0_spot_cutoff"), (u32*)&vtemp[0], 1);
-        vtemp = {0.0f, light->quadraticAttenuation, cosf(light->linearAttenuation), light->constantAttenuation};
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(vertex_lighting_shader.vertexShader, "light0_attenuation"), (u32*)&vtemp[0], 1);
 
         //material
-        gfx_material *mat = &g_state->material;
-        vtemp = mat->ambientColor;
-        vtemp = {vtemp.w, vtemp.z, vtemp.y, vtemp.x};
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(vertex_lighting_shader.vertexShader, "material_ambient"), (u32*)&vtemp[0], 1);
-        vtemp = mat->diffuseColor;
-        vtemp = {vtemp.w, vtemp.z, vtemp.y, vtemp.x};
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(vertex_lighting_shader.vertexShader, "material_diffuse"), (u32*)&vtemp[0], 1);
-        vtemp = mat->specularColor;
-        vtemp = {vtemp.w, vtemp.z, vtemp.y, vtemp.x};
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(vertex_lighting_shader.vertexShader, "material_specular"), (u32*)&vtemp[0], 1);
-        vtemp = mat->emissiveColor;
-        vtemp = {vtemp.w, vtemp.z, vtemp.y, vtemp.x};
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(vertex_lighting_shader.vertexShader, "material_emissive"), (u32*)&vtemp[0], 1);
-        vtemp = {0.0f, 0.0f, 0.0f, mat->specularExpo};
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(vertex_lighting_shader.vertexShader, "material_shininess"), (u32*)&vtemp[0], 1);
-
-        vtemp = g_state->lightModelAmbient;
-        vtemp = {vtemp.w, vtemp.z, vtemp.y, vtemp.x};
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(vertex_lighting_shader.vertexShader, "light_model_ambient"), (u32*)&vtemp[0], 1);
+        for (int i = 0; i < 5; ++i) {
+            set_uniform(vertex_lighting_shader, (gfx_uniform)(UNIFORM_MATERIAL_AMBIENT + i), &c.material[i][0], 1);
+        }
+
+        set_uniform(vertex_lighting_shader, UNIFORM_LIGHT_MODEL_AMBIENT, &c.lightModelAmbient[0], 1);
 
     } else {
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(shader.vertexShader, "projection"), (u32*)mu_proj, 4);
-        GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(shader.vertexShader, "modelview"), (u32*)mu_model, 4);
+        set_uniform(shader, UNIFORM_PROJECTION, c.projection, 4);
+        set_uniform(shader, UNIFORM_MODELVIEW, c.modelview, 4);
     }
 
 
-    GPU_SetViewport((u32 *)osConvertVirtToPhys(gpuDOut),
-                    (u32 *)osConvertVirtToPhys(gpuOut),
-                    0, 0, width, height);
-    {
-        GLint x = g_state->scissorBox.x;
-        GLint y = g_state->scissorBox.y;
-        GLint w = g_state->scissorBox.z;
-        GLint h = g_state->scissorBox.w;
-        GPU_SetScissorTest((g_state->enableScissorTest ? ext_state.scissorMode : GPU_SCISSOR_DISABLE), x, y, x + w, y + h);
-    }
-
-    GPU_DepthMap(-1.0f, 0.0f);
-    GPU_SetFaceCulling(GPU_CULL_NONE);
-    u8 stencil_ref = g_state->stencilRef;
-    GPU_SetStencilTest(g_state->enableStencilTest, gl_writefunc(g_state->stencilFunc), stencil_ref, g_state->stencilFuncMask, g_state->stencilMask);
-    GPU_SetStencilOp(gl_stencilop(g_state->stencilOpSFail), gl_stencilop(g_state->stencilOpZFail), gl_stencilop(g_state->stencilOpZPass));
-    GPU_WRITEMASK write_mask = (GPU_WRITEMASK)((g_state->colorMaskRed << 0) | (g_state->colorMaskGreen << 1) | (g_state->colorMaskBlue << 2) | (g_state->colorMaskAlpha << 3) | (g_state->depthMask << 4));
-    GPU_SetDepthTestAndWriteMask(g_state->enableDepthTest, gl_depthfunc(g_state->depthFunc), write_mask);
-    GPUCMD_AddMaskedWrite(GPUREG_EARLYDEPTH_TEST1, 0x1, 0);
-    GPUCMD_AddWrite(GPUREG_EARLYDEPTH_TEST2, 0);
-
-    if (g_state->enableBlend) {
-        GPU_SetAlphaBlending(
-                             GPU_BLEND_ADD,
-                             GPU_BLEND_ADD,
-                             gl_blendfactor(g_state->blendSrcFactor), gl_blendfactor(g_state->blendDstFactor),
-                             gl_blendfactor(g_state->blendSrcFactor), gl_blendfactor(g_state->blendDstFactor)
-                             );
-        u32 blendColor = g_state->blendColor;
-        GPU_SetBlendingColor(blendColor & 0xFF, (blendColor >> 8) & 0xFF, (blendColor >> 16) & 0xFF, (blendColor >> 24) & 0xFF);
-    }
-    else
-    {
-        GPU_SetAlphaBlending(
-                             GPU_BLEND_ADD,
-                             GPU_BLEND_ADD,
-                             GPU_ONE, GPU_ZERO,
-                             GPU_ONE, GPU_ZERO
-                             );
-        GPU_SetBlendingColor(0, 0, 0, 0);
+    apply_state(GFX_DIRTY_ALL);
+}
+
+void gfx_device_3ds::apply_state(GLbitfield groups) {
+    GLbitfield dirty = g_state->dirty & groups;
+    g_state->dirty &= ~groups;
+
+    if (dirty & GFX_DIRTY_FRAMEBUFFER) {
+        set_framebuffer();
     }
 
-    u8 alpha_ref = (u8)(g_state->alphaTestRef * 255.0f);
-    GPU_SetAlphaTest(g_state->enableAlphaTest, gl_writefunc(g_state->alphaTestFunc), alpha_ref);
+    if (dirty & GFX_DIRTY_SCISSOR) {
+        set_scissor();
+    }
+
+    if (dirty & GFX_DIRTY_FIXED) {
+        pica_write(GPUREG_DEPTHMAP_ENABLE, 1);
+        pica_write(GPUREG_DEPTHMAP_SCALE, f32tof24(-1.0f));
+        pica_write(GPUREG_DEPTHMAP_OFFSET, f32tof24(0.0f));
+        pica_write(GPUREG_FACECULLING_CONFIG, GPU_CULL_NONE);
+        pica_write(GPUREG_EARLYDEPTH_TEST1, 0);
+        pica_write(GPUREG_EARLYDEPTH_TEST2, 0);
+        GPUCMD_AddMaskedWrite(GPUREG_COLOR_OPERATION, 0x2, 0x00000100);
+        pica_dummy_texenv(1);
+        pica_dummy_texenv(2);
+        pica_dummy_texenv(3);
+        pica_dummy_texenv(4);
+        pica_dummy_texenv(5);
+    }
+
+    if (dirty & GFX_DIRTY_STENCIL) {
+        u8 stencil_ref = g_state->stencilRef;
+        u8 stencil_func_mask = g_state->stencilFuncMask;
+        u8 stencil_mask = g_state->stencilMask;
+        pica_write(GPUREG_STENCIL_TEST, (g_state->enableStencilTest & 1) | (gl_writefunc(g_state->stencilFunc) << 4) | (stencil_mask << 8) | (stencil_ref << 16) | (stencil_func_mask << 24));
+        pica_write(GPUREG_STENCIL_OP, gl_stencilop(g_state->stencilOpSFail) | (gl_stencilop(g_state->stencilOpZFail) << 4) | (gl_stencilop(g_state->stencilOpZPass) << 8));
+    }
+
+    if (dirty & GFX_DIRTY_DEPTH) {
+        GPU_WRITEMASK write_mask = (GPU_WRITEMASK)((g_state->colorMaskRed << 0) | (g_state->colorMaskGreen << 1) | (g_state->colorMaskBlue << 2) | (g_state->colorMaskAlpha << 3) | (g_state->depthMask << 4));
+        pica_write(GPUREG_DEPTH_COLOR_MASK, (g_state->enableDepthTest & 1) | (gl_depthfunc(g_state->depthFunc) << 4) | (write_mask << 8));
+    }
+
+    if (dirty & GFX_DIRTY_BLEND) {
+        if (g_state->enableBlend) {
+            GPU_BLENDFACTOR src = gl_blendfactor(g_state->blendSrcFactor);
+            GPU_BLENDFACTOR dst = gl_blendfactor(g_state->blendDstFactor);
+            pica_write(GPUREG_BLEND_FUNC, GPU_BLEND_ADD | (GPU_BLEND_ADD << 8) | (src << 16) | (dst << 20) | (src << 24) | (dst << 28));
+            pica_write(GPUREG_BLEND_COLOR, g_state->blendColor);
+        } else {
+            pica_write(GPUREG_BLEND_FUNC, GPU_BLEND_ADD | (GPU_BLEND_ADD << 8) | (GPU_ONE << 16) | (GPU_ZERO << 20) | (GPU_ONE << 24) | (GPU_ZERO << 28));
+            pica_write(GPUREG_BLEND_COLOR, 0);
+        }
+    }
+
+    if (dirty & GFX_DIRTY_ALPHA_TEST) {
+        u8 alpha_ref = (u8)(g_state->alphaTestRef * 255.0f);
+        pica_write(GPUREG_FRAGOP_ALPHA_TEST, (g_state->enableAlphaTest & 1) | (gl_writefunc(g_state->alphaTestFunc) << 4) | (alpha_ref << 8));
+    }
+
+    if (dirty & GFX_DIRTY_TEXTURE) {
+        set_texture();
+    }
+}
+
+void gfx_device_3ds::set_framebuffer() {
+    u32 param[4];
+    u32 dim = 0x01000000 | (((height - 1) & 0xFFF) << 12) | (width & 0xFFF);
+
+    param[0] = osConvertVirtToPhys(gpuDOut) >> 3;
+    param[1] = osConvertVirtToPhys(gpuOut) >> 3;
+    param[2] = dim;
+    if (!pica_equal(GPUREG_DEPTHBUFFER_LOC, param[0]) || !pica_equal(GPUREG_COLORBUFFER_LOC, param[1]) || !pica_equal(GPUREG_FRAMEBUFFER_DIM, param[2])) {
+        GPUCMD_AddWrite(GPUREG_FRAMEBUFFER_FLUSH, 0x00000001);
+        GPUCMD_AddWrite(GPUREG_FRAMEBUFFER_INVALIDATE, 0x00000001);
+        pica_writes(GPUREG_DEPTHBUFFER_LOC, param, 3);
+    }
+
+    pica_write(GPUREG_RENDERBUF_DIM, dim);
+    pica_write(GPUREG_DEPTHBUFFER_FORMAT, 0x00000003);
+    pica_write(GPUREG_COLORBUFFER_FORMAT, 0x00000002);
+    pica_write(GPUREG_FRAMEBUFFER_BLOCK32, 0x00000000);
+
+    param[0] = f32tof24(width / 2.0f);
+    param[1] = f32tof31(2.0f / width) << 1;
+    param[2] = f32tof24(height / 2.0f);
+    param[3] = f32tof31(2.0f / height) << 1;
+    pica_writes(GPUREG_VIEWPORT_WIDTH, param, 4);
+    pica_write(GPUREG_VIEWPORT_XY, 0);
+
+    param[0] = 0x0000000F;
+    param[1] = 0x0000000F;
+    param[2] = 0x00000003;
+    param[3] = 0x00000003;
+    pica_writes(GPUREG_COLORBUFFER_READ, param, 4);
+}
+
+void gfx_device_3ds::set_scissor() {
+    GLint x = g_state->scissorBox.x;
+    GLint y = g_state->scissorBox.y;
+    GLint w = g_state->scissorBox.z;
+    GLint h = g_state->scissorBox.w;
+    u32 param[3];
+    param[0] = g_state->enableScissorTest ? ext_state.scissorMode : GPU_SCISSOR_DISABLE;
+    param[1] = (y << 16) | (x & 0xFFFF);
+    param[2] = ((y + h - 1) << 16) | ((x + w - 1) & 0xFFFF);
+    pica_writes(GPUREG_SCISSORTEST_MODE, param, 3);
+}
+
+void gfx_device_3ds::set_texture() {
+    extern gfx_texture *getTexture(GLuint name);
+    gfx_texture* text = g_state->enableTexture2D ? getTexture(g_state->currentBoundTexture) : NULL;
 
     if (!g_state->enableTexture2D) {
-        GPU_SetTexEnv(
-                      0,
-                      GPU_TEVSOURCES(GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR),
-                      GPU_TEVSOURCES(GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR),
-                      GPU_TEVOPERANDS(0, 0, 0),
-                      GPU_TEVOPERANDS(0, 0, 0),
-                      GPU_REPLACE, GPU_REPLACE,
-                      0xFFFFFFFF
-                      );
+        pica_texenv(
+                    0,
+                    GPU_TEVSOURCES(GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR),
+                    GPU_TEVSOURCES(GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR),
+                    GPU_TEVOPERANDS(0, 0, 0),
+                    GPU_TEVOPERANDS(0, 0, 0),
+                    GPU_REPLACE, GPU_REPLACE,
+                    0xFFFFFFFF
+                    );
+        return;
+    }
+
+    // not shadowed, writing the unit config also clears the texture cache
+    GPU_SetTextureEnable(GPU_TEXUNIT0);
+
+    if (!text) return;
+
+    if (text->format == GL_ALPHA) {
+        pica_texenv(0,
+                    GPU_TEVSOURCES(GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR),
+                    GPU_TEVSOURCES(GPU_TEXTURE0, GPU_PRIMARY_COLOR, GPU_TEXTURE0),
+                    GPU_TEVOPERANDS(0,0,0),
+                    GPU_TEVOPERANDS(0,0,0),
+                    GPU_REPLACE, GPU_MODULATE,
+                    0xFFFFFFFF);
+    } else {
+        pica_texenv(0,
+                    GPU_TEVSOURCES(GPU_TEXTURE0, GPU_PRIMARY_COLOR, GPU_TEXTURE0),
+                    GPU_TEVSOURCES(GPU_TEXTURE0, GPU_PRIMARY_COLOR, GPU_TEXTURE0),
+                    GPU_TEVOPERANDS(0,0,0),
+                    GPU_TEVOPERANDS(0,0,0),
+                    GPU_MODULATE, GPU_MODULATE,
+                    0xFFFFFFFF);
+    }
+
+    pica_write(GPUREG_TEXUNIT0_TYPE, text->texelFormat);
+    pica_write(GPUREG_TEXUNIT0_ADDR1, osConvertVirtToPhys(text->colorBuffer) >> 3);
+    pica_write(GPUREG_TEXUNIT0_DIM, (text->width << 16) | text->height);
+    pica_write(GPUREG_TEXUNIT0_PARAM,
+               GPU_TEXTURE_MIN_FILTER(text->min_filter) |
+               GPU_TEXTURE_MAG_FILTER(text->mag_filter) |
+               GPU_TEXTURE_WRAP_S(text->wrap_s) |
+               GPU_TEXTURE_WRAP_T(text->wrap_t) |
+               (text->texelFormat == GPU_ETC1 ? GPU_TEXTURE_ETC1_PARAM : 0));
+}
+
+/* loads a fixed attribute register, the shader reads it for every vertex */
+static void set_fixed_attribute(u32 id, const vec4& v) {
+    u32 x = f32tof24(v.x);
+    u32 y = f32tof24(v.y);
+    u32 z = f32tof24(v.z);
+    u32 w = f32tof24(v.w);
+    GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_INDEX, id);
+    GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_DATA0, ((z >> 16) & 0xFF) | (w << 8));
+    GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_DATA1, ((y >> 8) & 0xFFFF) | ((z & 0xFFFF) << 16));
+    GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_DATA2, x | ((y & 0xFF) << 24));
+}
+
+/* GL type of a client array as a PICA attribute format, -1 if the loader cannot read it */
+static int gl_attribute_type(GLenum type) {
+    switch (type) {
+        case GL_BYTE: return GPU_BYTE;
+        case GL_UNSIGNED_BYTE: return GPU_UNSIGNED_BYTE;
+        case GL_SHORT: return GPU_SHORT;
+        case GL_FLOAT: return GPU_FLOAT;
+    }
+    return -1;
+}
+
+/* what the default shader multiplies colors read natively by, converted ones are normalized already */
+static float gl_color_scale(GLenum type) {
+    switch (type) {
+        case GL_BYTE: return 1.0f / 127.0f;
+        case GL_UNSIGNED_BYTE: return 1.0f / 255.0f;
+        case GL_SHORT: return 1.0f / 32767.0f;
+    }
+    return 1.0f;
+}
+
+/* layout of vertices written by gfx_pack_vertex, attributes they lack are fixed to the constant values */
+static void packed_layout(gfx_vertex_layout& layout, const u8 *data, u8 format, const gfx_vertex_attributes& constant) {
+    // pos, tex, color, normal
+    u64 permutation = 0;
+    u8 count = 1;
+    u16 fixed = 0xFF0;
+    if (format & GFX_VERTEX_TEXCOORD) permutation |= 1ull << (4 * count++); else fixed |= 1 << 1;
+    if (format & GFX_VERTEX_COLOR) permutation |= 2ull << (4 * count++); else fixed |= 1 << 2;
+    if (format & GFX_VERTEX_NORMAL) permutation |= 3ull << (4 * count++); else fixed |= 1 << 3;
+
+    layout.formats = GPU_ATTRIBFMT(0, 3, GPU_FLOAT) | GPU_ATTRIBFMT(1, 2, GPU_FLOAT) |
+                     GPU_ATTRIBFMT(2, 4, GPU_UNSIGNED_BYTE) | GPU_ATTRIBFMT(3, 3, GPU_FLOAT);
+    layout.fixed = fixed;
+    layout.constant = constant;
+    layout.colorScale = 1.0f / 255.0f;
+    layout.numBuffers = 1;
+    layout.client = 0;
+    layout.convert = 0;
+    layout.data[0] = data;
+    layout.stride[0] = gfx_vertex_stride(format);
+    layout.size[0] = layout.stride[0];
+    layout.permutation[0] = permutation;
+    layout.count[0] = count;
+}
+
+/* one attribute buffer per enabled client array, so interleaved and planar arrays are read in place */
+static bool array_layout(gfx_vertex_layout& layout, const gfx_state *state) {
+    layout.formats = 0;
+    layout.fixed = 0xFF0;
+    layout.constant = state->currentAttributes();
+    layout.colorScale = 1.0f / 255.0f;
+    layout.numBuffers = 0;
+    layout.client = 0;
+    layout.convert = 0;
+    for (u32 i = 0; i < GFX_ARRAY_COUNT; ++i) {
+        const gfx_client_array& array = state->clientArrays[i];
+        if (!array.enabled) {
+            layout.formats |= GPU_ATTRIBFMT(i, 4, GPU_FLOAT);
+            layout.fixed |= 1 << i;
+            continue;
+        }
+
+        const u8 *data = state->arrayData(array);
+        if (!data) return false;
+
+        u32 n = layout.numBuffers++;
+        layout.data[n] = data;
+        layout.stride[n] = gfx_array_stride(array);
+        layout.type[n] = array.type;
+        if (!array.buffer) layout.client |= 1 << n;
+
+        int type = gl_attribute_type(array.type);
+        if (type < 0) {
+            type = GPU_FLOAT;
+            layout.convert |= 1 << n;
+            layout.size[n] = array.size * 4;
+        } else {
+            layout.size[n] = array.size * gfx_array_type_size(array.type);
+        }
+        layout.formats |= GPU_ATTRIBFMT(i, array.size, type);
+        if (i == GFX_ARRAY_COLOR) layout.colorScale = gl_color_scale(array.type);
+        layout.permutation[n] = i;
+        layout.count[n] = 1;
+    }
+    return true;
+}
+
+/* copies count vertices of buffer i tightly packed to dst, types the loader can't read become floats */
+static void copy_vertices(u8 *dst, const gfx_vertex_layout& layout, u32 i, const u8 *data, u32 count) {
+    u32 size = layout.size[i];
+    if (layout.convert & (1 << i)) {
+        // colors and normals are normalized like GL does
+        bool normalized = layout.permutation[i] == GFX_ARRAY_COLOR || layout.permutation[i] == GFX_ARRAY_NORMAL;
+        float *f = (float*)dst;
+        for (u32 j = 0; j < count; ++j) {
+            for (u32 k = 0; k < size / 4; ++k) {
+                *f++ = gfx_array_component(data + j * layout.stride[i], layout.type[i], k, normalized);
+            }
+        }
+    } else if (layout.stride[i] == size) {
+        memcpy(dst, data, count * size);
     } else {
-        GPU_SetTextureEnable(GPU_TEXUNIT0);
-
-        extern gfx_texture *getTexture(GLuint name);
-        gfx_texture* text = getTexture(g_state->currentBoundTexture);
-        if (text) {
-
-            if (text->format == GL_ALPHA) {
-                GPU_SetTexEnv(0,
-                              GPU_TEVSOURCES(GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR),
-                              GPU_TEVSOURCES(GPU_TEXTURE0, GPU_PRIMARY_COLOR, GPU_TEXTURE0),
-                              GPU_TEVOPERANDS(0,0,0),
-                              GPU_TEVOPERANDS(0,0,0),
-                              GPU_REPLACE, GPU_MODULATE,
-                              0xFFFFFFFF);
-            } else {
-                GPU_SetTexEnv(0,
-                              GPU_TEVSOURCES(GPU_TEXTURE0, GPU_PRIMARY_COLOR, GPU_TEXTURE0),
-                              GPU_TEVSOURCES(GPU_TEXTURE0, GPU_PRIMARY_COLOR, GPU_TEXTURE0),
-                              GPU_TEVOPERANDS(0,0,0),
-                              GPU_TEVOPERANDS(0,0,0),
-                              GPU_MODULATE, GPU_MODULATE,
-                              0xFFFFFFFF);
+        for (u32 j = 0; j < count; ++j) memcpy(dst + j * size, data + j * layout.stride[i], size);
+    }
+    GSPGPU_FlushDataCache(dst, count * size);
+}
+
+static bool same_array(const gfx_client_array& a, const gfx_client_array& b) {
+    return a.enabled == b.enabled && a.size == b.size && a.type == b.type && a.stride == b.stride &&
+           a.pointer == b.pointer && a.buffer == b.buffer;
+}
+
+/* moves the layout to vertex first and makes the count vertices from there GPU visible, client memory
+   outside the linear heap and types the loader can't read are copied tightly packed into the ring,
+   linear memory is only flushed, arrays unchanged since glLockArraysEXT are taken from the lock. false
+   when the ring has no room for them */
+bool gfx_device_3ds::stage_layout(gfx_vertex_layout& layout, u32 first, u32 count) {
+    for (u32 i = 0; i < layout.numBuffers; ++i) {
+        const u8 *data = layout.data[i] + first * layout.stride[i];
+        layout.data[i] = data;
+        bool convert = layout.convert & (1 << i);
+        if (!convert && !(layout.client & (1 << i))) continue;
+
+        u32 array = layout.permutation[i];
+        if ((locked.staged | locked.flushed) & (1 << array) && first >= locked.first &&
+            first + count <= locked.first + locked.count && same_array(g_state->clientArrays[array], locked.arrays[array])) {
+            if (locked.staged & (1 << array)) {
+                layout.data[i] = locked.data + locked.offset[array] + (first - locked.first) * layout.size[i];
+                layout.stride[i] = layout.size[i];
             }
+            continue;
+        }
+
+        u32 size = layout.size[i];
+        if (!convert && osConvertVirtToPhys(data)) {
+            GSPGPU_FlushDataCache(data, (count - 1) * layout.stride[i] + size);
+            continue;
+        }
+
+        u8 *staged = stream_stage(count * size);
+        if (!staged) return false;
+        copy_vertices(staged, layout, i, data, count);
+        layout.data[i] = staged;
+        layout.stride[i] = size;
+    }
+    return true;
+}
+
+/* stages the range of the current arrays once for every draw until unlock_arrays, in linear memory of its own
+   since the ring is reused while the lock may be held for many lists */
+void gfx_device_3ds::lock_arrays(u32 first, u32 count) {
+    unlock_arrays();
+
+    gfx_vertex_layout layout;
+    if (!array_layout(layout, g_state)) return;
+
+    u32 bytes = 0;
+    for (u32 i = 0; i < layout.numBuffers; ++i) {
+        u32 array = layout.permutation[i];
+        const u8 *data = layout.data[i] + first * layout.stride[i];
+        if (layout.convert & (1 << i) || (layout.client & (1 << i) && !osConvertVirtToPhys(data))) {
+            locked.staged |= 1 << array;
+            locked.offset[array] = bytes;
+            bytes += (count * layout.size[i] + 0xF) & ~0xF;
+        } else if (layout.client & (1 << i)) {
+            GSPGPU_FlushDataCache(data, (count - 1) * layout.stride[i] + layout.size[i]);
+            locked.flushed |= 1 << array;
+        }
+    }
+
+    if (bytes) {
+        locked.data = (u8*)linearAlloc(bytes);
+        if (!locked.data) {
+            locked.staged = 0;
+        }
+    }
+    for (u32 i = 0; i < layout.numBuffers; ++i) {
+        u32 array = layout.permutation[i];
+        if (!(locked.staged & (1 << array))) continue;
+        copy_vertices(locked.data + locked.offset[array], layout, i, layout.data[i] + first * layout.stride[i], count);
+    }
+    for (u32 i = 0; i < GFX_ARRAY_COUNT; ++i) locked.arrays[i] = g_state->clientArrays[i];
+    locked.first = first;
+    locked.count = count;
+}
+
+void gfx_device_3ds::unlock_arrays() {
+    // draws recorded so far keep reading the copies until their list is done
+    release(locked.data);
+    locked = gfx_locked_arrays();
+}
+
+// attribute block the loader registers hold, shared by every context like the uniform registers
+static const gfx_attribute_cache *attributesLoaded = nullptr;
+
+/* fills the GPUREG_ATTRIBBUFFERS_LOC block for the layout's buffers from vertex first, the offsets are relative
+   to a base below all of them and the index buffer, which is returned */
+static u32 attribute_block(u32 *param, const gfx_vertex_layout& layout, u32 first, const void *indices) {
+    u32 addr[GFX_ARRAY_COUNT];
+    u32 base = indices ? osConvertVirtToPhys(indices) : ~0u;
+    for (u32 i = 0; i < layout.numBuffers; ++i) {
+        addr[i] = osConvertVirtToPhys(layout.data[i] + first * layout.stride[i]);
+        base = std::min(base, addr[i]);
+    }
+    base &= ~7;
+
+    memset(param, 0, 0x27 * sizeof(u32));
+    param[0] = base >> 3;
+    param[1] = layout.formats & 0xFFFFFFFF;
+    param[2] = ((GFX_ARRAY_COUNT - 1) << 28) | ((layout.fixed & 0xFFF) << 16) | ((layout.formats >> 32) & 0xFFFF);
+    for (u32 i = 0; i < layout.numBuffers; ++i) {
+        param[3 * i + 3] = addr[i] - base;
+        param[3 * i + 4] = layout.permutation[i] & 0xFFFFFFFF;
+        param[3 * i + 5] = (layout.count[i] << 28) | ((layout.stride[i] & 0xFFF) << 16) | ((layout.permutation[i] >> 32) & 0xFFFF);
+    }
+    return base;
+}
+
+static void load_attribute_block(const u32 *param) {
+    GPUCMD_AddIncrementalWrites(GPUREG_ATTRIBBUFFERS_LOC, (u32*)param, 0x27);
+    GPUCMD_AddMaskedWrite(GPUREG_VSH_INPUTBUFFER_CONFIG, 0xB, 0xA0000000 | (GFX_ARRAY_COUNT - 1));
+    GPUCMD_AddWrite(GPUREG_VSH_NUM_ATTR, GFX_ARRAY_COUNT - 1);
+    u32 inputs[2] = {0x3210, 0};
+    GPUCMD_AddIncrementalWrites(GPUREG_VSH_ATTRIBUTES_PERMUTATION_LOW, inputs, 2);
+}
+
+/* the current values of the attributes without a buffer, they are not part of any cached block */
+static void set_fixed_attributes(const gfx_vertex_layout& layout) {
+    if (layout.fixed & (1 << 1)) set_fixed_attribute(1, layout.constant.texCoord);
+    if (layout.fixed & (1 << 2)) set_fixed_attribute(2, layout.constant.color * (1.0f / layout.colorScale));
+    if (layout.fixed & (1 << 3)) set_fixed_attribute(3, layout.constant.normal);
+
+    // the default shader scales every color it reads, bytes arrive in the 0-255 range
+    if (boundProgram == &shader) {
+        float scale[4] = {layout.colorScale, layout.colorScale, layout.colorScale, layout.colorScale};
+        set_uniform(shader, UNIFORM_COLOR_SCALE, scale, 1);
+    }
+}
 
-            GPU_SetTexture(
-                           GPU_TEXUNIT0,
-                           (u32*)osConvertVirtToPhys(text->colorBuffer),
-                           text->width,
-                           text->height,
-                           GPU_TEXTURE_MIN_FILTER(text->min_filter) |
-                           GPU_TEXTURE_MAG_FILTER(text->mag_filter) |
-                           GPU_TEXTURE_WRAP_S(text->wrap_s) |
-                           GPU_TEXTURE_WRAP_T(text->wrap_t),
-                           GPU_RGBA8
-                           );
+/* points the loader at the layout's buffers, starting at vertex first */
+void gfx_device_3ds::set_vertex_layout(const gfx_vertex_layout& layout, u32 first, const void *indices) {
+    u32 param[0x27];
+    vertexBase = attribute_block(param, layout, first, indices);
+    load_attribute_block(param);
+    attributesLoaded = nullptr;
+    set_fixed_attributes(layout);
+}
+
+/* the attribute block of the bound vertex array object, rebuilt only once its arrays or the buffer storage
+   changed, NULL without an object or when its arrays have to be staged */
+gfx_attribute_cache *gfx_device_3ds::attribute_cache() {
+    if (!g_state->vertexArray) return nullptr;
+
+    gfx_attribute_cache *c = (gfx_attribute_cache*)g_state->arraysCache;
+    if (!c) {
+        c = new gfx_attribute_cache();
+        g_state->arraysCache = c;
+    }
+    if (c->generation != g_state->arraysGeneration || c->bufferGeneration != g_state->bufferGeneration) {
+        c->generation = g_state->arraysGeneration;
+        c->bufferGeneration = g_state->bufferGeneration;
+        c->usable = array_layout(c->layout, g_state) && !(c->layout.client | c->layout.convert);
+        if (c->usable) {
+            // the object's element buffer goes under the base too, so its draws replay the block unchanged
+            gfx_buffer *elements = g_state->elementArrayBuffer ? g_state->getBuffer(g_state->elementArrayBuffer) : nullptr;
+            attribute_block(c->param, c->layout, 0, elements ? elements->data : nullptr);
         }
+        if (attributesLoaded == c) attributesLoaded = nullptr;
     }
+    if (!c->usable) return nullptr;
 
-    GPU_SetDummyTexEnv(1);
-    GPU_SetDummyTexEnv(2);
-    GPU_SetDummyTexEnv(3);
-    GPU_SetDummyTexEnv(4);
-    GPU_SetDummyTexEnv(5);
+    c->layout.constant = g_state->currentAttributes();
+    return c;
 }
 
-void gfx_device_3ds::render_vertices_vbo(const mat4& projection, const mat4& modelview, u8 *data, GLuint units) {
-    GPUCMD_SetBufferOffset(0);
-    GPUCMD_AddMaskedWrite(GPUREG_ATTRIBBUFFERS_FORMAT_HIGH, 0b111111111111 << 16, 0);
+/* points the loader at the cached block, the registers are only written when another layout replaced it, false
+   if the indices lie out of reach of its base */
+bool gfx_device_3ds::set_cached_layout(const gfx_attribute_cache& c, const void *indices) {
+    u32 base = c.param[0] << 3;
+    if (indices) {
+        u32 phys = osConvertVirtToPhys(indices);
+        if (phys < base || phys - base > 0x0FFFFFFF) return false;
+    }
+
+    if (attributesLoaded != &c) {
+        load_attribute_block(c.param);
+        attributesLoaded = &c;
+    }
+    vertexBase = base;
+    set_fixed_attributes(c.layout);
+    return true;
+}
+
+void gfx_device_3ds::free_vertex_array(gfx_vertex_array& vao) {
+    gfx_attribute_cache *c = (gfx_attribute_cache*)vao.cache;
+    if (attributesLoaded == c) attributesLoaded = nullptr;
+    delete c;
+    vao.cache = nullptr;
+}
+
+/* index pattern covering the given number of quads, which is lowered to what the pattern holds when there is no
+   memory to extend it. NULL with GL_OUT_OF_MEMORY if there is no pattern at all */
+u16 *gfx_device_3ds::quad_indices(u32& quads) {
+    if (quads <= quadIndexQuads) return quadIndices;
+
+    u32 size = quadIndexQuads ? quadIndexQuads : 0x100;
+    while (size < quads) size *= 2;
+    u16 *indices = (u16*)linearAlloc(size * 6 * sizeof(u16));
+    if (!indices) {
+        if (!quadIndices) out_of_memory();
+        quads = quadIndexQuads;
+        return quadIndices;
+    }
+    for (u32 i = 0; i < size; ++i) {
+        u16 *q = indices + i * 6;
+        q[0] = i * 4;
+        q[1] = i * 4 + 1;
+        q[2] = i * 4 + 2;
+        q[3] = i * 4;
+        q[4] = i * 4 + 2;
+        q[5] = i * 4 + 3;
+    }
+    GSPGPU_FlushDataCache(indices, size * 6 * sizeof(u16));
+    release(quadIndices);
+    quadIndices = indices;
+    quadIndexQuads = size;
+    return quadIndices;
+}
+
+/* records the draw of count vertices from vertex first, every vertex is fetched and shaded once, a cached block
+   of the layout is replayed instead of rebuilt */
+void gfx_device_3ds::draw_vertices(GLenum mode, u32 first, u32 count, const gfx_vertex_layout& layout, const gfx_attribute_cache *cache) {
+    switch (mode) {
+#ifndef SPEC_GLES
+        case GL_QUADS: {
+            // two triangles per quad out of the shared index pattern, in batches as long as the pattern
+            for (u32 quad = 0; quad + 4 <= count;) {
+                u32 quads = std::min((count - quad) / 4, (u32)GPU_QUAD_BATCH);
+                u16 *indices = quad_indices(quads);
+                if (!indices) return;
+                if (quad && !reserve(GPU_DRAW_RESERVE)) return;
+                set_vertex_layout(layout, first + quad, indices);
+                GPU_DrawElements(GPU_TRIANGLES, (u32*)(uintptr_t)(osConvertVirtToPhys(indices) - vertexBase), quads * 6, true);
+                quad += quads * 4;
+            }
+            return;
+        }
+        case GL_QUAD_STRIP:
+            // drawn as the triangle strip over the same vertices, a trailing odd one is dropped
+            count &= ~1;
+            if (count < 4) return;
+            break;
+#endif
+        default:
+            break;
+    }
+
+    if (cache) set_cached_layout(*cache, NULL);
+    else set_vertex_layout(layout, 0, NULL);
+    GPU_DrawArray(gl_primitive(mode), first, count);
+}
+
+void gfx_device_3ds::render_vertices_vbo(const mat4& projection, const mat4& modelview, u8 *data, GLuint units, u8 format, const gfx_vertex_attributes& constant) {
+    if (!reserve(GPU_DRAW_RESERVE)) return;
     setup_state(projection, modelview);
-    SetAttributeBuffers(
-                        4,
-                        (u32*)osConvertVirtToPhys(data),
-                        GPU_ATTRIBFMT(0, 3, GPU_FLOAT) | GPU_ATTRIBFMT(1, 4, GPU_FLOAT) |
-                        GPU_ATTRIBFMT(2, 4, GPU_FLOAT) | GPU_ATTRIBFMT(3, 4, GPU_FLOAT),
-                        0xFF8,
-                        0x3210,
-                        1,
-                        {0x0},
-                        {0x3210},
-                        {4}
-                        );
-    
-    GPU_DrawArray(gl_primitive(g_state->vertexDrawMode), 0, units);
-    GPU_FinishDrawing();
-    //GPUCMD_Finalize();
-    //GPUCMD_FlushAndRun();
-    gspWaitForP3D();
+    gfx_vertex_layout layout;
+    packed_layout(layout, data, format, constant);
+    draw_vertices(g_state->vertexDrawMode, 0, units, layout);
+    draw_done();
 }
 
 void gfx_device_3ds::render_vertices(const mat4& projection, const mat4& modelview) {
-    GPUCMD_SetBufferOffset(0);
-    GPUCMD_AddMaskedWrite(GPUREG_ATTRIBBUFFERS_FORMAT_HIGH, 0b111111111111 << 16, 0);
+    u32 bytes = stream.count * stream.stride;
+    if (!bytes) return;
+
+    if (!reserve(GPU_DRAW_RESERVE)) return;
     setup_state(projection, modelview);
-    VBO temp_vbo = VBO(g_state->vertexBuffer.size());
-    temp_vbo.set_data(g_state->vertexBuffer);
-
-    SetAttributeBuffers(
-                        4,
-                        (u32*)osConvertVirtToPhys(temp_vbo.data),
-                        GPU_ATTRIBFMT(0, 3, GPU_FLOAT) | GPU_ATTRIBFMT(1, 4, GPU_FLOAT) |
-                        GPU_ATTRIBFMT(2, 4, GPU_FLOAT) | GPU_ATTRIBFMT(3, 4, GPU_FLOAT),
-                        0xFF8,
-                        0x3210,
-                        1,
-                        {0x0},
-                        {0x3210},
-                        {4}
-                        );
-    GPU_DrawArray(gl_primitive(g_state->vertexDrawMode), 0, temp_vbo.numVertices);
-    GPU_FinishDrawing();
-    //GPUCMD_Finalize();
-    //GPUCMD_FlushAndRun();
-    gspWaitForP3D();
-    linearFree(temp_vbo.data);
-    
+    GSPGPU_FlushDataCache(stream.base, bytes);
+    gfx_vertex_layout layout;
+    packed_layout(layout, stream.base, stream.format, stream.constant);
+    draw_vertices(g_state->vertexDrawMode, 0, stream.count, layout);
+    stream_commit(bytes);
+    draw_done();
 }
 
 void gfx_device_3ds::render_vertices_array(GLenum mode, GLint first, GLsizei count, const mat4& projection, const mat4& modelview) {
-  GPUCMD_SetBufferOffset(0);
+  gfx_attribute_cache *cache = attribute_cache();
+  if (cache) {
+    // nothing to stage, the loader starts at first itself so the block stays the same
+    if (!reserve(GPU_DRAW_RESERVE)) return;
+    setup_state(projection, modelview);
+    draw_vertices(mode, first, count, cache->layout, cache);
+    draw_done();
+    return;
+  }
+
+  gfx_vertex_layout layout;
+  if (!array_layout(layout, g_state)) return;
+
+  // staging may kick the list, so it goes before the state of the draw is recorded
+  if (!reserve(GPU_DRAW_RESERVE) || !stage_layout(layout, first, count)) return;
   setup_state(projection, modelview);
-  // pos, tex, color, normal
-
-  SetAttributeBuffers(
-                      4,
-                      (u32*)osConvertVirtToPhys(g_state->vertexPtr),
-                      GPU_ATTRIBFMT(0, 3, GPU_FLOAT) | GPU_ATTRIBFMT(1, 4, GPU_FLOAT) |
-                      GPU_ATTRIBFMT(2, 4, GPU_FLOAT) | GPU_ATTRIBFMT(3, 4, GPU_FLOAT),
-                      0xFFE,
-                      0x3210,
-                      1,
-                      {0x0},
-                      {0x0},
-                      {1}
-                      );
-
-  // make tex, color, and normal immediate values
-  // TODO texcoordpointer
-  GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_INDEX, 1);
-  GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_DATA0, 0);
-  GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_DATA1, 0);
-  GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_DATA2, 0);
-  // TODO colorpointer
-  GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_INDEX, 2);
-  {
-    vec4 cc = g_state->currentVertexColor;
-    u32 cr = f32tof24(cc.x);
-    u32 cg = f32tof24(cc.y);
-    u32 cb = f32tof24(cc.z);
-    u32 ca = f32tof24(cc.w);
-    GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_DATA0, ((cb >> 16) & 0xFF) | (ca << 8));
-    GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_DATA1, ((cg >> 8) & 0xFFFF) | (((cb) & 0xFFFF) << 16));
-    GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_DATA2, cr | (((cg) & 0xFF) << 24));
+  draw_vertices(mode, 0, count, layout);
+  draw_done();
+}
+
+void gfx_device_3ds::render_elements_array(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLuint start, GLuint end, const mat4& projection, const mat4& modelview) {
+  static const u8 quad_corners[6] = {0, 1, 2, 0, 2, 3};
+
+  gfx_attribute_cache *cache = attribute_cache();
+  gfx_vertex_layout layout;
+  if (cache) layout = cache->layout;
+  else if (!array_layout(layout, g_state)) return;
+
+  bool quads = false;
+  GLsizei used = count; // indices read from the application
+  switch (mode) {
+#ifndef SPEC_GLES
+    case GL_QUADS:
+      // two triangles per quad, the indices are rewritten anyway
+      quads = true;
+      used = count & ~3;
+      count = count / 4 * 6;
+      break;
+    case GL_QUAD_STRIP:
+      count &= ~1;
+      if (count < 4) return;
+      used = count;
+      break;
+#endif
+    default:
+      break;
   }
-  // TODO normalpointer
-  GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_INDEX, 3);
-  {
-    vec4 cc = g_state->currentVertexNormal;
-    u32 cr = f32tof24(cc.x);
-    u32 cg = f32tof24(cc.y);
-    u32 cb = f32tof24(cc.z);
-    u32 ca = f32tof24(cc.w);
-    GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_DATA0, ((cb >> 16) & 0xFF) | (ca << 8));
-    GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_DATA1, ((cg >> 8) & 0xFFFF) | (((cb) & 0xFFFF) << 16));
-    GPUCMD_AddWrite(GPUREG_FIXEDATTRIB_DATA2, cr | (((cg) & 0xFF) << 24));
+  if (!count) return;
+
+  // client memory and converted arrays are only staged over the vertices the indices reach, they count from there
+  u32 first = 0;
+  u32 size = gfx_index_size(type);
+  bool stage = layout.client | layout.convert;
+  if (stage) {
+    if (end == ~0u && locked.count) {
+      // indices outside the locked range are undefined with GL_EXT_compiled_vertex_array
+      start = locked.first;
+      end = locked.first + locked.count - 1;
+    } else if (end == ~0u) {
+      start = ~0u;
+      end = 0;
+      for (GLsizei i = 0; i < used; ++i) {
+        u32 index = gfx_index(indices, type, i);
+        start = std::min(start, index);
+        end = std::max(end, index);
+      }
+    }
+    first = start;
+  } else if (size > 2 && end == ~0u) {
+    end = 0;
+    for (GLsizei i = 0; i < used; ++i) end = std::max(end, gfx_index(indices, type, i));
   }
 
-  GPU_DrawArray(gl_primitive(mode), first, count);
-  GPU_FinishDrawing();
-  //GPUCMD_Finalize();
-  //GPUCMD_FlushAndRun();
-  gspWaitForP3D();
+  // the loader takes 16 bit indices at most, counted from the first staged vertex, so a wider range is refused
+  // before anything is staged or recorded
+  if ((stage || size > 2) && end - first > 0xFFFF) {
+#ifndef DISABLE_ERRORS
+    setError(GL_INVALID_VALUE);
+#endif
+    return;
+  }
+
+  if (!reserve(GPU_DRAW_RESERVE)) return;
+  if (stage && !stage_layout(layout, first, end - start + 1)) return;
+
+  // the loader reads u8 and u16 indices in place when they are GPU visible, anything else goes through the ring
+  u32 phys = osConvertVirtToPhys(indices);
+  if (!phys || (phys & (size - 1)) || size > 2 || quads || first) {
+    u32 staged = std::min(size, 2u);
+    u8 *data = stream_stage(count * staged);
+    if (!data) return;
+    for (GLsizei i = 0; i < count; ++i) {
+      u32 index = gfx_index(indices, type, quads ? i / 6 * 4 + quad_corners[i % 6] : i) - first;
+      if (staged == 1) data[i] = index;
+      else ((u16*)data)[i] = index;
+    }
+    indices = data;
+    size = staged;
+  }
+  GSPGPU_FlushDataCache(indices, count * size);
+
+  setup_state(projection, modelview);
+  if (!cache || !set_cached_layout(*cache, indices)) set_vertex_layout(layout, 0, indices);
+  GPU_DrawElements(quads ? GPU_TRIANGLES : gl_primitive(mode), (u32*)(uintptr_t)(osConvertVirtToPhys(indices) - vertexBase), count, size == 2);
+  draw_done();
 }
 
-void gfx_device_3ds::clearDepth(GLfloat d) {
-  GPUCMD_SetBufferOffset(0);
+void gfx_device_3ds::apply_clear_state(u32 depth_color_mask, bool stencil) {
+  apply_state(GFX_DIRTY_FRAMEBUFFER | GFX_DIRTY_SCISSOR | GFX_DIRTY_FIXED);
 
-  shaderProgramUse(&clear_shader);
+  // the clear quad bypasses the fragment state, the next draw restores it
+  u8 stencil_ref = g_state->stencilRef;
+  u8 stencil_func_mask = g_state->stencilFuncMask;
+  u8 stencil_mask = g_state->stencilMask;
+  if (stencil) {
+    u8 clear_stencil = g_state->clearStencil;
+    pica_write(GPUREG_STENCIL_TEST, 1 | (GPU_ALWAYS << 4) | (stencil_mask << 8) | (clear_stencil << 16) | (0xFF << 24));
+    pica_write(GPUREG_STENCIL_OP, GPU_STENCIL_REPLACE | (GPU_STENCIL_REPLACE << 4) | (GPU_STENCIL_REPLACE << 8));
+  } else {
+    pica_write(GPUREG_STENCIL_TEST, (GPU_NEVER << 4) | (stencil_mask << 8) | (stencil_ref << 16) | (stencil_func_mask << 24));
+    pica_write(GPUREG_STENCIL_OP, GPU_STENCIL_KEEP | (GPU_STENCIL_KEEP << 4) | (GPU_STENCIL_KEEP << 8));
+  }
+  pica_write(GPUREG_DEPTH_COLOR_MASK, depth_color_mask);
+  pica_write(GPUREG_BLEND_FUNC, GPU_BLEND_ADD | (GPU_BLEND_ADD << 8) | (GPU_ONE << 16) | (GPU_ZERO << 20) | (GPU_ONE << 24) | (GPU_ZERO << 28));
+  u8 alpha_ref = (u8)(g_state->alphaTestRef * 255.0f);
+  pica_write(GPUREG_FRAGOP_ALPHA_TEST, (GPU_NEVER << 4) | (alpha_ref << 8));
+  pica_texenv(
+              0,
+              GPU_TEVSOURCES(GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR),
+              GPU_TEVSOURCES(GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR),
+              GPU_TEVOPERANDS(0, 0, 0),
+              GPU_TEVOPERANDS(0, 0, 0),
+              GPU_REPLACE, GPU_REPLACE,
+              0xFFFFFFFF
+              );
+  g_state->dirty |= GFX_DIRTY_STENCIL | GFX_DIRTY_DEPTH | GFX_DIRTY_BLEND | GFX_DIRTY_ALPHA_TEST | GFX_DIRTY_TEXTURE;
+}
+
+/* draws a fullscreen quad through the clear shader, honouring scissor and write masks */
+void gfx_device_3ds::clear_quad(GLbitfield mask) {
+  if (!reserve(GPU_DRAW_RESERVE)) return;
+  use_program(clear_shader);
 
   float mu_proj[4*4];
   mat4 pica = mat4();
@@ -609,71 +1921,31 @@ void gfx_device_3ds::clearDepth(GLfloat d) {
     }
   }
 
-  float clear_color[4] = {1, 1, 1, 1};
-  float clear_depth[4] = {1, 1, (float)d, 1};
+  vec4 c = g_state->clearColor;
+  float clear_color[4] = { c.w, c.z, c.y, c.x };
+  // the quad is specified in clip space, the depth map turns this into 1 - clearDepth
+  float clear_depth[4] = {1, 1, 2.0f * g_state->clearDepth - 1.0f, 1};
 
   {
-    GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(clear_shader.vertexShader, "projection"), (u32*)mu_proj, 4);
-    GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(clear_shader.vertexShader, "clear_color"), (u32*)clear_color, 1);
-    GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(clear_shader.vertexShader, "clear_depth"), (u32*)clear_depth, 1);
+    set_uniform(clear_shader, UNIFORM_PROJECTION, mu_proj, 4);
+    set_uniform(clear_shader, UNIFORM_CLEAR_COLOR, clear_color, 1);
+    set_uniform(clear_shader, UNIFORM_CLEAR_DEPTH, clear_depth, 1);
   }
 
-
-  GPU_SetViewport((u32 *)osConvertVirtToPhys(gpuDOut),
-                  (u32 *)osConvertVirtToPhys(gpuOut),
-                  0, 0, width, height);
-  {
-    GLint x = g_state->scissorBox.x;
-    GLint y = g_state->scissorBox.y;
-    GLint w = g_state->scissorBox.z;
-    GLint h = g_state->scissorBox.w;
-    GPU_SetScissorTest((g_state->enableScissorTest ? ext_state.scissorMode : GPU_SCISSOR_DISABLE), x, y, x + w, y + h);
+  u32 write_mask = 0;
+  if (mask & GL_COLOR_BUFFER_BIT) {
+    write_mask |= (g_state->colorMaskRed << 0) | (g_state->colorMaskGreen << 1) | (g_state->colorMaskBlue << 2) | (g_state->colorMaskAlpha << 3);
   }
+  if (mask & GL_DEPTH_BUFFER_BIT) {
+    write_mask |= GPU_WRITE_DEPTH;
+  }
+  apply_clear_state(1 | (GPU_ALWAYS << 4) | (write_mask << 8), mask & GL_STENCIL_BUFFER_BIT);
 
-  GPU_DepthMap(-1.0f, 0.0f);
-  GPU_SetFaceCulling(GPU_CULL_NONE);
-  u8 stencil_ref = g_state->stencilRef;
-  GPU_SetStencilTest(false, GPU_NEVER, stencil_ref, g_state->stencilFuncMask, g_state->stencilMask);
-  GPU_SetStencilOp(GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP);
-  GPU_SetDepthTestAndWriteMask(true, GPU_ALWAYS, GPU_WRITE_DEPTH);
-  GPUCMD_AddMaskedWrite(GPUREG_EARLYDEPTH_TEST1, 0x1, 0);
-  GPUCMD_AddWrite(GPUREG_EARLYDEPTH_TEST2, 0);
-
-  u8 alpha_ref = (u8)(g_state->alphaTestRef * 255.0f);
-  GPU_SetAlphaTest(false, GPU_NEVER, alpha_ref);
-  GPU_SetTexEnv(
-                  0,
-                  GPU_TEVSOURCES(GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR),
-                  GPU_TEVSOURCES(GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR),
-                  GPU_TEVOPERANDS(0, 0, 0),
-                  GPU_TEVOPERANDS(0, 0, 0),
-                  GPU_REPLACE, GPU_REPLACE,
-                  0xFFFFFFFF
-                  );
-
-  GPU_SetDummyTexEnv(1);
-  GPU_SetDummyTexEnv(2);
-  GPU_SetDummyTexEnv(3);
-  GPU_SetDummyTexEnv(4);
-  GPU_SetDummyTexEnv(5);
-
-  SetAttributeBuffers(
-                      4,
-                      (u32*)osConvertVirtToPhys(clearQuadVBO->data),
-                      GPU_ATTRIBFMT(0, 3, GPU_FLOAT) | GPU_ATTRIBFMT(1, 4, GPU_FLOAT) |
-                      GPU_ATTRIBFMT(2, 4, GPU_FLOAT) | GPU_ATTRIBFMT(3, 4, GPU_FLOAT),
-                      0xFF8,
-                      0x3210,
-                      1,
-                      {0x0},
-                      {0x3210},
-                      {4}
-                      );
+  gfx_vertex_layout layout;
+  packed_layout(layout, clearQuadVBO->data, clearQuadVBO->format, g_state->currentAttributes());
+  set_vertex_layout(layout, 0, NULL);
   GPU_DrawArray(gl_primitive(GL_TRIANGLES), 0, clearQuadVBO->numVertices);
-  GPU_FinishDrawing();
-  //GPUCMD_Finalize();
-  //GPUCMD_FlushAndRun();
-  gspWaitForP3D();
+  draw_done();
 }
 
 #define DISPLAY_TRANSFER_FLAGS \
@@ -681,95 +1953,68 @@ void gfx_device_3ds::clearDepth(GLfloat d) {
   GX_TRANSFER_IN_FORMAT(GX_TRANSFER_FMT_RGBA8) | \
   GX_TRANSFER_SCALING(GX_TRANSFER_SCALE_NO))
 
+/* the transfer is queued behind the frame's lists and the next frame is recorded while they run, lists submitted
+   after it wait for it so they never draw into the frame it is still reading */
 void gfx_device_3ds::flush(u8 *fb, int w, int h, int format) {
-    
-    GX_DisplayTransfer((u32*)gpuOut, GX_BUFFER_DIM(width, height), (u32 *)fb, GX_BUFFER_DIM(w, h), DISPLAY_TRANSFER_FLAGS | GX_TRANSFER_OUT_FORMAT(format));
-    gspWaitForPPF();
+    submit();
+    gpu_push_transfer(gpuOut, GX_BUFFER_DIM(width, height), (u32 *)fb, GX_BUFFER_DIM(w, h),
+                      DISPLAY_TRANSFER_FLAGS | GX_TRANSFER_OUT_FORMAT(format));
 }
 
 #define RGBA8(r,g,b,a) ( (((r)&0xFF)<<24) | (((g)&0xFF)<<16) | (((b)&0xFF)<<8) | (((a)&0xFF)<<0) )
-void gfx_device_3ds::clear(float r, float g, float b, float a) {
-  GPUCMD_SetBufferOffset(0);
-
-  shaderProgramUse(&clear_shader);
-
-  float mu_proj[4*4];
-  mat4 pica = mat4();
-  pica[0xA] = 0.5;
-  pica[0xB] = -0.5;
 
-  int i, j;
-  for (i = 0; i < 4; i++) {
-    for (j = 0; j < 4; j++) {
-      mu_proj[i*4 + j] = pica[i*4 + (3-j)];
+/* clears whole buffers with the memory fill engine, color and depth/stencil in one
+   operation. partial clears (scissor, color masks, one half of depth/stencil) use the quad */
+void gfx_device_3ds::clear(GLbitfield mask) {
+  bool colorMasked = !(g_state->colorMaskRed && g_state->colorMaskGreen && g_state->colorMaskBlue && g_state->colorMaskAlpha);
+  if (!(g_state->colorMaskRed || g_state->colorMaskGreen || g_state->colorMaskBlue || g_state->colorMaskAlpha)) mask &= ~GL_COLOR_BUFFER_BIT;
+  if (!g_state->depthMask) mask &= ~GL_DEPTH_BUFFER_BIT;
+  if (!(g_state->stencilMask & 0xFF)) mask &= ~GL_STENCIL_BUFFER_BIT;
+  if (!mask) return;
+
+  GLbitfield quad = 0;
+  gfx_vec4i box = g_state->scissorBox;
+  if (g_state->enableScissorTest && (box.x > 0 || box.y > 0 || box.x + box.z < width || box.y + box.w < height)) {
+    quad = mask;
+  } else {
+    if ((mask & GL_COLOR_BUFFER_BIT) && colorMasked) quad |= GL_COLOR_BUFFER_BIT;
+
+    // the fill always writes depth and stencil together
+    GLbitfield ds = mask & (GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    if (ds == GL_STENCIL_BUFFER_BIT ||
+        (ds == GL_DEPTH_BUFFER_BIT && stencilUsed) ||
+        ((ds & GL_STENCIL_BUFFER_BIT) && (g_state->stencilMask & 0xFF) != 0xFF)) {
+      quad |= ds;
     }
   }
 
-  float clear_color[4] = { a, b, g, r };
-  float clear_depth[4] = {1, 1, 0, 1};
+  GLbitfield fill = mask & ~quad;
+  if (fill) {
+    // the fill engine runs outside the command list, it is queued behind what is recorded so far and the draws
+    // after it go into the next list
+    submit();
+
+    u32 *buf[2] = {NULL, NULL};
+    u32 value[2] = {0, 0};
+    int n = 0;
+    if (fill & GL_COLOR_BUFFER_BIT) {
+      vec4 c = g_state->clearColor;
+      buf[n] = gpuOut;
+      value[n++] = RGBA8((int)(c.x * 255.0f), (int)(c.y * 255.0f), (int)(c.z * 255.0f), (int)(c.w * 255.0f));
+    }
+    if (fill & (GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT)) {
+      // a depth-only fill writes back the stencil byte the buffer already holds
+      if (fill & GL_STENCIL_BUFFER_BIT) stencilFillValue = g_state->clearStencil & 0xFF;
+      buf[n] = gpuDOut;
+      value[n++] = ((u32)stencilFillValue << 24) | (u32)((1.0f - g_state->clearDepth) * 0xFFFFFF);
+      stencilUsed = false;
+    }
 
-  {
-    GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(clear_shader.vertexShader, "projection"), (u32*)mu_proj, 4);
-    GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(clear_shader.vertexShader, "clear_color"), (u32*)clear_color, 1);
-    GPU_SetFloatUniform(GPU_VERTEX_SHADER, shaderInstanceGetUniformLocation(clear_shader.vertexShader, "clear_depth"), (u32*)clear_depth, 1);
+    gpu_push_fill(buf[0], value[0], buf[1], value[1], width * height);
   }
 
-
-  GPU_SetViewport((u32 *)osConvertVirtToPhys(gpuDOut),
-                  (u32 *)osConvertVirtToPhys(gpuOut),
-                  0, 0, width, height);
-  {
-    GLint x = g_state->scissorBox.x;
-    GLint y = g_state->scissorBox.y;
-    GLint w = g_state->scissorBox.z;
-    GLint h = g_state->scissorBox.w;
-    GPU_SetScissorTest((g_state->enableScissorTest ? ext_state.scissorMode : GPU_SCISSOR_DISABLE), x, y, x + w, y + h);
+  if (quad) {
+    if (quad & GL_STENCIL_BUFFER_BIT) stencilUsed = true;
+    clear_quad(quad);
   }
-
-  GPU_DepthMap(-1.0f, 0.0f);
-  GPU_SetFaceCulling(GPU_CULL_NONE);
-  u8 stencil_ref = g_state->stencilRef;
-  GPU_SetStencilTest(false, GPU_NEVER, stencil_ref, g_state->stencilFuncMask, g_state->stencilMask);
-  GPU_SetStencilOp(GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP);
-  GPU_WRITEMASK write_mask = (GPU_WRITEMASK)((g_state->colorMaskRed << 0) | (g_state->colorMaskGreen << 1) | (g_state->colorMaskBlue << 2) | (g_state->colorMaskAlpha << 3));
-  GPU_SetDepthTestAndWriteMask(false, GPU_ALWAYS, write_mask);
-  GPUCMD_AddMaskedWrite(GPUREG_EARLYDEPTH_TEST1, 0x1, 0);
-  GPUCMD_AddWrite(GPUREG_EARLYDEPTH_TEST2, 0);
-
-  u8 alpha_ref = (u8)(g_state->alphaTestRef * 255.0f);
-  GPU_SetAlphaTest(false, GPU_NEVER, alpha_ref);
-  GPU_SetTexEnv(
-                0,
-                GPU_TEVSOURCES(GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR),
-                GPU_TEVSOURCES(GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR),
-                GPU_TEVOPERANDS(0, 0, 0),
-                GPU_TEVOPERANDS(0, 0, 0),
-                GPU_REPLACE, GPU_REPLACE,
-                0xFFFFFFFF
-                );
-
-  GPU_SetDummyTexEnv(1);
-  GPU_SetDummyTexEnv(2);
-  GPU_SetDummyTexEnv(3);
-  GPU_SetDummyTexEnv(4);
-  GPU_SetDummyTexEnv(5);
-
-  SetAttributeBuffers(
-                      4,
-                      (u32*)osConvertVirtToPhys(clearQuadVBO->data),
-                      GPU_ATTRIBFMT(0, 3, GPU_FLOAT) | GPU_ATTRIBFMT(1, 4, GPU_FLOAT) |
-                      GPU_ATTRIBFMT(2, 4, GPU_FLOAT) | GPU_ATTRIBFMT(3, 4, GPU_FLOAT),
-                      0xFF8,
-                      0x3210,
-                      1,
-                      {0x0},
-                      {0x3210},
-                      {4}
-                      );
-  GPU_DrawArray(gl_primitive(GL_TRIANGLES), 0, clearQuadVBO->numVertices);
-  GPU_FinishDrawing();
-  //GPUCMD_Finalize();
-  //GPUCMD_FlushAndRun();
- // gxCmdQueueRun(gpuCmd);
-  gspWaitForP3D();
 }
@@ -5,32 +5,143 @@
 #include "glImpl.h"
 
 #include <3ds.h>
+#include <gfx_device.h>
 #include <GL/glext.h>
 #include <GL/ctr.h>
 
-/* PICA200 extension state */
-struct gfx_device_3ds_ext {
+#define GPU_STREAM_SEGMENTS 8 // parts of the immediate mode vertex ring fenced separately
 
-    GPU_SCISSORMODE scissorMode = GPU_SCISSOR_NORMAL;
+/* GPU command list storage, reused once the GPU has retired its fence */
+struct gfx_command_buffer {
+    u32 *data = nullptr;
+    u32 size = 0; // in words
+    u32 fence = 0; // sequence number of the last list submitted from this buffer
+    u64 submitTick = 0;
+    u64 retireTick = 0;
+};
+
+/* uniform values in register order, valid while the generations they were built from match. the lighting shader
+   only has light 0, so that is the only light tracked. material and light model have no setters yet and are packed
+   again for every lit draw, set_uniform still skips the registers that didn't change */
+struct gfx_uniform_cache {
+    GLuint projectionGeneration = ~0u;
+    GLuint viewportGeneration = ~0u;
+    GLuint modelviewGeneration = ~0u;
+    GLuint lightGeneration = ~0u;
+    float projection[4*4];
+    float modelview[4*4];
+    float normal_mtx[4*4];
+    vec4 light[7]; // ambient, diffuse, specular, position, spotdir, spot_cutoff, attenuation
+    vec4 material[5]; // ambient, diffuse, specular, emissive, shininess
+    vec4 lightModelAmbient;
+};
+
+/* where the vertex loader fetches the attributes of a draw from */
+struct gfx_vertex_layout {
+    u64 formats; // GPU_ATTRIBFMT of every attribute
+    u16 fixed; // attributes loaded from the constant values instead of a buffer
+    gfx_vertex_attributes constant;
+    float colorScale; // the default shader multiplies fetched and fixed colors by this
+    u32 numBuffers;
+    u8 client; // buffers in application memory rather than buffer objects
+    u8 convert; // buffers in a type the loader has no format for, staged as floats
+    const u8 *data[GFX_ARRAY_COUNT]; // first vertex of each buffer
+    u32 stride[GFX_ARRAY_COUNT];
+    u32 size[GFX_ARRAY_COUNT]; // bytes of each vertex that are read
+    GLenum type[GFX_ARRAY_COUNT]; // GL type of the data in each buffer
+    u64 permutation[GFX_ARRAY_COUNT]; // attributes in the order they are stored
+    u8 count[GFX_ARRAY_COUNT];
+};
+
+/* attribute buffer block of a vertex array object whose arrays all live in buffer objects, valid while the
+   object's arrays and the buffer storage are unchanged */
+struct gfx_attribute_cache {
+    GLuint generation = ~0u;
+    GLuint bufferGeneration = ~0u;
+    bool usable = false; // nothing has to be staged or converted, so the block is the same for every draw
+    gfx_vertex_layout layout;
+    u32 param[0x27]; // from GPUREG_ATTRIBBUFFERS_LOC, offsets relative to param[0] << 3
+};
+
+/* client arrays staged by glLockArraysEXT, reused by the draws until the unlock */
+struct gfx_locked_arrays {
+    u8 *data = nullptr; // copies of the arrays the GPU can't read in place, linear memory
+    u32 first = 0;
+    u32 count = 0; // 0 while nothing is locked
+    u8 staged = 0; // arrays copied into data
+    u8 flushed = 0; // arrays in linear memory, flushed once at the lock
+    u32 offset[GFX_ARRAY_COUNT]; // where each staged array starts in data
+    gfx_client_array arrays[GFX_ARRAY_COUNT]; // the arrays as they were locked
 };
 
 struct gfx_device_3ds : public gfx_device {
     u32 *gpuDOut;
     u32 *gpuOut;
-    gfx_device_3ds_ext ext_state;
+    gfx_command_buffer cmdbufs[CAELINA_MAX_COMMAND_BUFFERS];
+    u32 numCmdbufs;
+    u32 currentCmdbuf;
+    u32 stalls;
+    u64 stallTicks;
+    bool stencilUsed; // stencil was drawn or cleared since the last fill, so depth-only clears must keep it
+    u8 stencilFillValue; // stencil byte the last depth/stencil fill wrote
+    gfx_uniform_cache uniforms;
+    u8 *streamData; // immediate mode vertex ring in linear memory
+    u32 streamSize;
+    u32 streamHead; // offset of the batch being recorded
+    u32 streamLimit; // the ring is free up to here
+    u32 streamFences[GPU_STREAM_SEGMENTS]; // last list reading each segment
+    u32 vertexBase; // physical address the attribute and index buffer offsets are relative to
+    gfx_locked_arrays locked;
 
     gfx_device_3ds(gfx_state *state, int w, int h);
     ~gfx_device_3ds();
-    void clear(float r, float g, float b, float a);
-    void clearDepth(GLfloat depth);
+    void bind();
+    bool busy();
+    void submit();
+    void finish();
+    void release(void *data, bool vram = false);
+    void resize(int w, int h);
+    bool reserve(u32 words);
+    void draw_done();
+    void get_stats(gfx_device_stats *stats);
+    void clear(GLbitfield mask);
     void flush(u8* fb, int w, int h, int f);
     void render_vertices(const mat4& projection, const mat4& modelview);
-    void render_vertices_vbo(const mat4& projection, const mat4& modelview, u8 *data, GLuint units);
+    void render_vertices_vbo(const mat4& projection, const mat4& modelview, u8 *data, GLuint units, u8 format, const gfx_vertex_attributes& constant);
     void render_vertices_array(GLenum mode, GLint first, GLsizei count, const mat4& projection, const mat4& modelview);
+    void render_elements_array(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLuint start, GLuint end, const mat4& projection, const mat4& modelview);
+    void buffer_data(gfx_buffer& buf, GLsizeiptr size, const GLvoid *data);
+    void buffer_sub_data(gfx_buffer& buf, GLintptr offset, GLsizeiptr size, const GLvoid *data);
+    void free_buffer(gfx_buffer& buf);
+    void lock_arrays(u32 first, u32 count);
+    void unlock_arrays();
+    void free_vertex_array(gfx_vertex_array& vao);
     void repack_texture(gfx_texture& tex);
+    void wait_texture(gfx_texture& tex);
     void free_texture(gfx_texture& tex);
     u8 *cache_vertex_list(GLuint *size);
+    bool stream_grow(u32 n);
+    bool stream_split();
+    bool stream_reserve(u32 need);
+    void stream_commit(u32 bytes);
+    u8 *stream_stage(u32 bytes);
+    void stream_reset(u32 head);
+    void stream_acquire(u32 end);
+    void wait_fence(u32 fence);
     void setup_state(const mat4& projection, const mat4& modelview);
+    void update_uniforms(const mat4& projection, const mat4& modelview);
+    void apply_state(GLbitfield groups);
+    void apply_clear_state(u32 depth_color_mask, bool stencil);
+    void clear_quad(GLbitfield mask);
+    void set_framebuffer();
+    void set_scissor();
+    void set_texture();
+    bool stage_layout(gfx_vertex_layout& layout, u32 first, u32 count);
+    void set_vertex_layout(const gfx_vertex_layout& layout, u32 first, const void *indices);
+    gfx_attribute_cache *attribute_cache();
+    bool set_cached_layout(const gfx_attribute_cache& c, const void *indices);
+    void draw_vertices(GLenum mode, u32 first, u32 count, const gfx_vertex_layout& layout, const gfx_attribute_cache *cache = nullptr);
+    u16 *quad_indices(u32& quads);
 };
 
 #endif
@@ -0,0 +1,993 @@
+#include "glImpl.h"
+#include "etc1.h"
+
+#ifdef CTRGL_HOST
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+/* Software rendering of the fixed function pipeline the PICA200 path sets up. The calling
+   thread transforms, clips and bins triangles into SW_TILE_SIZE tiles, the tiles are then
+   shaded in parallel. Every tile is owned by one thread and walks its bin in submission
+   order, so the image does not depend on the number of threads.
+
+   Draws are always batched, vertices are transformed when recorded so nothing the GL layer
+   passed in has to outlive the call. The tiles run on glFlush, glFinish, clears, texture
+   uploads and gfxFlush. */
+
+extern gfx_texture *getTexture(GLuint name);
+
+#define SW_GUARD_BAND 8.0f // clip x and y only this far outside the viewport
+#define SW_SUBPIXEL_BITS 4
+
+static vec4 transform(const mat4& m, float x, float y, float z, float w) {
+    return vec4(m.m[0][0] * x + m.m[0][1] * y + m.m[0][2] * z + m.m[0][3] * w,
+                m.m[1][0] * x + m.m[1][1] * y + m.m[1][2] * z + m.m[1][3] * w,
+                m.m[2][0] * x + m.m[2][1] * y + m.m[2][2] * z + m.m[2][3] * w,
+                m.m[3][0] * x + m.m[3][1] * y + m.m[3][2] * z + m.m[3][3] * w);
+}
+
+static float dot3(const vec4& a, const vec4& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static vec4 normalize3(const vec4& v) {
+    float len = std::sqrt(dot3(v, v));
+    if (len == 0.0f) return vec4(0, 0, 0, 0);
+    return vec4(v.x / len, v.y / len, v.z / len, 0);
+}
+
+static u8 to_u8(float v) {
+    return (u8)(clampf(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+gfx_device_sw::gfx_device_sw(gfx_state *state, int w, int h) : gfx_device(state, w, h) {
+    colorBuffer = NULL;
+    depthBuffer = NULL;
+    allocate_buffers();
+
+    generation = 0;
+    running = 0;
+    quit = false;
+    passes = 0;
+    stalls = 0;
+    stallTicks = 0;
+
+    // the thread that records joins every pass, so it counts as one of them
+    int threads = std::thread::hardware_concurrency();
+    const char *env = getenv("CTRGL_SW_THREADS");
+    if (env) threads = atoi(env);
+    if (threads < 1) threads = 1;
+    for (int i = 1; i < threads; ++i) {
+        workers.push_back(std::thread(&gfx_device_sw::worker, this));
+    }
+}
+
+gfx_device_sw::~gfx_device_sw() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : workers) t.join();
+    free(colorBuffer);
+    free(depthBuffer);
+    free(stream.base);
+}
+
+void gfx_device_sw::allocate_buffers() {
+    free(colorBuffer);
+    free(depthBuffer);
+    colorBuffer = (u32*)calloc(width * height, 4);
+    depthBuffer = (u32*)calloc(width * height, 4);
+    tilesX = (width + SW_TILE_SIZE - 1) / SW_TILE_SIZE;
+    tilesY = (height + SW_TILE_SIZE - 1) / SW_TILE_SIZE;
+    bins.assign(tilesX * tilesY, std::vector<u32>());
+}
+
+void gfx_device_sw::bind() {
+}
+
+void gfx_device_sw::submit() {
+    rasterize();
+}
+
+void gfx_device_sw::finish() {
+    rasterize();
+}
+
+void gfx_device_sw::release(void *data, bool vram) {
+    // only cached vertex lists come back here, triangles never point into them
+    free(data);
+}
+
+void gfx_device_sw::resize(int w, int h) {
+    rasterize();
+    width = w;
+    height = h;
+    allocate_buffers();
+}
+
+void gfx_device_sw::get_stats(gfx_device_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->submitted = passes;
+    stats->retired = passes;
+    stats->stalls = stalls;
+    stats->stallTicks = stallTicks;
+}
+
+/* a texel in a PICA format as RGBA bytes, the way the texture unit expands it */
+static void sw_decode_texel(const u8 *p, GPU_TEXCOLOR format, u8 rgba[4]) {
+    u16 v = 0;
+    if (gfx_texel_size(format) == 2) memcpy(&v, p, 2);
+
+    switch (format) {
+        case GPU_RGBA8: {
+            rgba[0] = p[3];
+            rgba[1] = p[2];
+            rgba[2] = p[1];
+            rgba[3] = p[0];
+        } break;
+        case GPU_RGB8: {
+            rgba[0] = p[2];
+            rgba[1] = p[1];
+            rgba[2] = p[0];
+            rgba[3] = 0xFF;
+        } break;
+        case GPU_RGB565: {
+            rgba[0] = ((v >> 11) << 3) | (v >> 13);
+            rgba[1] = (((v >> 5) & 0x3F) << 2) | ((v >> 9) & 0x3);
+            rgba[2] = ((v & 0x1F) << 3) | ((v >> 2) & 0x7);
+            rgba[3] = 0xFF;
+        } break;
+        case GPU_RGBA5551: {
+            rgba[0] = ((v >> 11) << 3) | (v >> 13);
+            rgba[1] = (((v >> 6) & 0x1F) << 3) | ((v >> 8) & 0x7);
+            rgba[2] = (((v >> 1) & 0x1F) << 3) | ((v >> 3) & 0x7);
+            rgba[3] = (v & 1) * 0xFF;
+        } break;
+        case GPU_RGBA4: {
+            rgba[0] = (v >> 12) * 0x11;
+            rgba[1] = ((v >> 8) & 0xF) * 0x11;
+            rgba[2] = ((v >> 4) & 0xF) * 0x11;
+            rgba[3] = (v & 0xF) * 0x11;
+        } break;
+        case GPU_LA8: {
+            rgba[0] = rgba[1] = rgba[2] = p[1];
+            rgba[3] = p[0];
+        } break;
+        case GPU_L8: {
+            rgba[0] = rgba[1] = rgba[2] = p[0];
+            rgba[3] = 0xFF;
+        } break;
+        case GPU_A8: {
+            rgba[0] = rgba[1] = rgba[2] = 0;
+            rgba[3] = p[0];
+        } break;
+        default: {
+            rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0;
+        } break;
+    }
+}
+
+/* ETC blocks are stored in image order with their rows bottom up, so they decode straight into place */
+static void sw_decode_blocks(gfx_texture& tex) {
+    bool alpha = tex.texelFormat == GPU_ETC1A4;
+    const u8 *block = tex.unpackedColorBuffer;
+    u8 rgba[16 * 4];
+    for (GLsizei by = 0; by < tex.height; by += 4) {
+        for (GLsizei bx = 0; bx < tex.width; bx += 4) {
+            u64 a = 0;
+            if (alpha) {
+                memcpy(&a, block, sizeof(a));
+                block += sizeof(a);
+            }
+            etc1_decode_block(block, rgba);
+            block += ETC1_BLOCK_SIZE;
+            for (int y = 0; y < 4; ++y) {
+                for (int x = 0; x < 4; ++x) {
+                    u8 *p = rgba + (y * 4 + x) * 4;
+                    if (alpha) p[3] = ((a >> (4 * (x * 4 + y))) & 0xF) * 0x11;
+                    memcpy(tex.colorBuffer + ((by + y) * tex.width + bx + x) * 4, p, 4);
+                }
+            }
+        }
+    }
+}
+
+void gfx_device_sw::repack_texture(gfx_texture& tex) {
+    // recorded draws sample the old texels
+    rasterize();
+    // no tiling, the texels are only expanded to the RGBA bytes the rasterizer reads
+    u32 count = tex.width * tex.height;
+    u32 size = gfx_texel_size(tex.texelFormat);
+    free(tex.colorBuffer);
+    tex.colorBuffer = (GLubyte*)malloc(count * 4);
+    if (tex.texelFormat == GPU_ETC1 || tex.texelFormat == GPU_ETC1A4) {
+        sw_decode_blocks(tex);
+    } else {
+        for (u32 i = 0; i < count; ++i) {
+            sw_decode_texel(tex.unpackedColorBuffer + i * size, tex.texelFormat, tex.colorBuffer + i * 4);
+        }
+    }
+    tex.extdata = 0;
+}
+
+/* colorBuffer is a decoded copy, nothing reads the unpacked texels behind the application's back */
+void gfx_device_sw::wait_texture(gfx_texture& tex) {
+}
+
+void gfx_device_sw::free_texture(gfx_texture& tex) {
+    rasterize();
+    linearFree(tex.unpackedColorBuffer);
+    free(tex.colorBuffer);
+    tex.colorBuffer = NULL;
+}
+
+/* vertices are fetched when the draw is recorded, so buffer storage is never read late */
+void gfx_device_sw::buffer_data(gfx_buffer& buf, GLsizeiptr size, const GLvoid *data) {
+    free_buffer(buf);
+    buf.size = size;
+    if (!size) return;
+    buf.data = (u8*)malloc(size);
+    if (data) memcpy(buf.data, data, size);
+}
+
+void gfx_device_sw::buffer_sub_data(gfx_buffer& buf, GLintptr offset, GLsizeiptr size, const GLvoid *data) {
+    memcpy(buf.data + offset, data, size);
+}
+
+void gfx_device_sw::free_buffer(gfx_buffer& buf) {
+    free(buf.data);
+    buf.data = NULL;
+    buf.size = 0;
+}
+
+/* arrays are read straight from application memory at every draw, there is nothing to keep */
+void gfx_device_sw::lock_arrays(u32 first, u32 count) {
+}
+
+void gfx_device_sw::unlock_arrays() {
+}
+
+void gfx_device_sw::free_vertex_array(gfx_vertex_array& vao) {
+}
+
+u8 *gfx_device_sw::cache_vertex_list(GLuint *size) {
+    u32 bytes = stream.count * stream.stride;
+    *size = bytes + sizeof(gfx_vertex_attributes);
+    u8 *data = (u8*)malloc(*size);
+    memcpy(data, stream.base, bytes);
+    memcpy(data + bytes, &stream.constant, sizeof(gfx_vertex_attributes));
+    return data;
+}
+
+bool gfx_device_sw::stream_grow(u32 n) {
+    // batches are transformed at glEnd, so one buffer serves all of them
+    u32 size = std::max(stream.size * 2, (stream.count + n) * stream.stride);
+    u8 *base = (u8*)realloc(stream.base, size);
+    if (!base) {
+        stream.count = 0;
+        return false;
+    }
+    stream.base = base;
+    stream.size = size;
+    stream.capacity = size / stream.stride;
+    return true;
+}
+
+void gfx_device_sw::render_vertices(const mat4& projection, const mat4& modelview) {
+    draw(g_state->vertexDrawMode, stream.base, stream.format, stream.constant, stream.count, projection, modelview);
+    stream.count = 0;
+}
+
+void gfx_device_sw::render_vertices_vbo(const mat4& projection, const mat4& modelview, u8 *data, GLuint units, u8 format, const gfx_vertex_attributes& constant) {
+    draw(g_state->vertexDrawMode, data, format, constant, units, projection, modelview);
+}
+
+/* packed format holding the enabled client arrays and where they start, false if one of them has no data */
+static bool array_format(const gfx_state *state, u8 *format, const u8 *data[GFX_ARRAY_COUNT]) {
+    static const u8 array_formats[GFX_ARRAY_COUNT] = {0, GFX_VERTEX_TEXCOORD, GFX_VERTEX_COLOR, GFX_VERTEX_NORMAL};
+
+    *format = 0;
+    for (u32 i = 0; i < GFX_ARRAY_COUNT; ++i) {
+        const gfx_client_array& array = state->clientArrays[i];
+        if (!array.enabled) continue;
+        data[i] = state->arrayData(array);
+        if (!gfx_array_type_size(array.type) || !data[i]) return false;
+        *format |= array_formats[i];
+    }
+    return true;
+}
+
+/* vertex i of the client arrays repacked into the immediate mode layout */
+static u8 *pack_array_vertex(u8 *dst, const gfx_state *state, const u8 *const data[GFX_ARRAY_COUNT], u8 format, const gfx_vertex_attributes& constant, u32 i) {
+    // components an array leaves out read as in GL, 0 0 0 1
+    vec4 v[GFX_ARRAY_COUNT] = {constant.texCoord, constant.texCoord, constant.color, constant.normal};
+    for (u32 j = 0; j < GFX_ARRAY_COUNT; ++j) {
+        const gfx_client_array& array = state->clientArrays[j];
+        if (!array.enabled) continue;
+        const u8 *p = data[j] + i * gfx_array_stride(array);
+        bool normalized = j == GFX_ARRAY_COLOR || j == GFX_ARRAY_NORMAL;
+        v[j] = vec4(0, 0, 0, 1);
+        for (int k = 0; k < array.size; ++k) v[j][k] = gfx_array_component(p, array.type, k, normalized);
+    }
+    gfx_vertex_attributes attr;
+    attr.texCoord = v[GFX_ARRAY_TEXCOORD];
+    attr.color = v[GFX_ARRAY_COLOR];
+    attr.normal = v[GFX_ARRAY_NORMAL];
+    return gfx_pack_vertex(dst, format, v[0].x, v[0].y, v[0].z, attr);
+}
+
+void gfx_device_sw::render_vertices_array(GLenum mode, GLint first, GLsizei count, const mat4& projection, const mat4& modelview) {
+    u8 format;
+    const u8 *data[GFX_ARRAY_COUNT];
+    if (!array_format(g_state, &format, data)) return;
+
+    gfx_vertex_attributes constant = g_state->currentAttributes();
+    std::vector<u8> vertices(count * gfx_vertex_stride(format));
+    u8 *dst = &vertices[0];
+    for (GLsizei i = 0; i < count; ++i) {
+        dst = pack_array_vertex(dst, g_state, data, format, constant, first + i);
+    }
+    draw(mode, &vertices[0], format, constant, count, projection, modelview);
+}
+
+void gfx_device_sw::render_elements_array(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLuint start, GLuint end, const mat4& projection, const mat4& modelview) {
+    u8 format;
+    const u8 *data[GFX_ARRAY_COUNT];
+    if (!array_format(g_state, &format, data)) return;
+
+    // every index fetches its vertex again, like the loader does without a vertex cache
+    gfx_vertex_attributes constant = g_state->currentAttributes();
+    std::vector<u8> vertices(count * gfx_vertex_stride(format));
+    u8 *dst = &vertices[0];
+    for (GLsizei i = 0; i < count; ++i) {
+        dst = pack_array_vertex(dst, g_state, data, format, constant, gfx_index(indices, type, i));
+    }
+    draw(mode, &vertices[0], format, constant, count, projection, modelview);
+}
+
+/* ------------------------------------------------------------------------------------------ */
+/* front end */
+
+u32 gfx_device_sw::capture_state() {
+    sw_fragment_state st;
+
+    gfx_texture *text = g_state->enableTexture2D ? getTexture(g_state->currentBoundTexture) : NULL;
+    if (text && text->colorBuffer) {
+        st.texture = text->colorBuffer;
+        st.texWidth = text->width;
+        st.texHeight = text->height;
+        st.texEnv = text->format == GL_ALPHA ? SW_TEXENV_ALPHA : SW_TEXENV_MODULATE;
+        st.minFilter = text->min_filter;
+        st.magFilter = text->mag_filter;
+        st.wrapS = text->wrap_s;
+        st.wrapT = text->wrap_t;
+    }
+
+    st.alphaTest = g_state->enableAlphaTest;
+    st.alphaFunc = g_state->alphaTestFunc;
+    st.alphaRef = (u8)(g_state->alphaTestRef * 255.0f);
+
+    st.stencilTest = g_state->enableStencilTest;
+    st.stencilFunc = g_state->stencilFunc;
+    st.stencilRef = g_state->stencilRef;
+    st.stencilFuncMask = g_state->stencilFuncMask;
+    st.stencilMask = g_state->stencilMask;
+    st.stencilOpSFail = g_state->stencilOpSFail;
+    st.stencilOpZFail = g_state->stencilOpZFail;
+    st.stencilOpZPass = g_state->stencilOpZPass;
+
+    st.depthTest = g_state->enableDepthTest;
+    st.depthFunc = g_state->depthFunc;
+    st.depthMask = g_state->depthMask;
+
+    st.blend = g_state->enableBlend;
+    st.blendSrc = g_state->blendSrcFactor;
+    st.blendDst = g_state->blendDstFactor;
+    for (int i = 0; i < 4; ++i) st.blendColor[i] = g_state->blendColor >> (i * 8);
+
+    st.colorMask = (g_state->colorMaskRed ? 0xFF000000 : 0) | (g_state->colorMaskGreen ? 0x00FF0000 : 0) |
+                   (g_state->colorMaskBlue ? 0x0000FF00 : 0) | (g_state->colorMaskAlpha ? 0x000000FF : 0);
+
+    if (g_state->enableScissorTest) {
+        gfx_vec4i box = g_state->scissorBox;
+        st.scissorMode = ext_state.scissorMode;
+        st.scissor[0] = box.x;
+        st.scissor[1] = height - (box.y + box.w);
+        st.scissor[2] = box.x + box.z;
+        st.scissor[3] = height - box.y;
+    }
+
+    states.push_back(st);
+    return states.size() - 1;
+}
+
+/* GL lighting for every enabled light, the material stands in for the vertex color */
+static vec4 light_vertex(const gfx_state *s, const vec4& eye, const vec4& normal) {
+    const gfx_material& mat = s->material;
+    vec4 c = mat.emissiveColor + vec4(mat.ambientColor.x * s->lightModelAmbient.x,
+                                      mat.ambientColor.y * s->lightModelAmbient.y,
+                                      mat.ambientColor.z * s->lightModelAmbient.z, 0);
+
+    for (int i = 0; i < IMPL_MAX_LIGHTS; ++i) {
+        if (!s->enableLight[i]) continue;
+        const gfx_light& l = s->lights[i];
+
+        vec4 dir;
+        float atten = 1.0f;
+        if (l.position.w != 0.0f) {
+            dir = vec4(l.position.x / l.position.w - eye.x, l.position.y / l.position.w - eye.y, l.position.z / l.position.w - eye.z, 0);
+            float d = std::sqrt(dot3(dir, dir));
+            dir = normalize3(dir);
+            atten = 1.0f / (l.constantAttenuation + l.linearAttenuation * d + l.quadraticAttenuation * d * d);
+            if (l.spotlightCutoff != 180.0f) {
+                float spot = -dot3(dir, normalize3(l.spotlightDirection));
+                if (spot < cosf(l.spotlightCutoff * (float)M_PI / 180.0f)) continue;
+                atten *= powf(spot, l.spotlightExpo);
+            }
+        } else {
+            dir = normalize3(l.position);
+        }
+
+        float diffuse = std::max(dot3(normal, dir), 0.0f);
+        float specular = 0.0f;
+        if (diffuse > 0.0f) {
+            vec4 view = s->lightModelLocalEye ? normalize3(-eye) : vec4(0, 0, 1, 0);
+            float nh = std::max(dot3(normal, normalize3(dir + view)), 0.0f);
+            specular = mat.specularExpo ? powf(nh, mat.specularExpo) : 1.0f;
+        }
+
+        c.x += atten * (mat.ambientColor.x * l.ambient.x + diffuse * mat.diffuseColor.x * l.diffuse.x + specular * mat.specularColor.x * l.specular.x);
+        c.y += atten * (mat.ambientColor.y * l.ambient.y + diffuse * mat.diffuseColor.y * l.diffuse.y + specular * mat.specularColor.y * l.specular.y);
+        c.z += atten * (mat.ambientColor.z * l.ambient.z + diffuse * mat.diffuseColor.z * l.diffuse.z + specular * mat.specularColor.z * l.specular.z);
+    }
+
+    return vec4(clampf(c.x, 0, 1), clampf(c.y, 0, 1), clampf(c.z, 0, 1), clampf(mat.diffuseColor.w, 0, 1));
+}
+
+void gfx_device_sw::shade(const u8 *in, u8 format, const gfx_vertex_attributes& constant, sw_vertex& out, const mat4& mvp, const mat4& modelview) {
+    // attributes the vertex lacks read the constant values, like the fixed attributes on the GPU
+    float p[3];
+    gfx_vertex_attributes attr = constant;
+    gfx_unpack_vertex(in, format, p, attr);
+
+    out.position = transform(mvp, p[0], p[1], p[2], 1.0f);
+    out.s = attr.texCoord.x;
+    out.t = attr.texCoord.y;
+
+    if (!g_state->enableLighting) {
+        out.color = attr.color;
+        return;
+    }
+
+    // normals go through the upper 3x3 of the modelview like in the lighting shader
+    vec4 eye = transform(modelview, p[0], p[1], p[2], 1.0f);
+    vec4 normal = normalize3(transform(modelview, attr.normal.x, attr.normal.y, attr.normal.z, 0.0f));
+    out.color = light_vertex(g_state, eye, normal);
+}
+
+void gfx_device_sw::draw(GLenum mode, const u8 *vertices, u8 format, const gfx_vertex_attributes& constant, u32 count, const mat4& projection, const mat4& modelview) {
+    if (!count) return;
+
+    mat4 viewport = g_state->viewportMatrix;
+    mat4 proj = projection;
+    mat4 mvp = viewport * proj * modelview;
+
+    u32 stride = gfx_vertex_stride(format);
+    transformed.resize(count);
+    for (u32 i = 0; i < count; ++i) {
+        shade(vertices + i * stride, format, constant, transformed[i], mvp, modelview);
+    }
+
+    u32 state = capture_state();
+    u32 num = 0;
+    switch (mode) {
+#ifndef SPEC_GLES
+        case GL_QUADS: num = count / 4 * 2; break; // 0 1 2 and 0 2 3, as in the GPU's index pattern
+        case GL_QUAD_STRIP: num = count >= 4 ? (count & ~1) - 2 : 0; break;
+        case GL_POLYGON:
+#endif
+        case GL_TRIANGLE_STRIP:
+        case GL_TRIANGLE_FAN: num = count >= 3 ? count - 2 : 0; break;
+        case GL_TRIANGLES: num = count / 3; break;
+        default: return; // points and lines are not rasterized by the PICA200 path either
+    }
+
+    for (u32 i = 0; i < num; ++i) {
+        if (triangles.size() >= SW_MAX_PENDING) {
+            rasterize();
+            state = capture_state();
+        }
+
+        const sw_vertex *v = &transformed[0];
+        switch (mode) {
+#ifndef SPEC_GLES
+            case GL_QUADS: {
+                const sw_vertex *q = v + i / 2 * 4;
+                if (i & 1) clip_triangle(q[0], q[2], q[3], state);
+                else clip_triangle(q[0], q[1], q[2], state);
+            } break;
+            case GL_QUAD_STRIP:
+#endif
+            case GL_TRIANGLE_STRIP: clip_triangle(v[i], v[i + 1], v[i + 2], state); break;
+#ifndef SPEC_GLES
+            case GL_POLYGON:
+#endif
+            case GL_TRIANGLE_FAN: clip_triangle(v[0], v[i + 1], v[i + 2], state); break;
+            default: clip_triangle(v[i * 3], v[i * 3 + 1], v[i * 3 + 2], state); break;
+        }
+    }
+}
+
+/* signed distance to the clip planes: near, far, then the guard band */
+static float clip_distance(const vec4& p, int plane) {
+    switch (plane) {
+        case 0: return p.z;
+        case 1: return p.w - p.z;
+        case 2: return p.x + SW_GUARD_BAND * p.w;
+        case 3: return SW_GUARD_BAND * p.w - p.x;
+        case 4: return p.y + SW_GUARD_BAND * p.w;
+        default: return SW_GUARD_BAND * p.w - p.y;
+    }
+}
+
+static sw_vertex clip_lerp(const sw_vertex& a, const sw_vertex& b, float t) {
+    sw_vertex r;
+    r.position = a.position + (b.position - a.position) * t;
+    r.color = a.color + (b.color - a.color) * t;
+    r.s = a.s + (b.s - a.s) * t;
+    r.t = a.t + (b.t - a.t) * t;
+    return r;
+}
+
+void gfx_device_sw::clip_triangle(const sw_vertex& v0, const sw_vertex& v1, const sw_vertex& v2, u32 state) {
+    const sw_vertex *in[3] = {&v0, &v1, &v2};
+    u32 outside = 0;
+    for (int plane = 0; plane < 6; ++plane) {
+        for (int i = 0; i < 3; ++i) {
+            if (clip_distance(in[i]->position, plane) < 0.0f) outside |= 1 << plane;
+        }
+    }
+    if (!outside) {
+        setup_triangle(v0, v1, v2, state);
+        return;
+    }
+
+    std::vector<sw_vertex>& poly = clipped;
+    std::vector<sw_vertex> next;
+    poly.clear();
+    poly.push_back(v0);
+    poly.push_back(v1);
+    poly.push_back(v2);
+    for (int plane = 0; plane < 6 && poly.size() >= 3; ++plane) {
+        if (!(outside & (1 << plane))) continue;
+        next.clear();
+        for (u32 i = 0; i < poly.size(); ++i) {
+            const sw_vertex& a = poly[i];
+            const sw_vertex& b = poly[(i + 1) % poly.size()];
+            float da = clip_distance(a.position, plane);
+            float db = clip_distance(b.position, plane);
+            if (da >= 0.0f) next.push_back(a);
+            if ((da >= 0.0f) != (db >= 0.0f)) next.push_back(clip_lerp(a, b, da / (da - db)));
+        }
+        poly.swap(next);
+    }
+
+    for (u32 i = 2; i < poly.size(); ++i) {
+        setup_triangle(poly[0], poly[i - 1], poly[i], state);
+    }
+}
+
+void gfx_device_sw::setup_triangle(const sw_vertex& v0, const sw_vertex& v1, const sw_vertex& v2, u32 state) {
+    const sw_vertex *v[3] = {&v0, &v1, &v2};
+    sw_triangle tri;
+    s64 x[3], y[3];
+    float bx[3], by[3];
+
+    for (int i = 0; i < 3; ++i) {
+        const vec4& p = v[i]->position;
+        if (p.w <= 0.0f) return;
+        float invW = 1.0f / p.w;
+        bx[i] = (p.x * invW + 1.0f) * width * 0.5f;
+        by[i] = height - (p.y * invW + 1.0f) * height * 0.5f;
+        x[i] = lrintf(bx[i] * (1 << SW_SUBPIXEL_BITS));
+        y[i] = lrintf(by[i] * (1 << SW_SUBPIXEL_BITS));
+        tri.z[i] = clampf(p.z * invW, 0.0f, 1.0f);
+        tri.invW[i] = invW;
+        tri.color[i][0] = v[i]->color.x * invW;
+        tri.color[i][1] = v[i]->color.y * invW;
+        tri.color[i][2] = v[i]->color.z * invW;
+        tri.color[i][3] = v[i]->color.w * invW;
+        tri.st[i][0] = v[i]->s * invW;
+        tri.st[i][1] = v[i]->t * invW;
+    }
+
+    s64 area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (area == 0) return;
+    if (area < 0) {
+        // no culling, turn it around so the inside is positive for every edge
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+        std::swap(bx[1], bx[2]);
+        std::swap(by[1], by[2]);
+        std::swap(tri.z[1], tri.z[2]);
+        std::swap(tri.invW[1], tri.invW[2]);
+        std::swap(tri.color[1], tri.color[2]);
+        std::swap(tri.st[1], tri.st[2]);
+        area = -area;
+    }
+
+    // pixel centers inside the bounding box
+    const s64 half = 1 << (SW_SUBPIXEL_BITS - 1);
+    s64 minX = std::min(x[0], std::min(x[1], x[2])), maxX = std::max(x[0], std::max(x[1], x[2]));
+    s64 minY = std::min(y[0], std::min(y[1], y[2])), maxY = std::max(y[0], std::max(y[1], y[2]));
+    tri.minX = std::max<s64>((minX - half + (1 << SW_SUBPIXEL_BITS) - 1) >> SW_SUBPIXEL_BITS, 0);
+    tri.minY = std::max<s64>((minY - half + (1 << SW_SUBPIXEL_BITS) - 1) >> SW_SUBPIXEL_BITS, 0);
+    tri.maxX = std::min<s64>((maxX - half) >> SW_SUBPIXEL_BITS, width - 1);
+    tri.maxY = std::min<s64>((maxY - half) >> SW_SUBPIXEL_BITS, height - 1);
+    if (tri.minX > tri.maxX || tri.minY > tri.maxY) return;
+
+    // edge k lies opposite vertex k, evaluated at pixel centers
+    for (int k = 0; k < 3; ++k) {
+        int i = (k + 1) % 3, j = (k + 2) % 3;
+        s64 dx = x[j] - x[i], dy = y[j] - y[i];
+        s64 c = dy * x[i] - dx * y[i] - dy * half + dx * half;
+        // top-left rule, pixels exactly on other edges belong to the neighbour
+        bool topLeft = dy < 0 || (dy == 0 && dx > 0);
+        tri.a[k] = -dy << SW_SUBPIXEL_BITS;
+        tri.b[k] = dx << SW_SUBPIXEL_BITS;
+        tri.c[k] = topLeft ? c : c - 1;
+    }
+    tri.invArea = 1.0f / (float)area;
+    tri.state = state;
+
+    const sw_fragment_state& st = states[state];
+    tri.minify = false;
+    if (st.texture) {
+        float s0 = tri.st[0][0] / tri.invW[0], t0 = tri.st[0][1] / tri.invW[0];
+        float s1 = tri.st[1][0] / tri.invW[1], t1 = tri.st[1][1] / tri.invW[1];
+        float s2 = tri.st[2][0] / tri.invW[2], t2 = tri.st[2][1] / tri.invW[2];
+        float texels = fabsf((s1 - s0) * (t2 - t0) - (t1 - t0) * (s2 - s0)) * st.texWidth * st.texHeight;
+        float pixels = fabsf((bx[1] - bx[0]) * (by[2] - by[0]) - (by[1] - by[0]) * (bx[2] - bx[0]));
+        tri.minify = texels > pixels;
+    }
+
+    u32 index = triangles.size();
+    triangles.push_back(tri);
+    for (int ty = tri.minY / SW_TILE_SIZE; ty <= tri.maxY / SW_TILE_SIZE; ++ty) {
+        for (int tx = tri.minX / SW_TILE_SIZE; tx <= tri.maxX / SW_TILE_SIZE; ++tx) {
+            bins[ty * tilesX + tx].push_back(index);
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------------------------ */
+/* back end */
+
+void gfx_device_sw::worker() {
+    u32 seen = 0;
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        wake.wait(guard, [&] { return quit || generation != seen; });
+        if (quit) return;
+        seen = generation;
+        guard.unlock();
+
+        for (int tile; (tile = nextTile++) < tilesX * tilesY; ) rasterize_tile(tile);
+
+        guard.lock();
+        if (--running == 0) idle.notify_one();
+    }
+}
+
+void gfx_device_sw::rasterize() {
+    if (triangles.empty()) {
+        states.clear();
+        return;
+    }
+
+    u64 start = svcGetSystemTick();
+    nextTile = 0;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = workers.size();
+        ++generation;
+    }
+    wake.notify_all();
+
+    for (int tile; (tile = nextTile++) < tilesX * tilesY; ) rasterize_tile(tile);
+
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        idle.wait(guard, [&] { return running == 0; });
+    }
+
+    for (std::vector<u32>& bin : bins) bin.clear();
+    triangles.clear();
+    states.clear();
+
+    ++passes;
+    ++stalls;
+    stallTicks += svcGetSystemTick() - start;
+}
+
+static bool sw_compare(GLenum func, u32 a, u32 b) {
+    switch (func) {
+        case GL_NEVER: return false;
+        case GL_LESS: return a < b;
+        case GL_EQUAL: return a == b;
+        case GL_LEQUAL: return a <= b;
+        case GL_GREATER: return a > b;
+        case GL_NOTEQUAL: return a != b;
+        case GL_GEQUAL: return a >= b;
+    }
+
+    return true;
+}
+
+static u8 sw_stencilop(GLenum op, u8 value, u8 ref) {
+    switch (op) {
+        case GL_ZERO: return 0;
+        case GL_REPLACE: return ref;
+        case GL_INCR: return value == 0xFF ? value : value + 1;
+        case GL_DECR: return value == 0 ? value : value - 1;
+#if !defined(SPEC_GLES) || defined(SPEC_GLES2)
+        case GL_INCR_WRAP: return value + 1;
+        case GL_DECR_WRAP: return value - 1;
+#endif
+        case GL_INVERT: return ~value;
+    }
+
+    return value;
+}
+
+static u32 sw_blendfactor(GLenum factor, int c, const u8 *src, const u8 *dst, const u8 *constant) {
+    switch (factor) {
+        case GL_ZERO: return 0;
+        case GL_ONE: return 255;
+        case GL_SRC_COLOR: return src[c];
+        case GL_ONE_MINUS_SRC_COLOR: return 255 - src[c];
+        case GL_DST_COLOR: return dst[c];
+        case GL_ONE_MINUS_DST_COLOR: return 255 - dst[c];
+        case GL_SRC_ALPHA: return src[3];
+        case GL_ONE_MINUS_SRC_ALPHA: return 255 - src[3];
+        case GL_DST_ALPHA: return dst[3];
+        case GL_ONE_MINUS_DST_ALPHA: return 255 - dst[3];
+        case GL_SRC_ALPHA_SATURATE: return c == 3 ? 255 : std::min<u32>(src[3], 255 - dst[3]);
+#if !defined(SPEC_GLES) || defined(SPEC_GLES2)
+        case GL_CONSTANT_COLOR: return constant[c];
+        case GL_ONE_MINUS_CONSTANT_COLOR: return 255 - constant[c];
+        case GL_CONSTANT_ALPHA: return constant[3];
+        case GL_ONE_MINUS_CONSTANT_ALPHA: return 255 - constant[3];
+#endif
+    }
+
+    return 255;
+}
+
+/* texel index after wrapping, -1 samples the (black) border */
+static int sw_wrap(int i, int size, u8 mode) {
+    switch (mode) {
+        case GPU_CLAMP_TO_EDGE: return clampi(i, 0, size - 1);
+        case GPU_CLAMP_TO_BORDER: return i < 0 || i >= size ? -1 : i;
+        case GPU_MIRRORED_REPEAT: {
+            int m = ((i % (2 * size)) + 2 * size) % (2 * size);
+            return m < size ? m : 2 * size - 1 - m;
+        }
+    }
+
+    return ((i % size) + size) % size;
+}
+
+static void sw_texel(const sw_fragment_state& st, int x, int y, u32 rgba[4]) {
+    x = sw_wrap(x, st.texWidth, st.wrapS);
+    y = sw_wrap(y, st.texHeight, st.wrapT);
+    if (x < 0 || y < 0) {
+        rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0;
+        return;
+    }
+    const u8 *p = st.texture + (y * st.texWidth + x) * 4;
+    for (int c = 0; c < 4; ++c) rgba[c] = p[c];
+}
+
+static void sw_sample(const sw_fragment_state& st, bool minify, float s, float t, u8 out[4]) {
+    float u = s * st.texWidth;
+    float v = t * st.texHeight;
+    u32 texel[4];
+
+    if ((minify ? st.minFilter : st.magFilter) == GPU_NEAREST) {
+        sw_texel(st, (int)floorf(u), (int)floorf(v), texel);
+        for (int c = 0; c < 4; ++c) out[c] = texel[c];
+        return;
+    }
+
+    u -= 0.5f;
+    v -= 0.5f;
+    int x = (int)floorf(u), y = (int)floorf(v);
+    u32 fx = (u32)((u - x) * 256.0f), fy = (u32)((v - y) * 256.0f);
+    u32 t00[4], t10[4], t01[4], t11[4];
+    sw_texel(st, x, y, t00);
+    sw_texel(st, x + 1, y, t10);
+    sw_texel(st, x, y + 1, t01);
+    sw_texel(st, x + 1, y + 1, t11);
+    for (int c = 0; c < 4; ++c) {
+        u32 top = t00[c] * (256 - fx) + t10[c] * fx;
+        u32 bottom = t01[c] * (256 - fx) + t11[c] * fx;
+        out[c] = (top * (256 - fy) + bottom * fy + (1 << 15)) >> 16;
+    }
+}
+
+static bool sw_scissor(const sw_fragment_state& st, int x, int y) {
+    if (st.scissorMode == GPU_SCISSOR_DISABLE) return true;
+    bool inside = x >= st.scissor[0] && y >= st.scissor[1] && x < st.scissor[2] && y < st.scissor[3];
+    return st.scissorMode == GPU_SCISSOR_INVERT ? !inside : inside;
+}
+
+void gfx_device_sw::rasterize_tile(int tile) {
+    const std::vector<u32>& bin = bins[tile];
+    if (bin.empty()) return;
+
+    int tileX0 = (tile % tilesX) * SW_TILE_SIZE;
+    int tileY0 = (tile / tilesX) * SW_TILE_SIZE;
+    int tileX1 = std::min(tileX0 + SW_TILE_SIZE, width) - 1;
+    int tileY1 = std::min(tileY0 + SW_TILE_SIZE, height) - 1;
+
+    for (u32 index : bin) {
+        const sw_triangle& tri = triangles[index];
+        const sw_fragment_state& st = states[tri.state];
+        int x0 = std::max(tri.minX, tileX0), x1 = std::min(tri.maxX, tileX1);
+        int y0 = std::max(tri.minY, tileY0), y1 = std::min(tri.maxY, tileY1);
+
+        for (int y = y0; y <= y1; ++y) {
+            s64 e[3];
+            for (int k = 0; k < 3; ++k) e[k] = tri.a[k] * x0 + tri.b[k] * y + tri.c[k];
+
+            for (int x = x0; x <= x1; ++x, e[0] += tri.a[0], e[1] += tri.a[1], e[2] += tri.a[2]) {
+                if ((e[0] | e[1] | e[2]) < 0) continue;
+                if (!sw_scissor(st, x, y)) continue;
+
+                float l0 = e[0] * tri.invArea, l1 = e[1] * tri.invArea, l2 = e[2] * tri.invArea;
+                float w = 1.0f / (l0 * tri.invW[0] + l1 * tri.invW[1] + l2 * tri.invW[2]);
+
+                u8 color[4];
+                for (int c = 0; c < 4; ++c) {
+                    color[c] = to_u8((l0 * tri.color[0][c] + l1 * tri.color[1][c] + l2 * tri.color[2][c]) * w);
+                }
+
+                if (st.texture) {
+                    float s = (l0 * tri.st[0][0] + l1 * tri.st[1][0] + l2 * tri.st[2][0]) * w;
+                    float t = (l0 * tri.st[0][1] + l1 * tri.st[1][1] + l2 * tri.st[2][1]) * w;
+                    u8 texel[4];
+                    sw_sample(st, tri.minify, s, t, texel);
+                    if (st.texEnv == SW_TEXENV_MODULATE) {
+                        for (int c = 0; c < 4; ++c) color[c] = color[c] * texel[c] / 255;
+                    } else {
+                        color[3] = color[3] * texel[3] / 255;
+                    }
+                }
+
+                if (st.alphaTest && !sw_compare(st.alphaFunc, color[3], st.alphaRef)) continue;
+
+                u32& ds = depthBuffer[y * width + x];
+                u8 stencil = ds >> 24;
+                u32 depth = ds & 0xFFFFFF;
+                u8 newStencil = stencil;
+
+                if (st.stencilTest &&
+                    !sw_compare(st.stencilFunc, st.stencilRef & st.stencilFuncMask, stencil & st.stencilFuncMask)) {
+                    newStencil = sw_stencilop(st.stencilOpSFail, stencil, st.stencilRef);
+                    ds = (ds & 0xFFFFFF) | (u32)((stencil & ~st.stencilMask) | (newStencil & st.stencilMask)) << 24;
+                    continue;
+                }
+
+                u32 z = (u32)((l0 * tri.z[0] + l1 * tri.z[1] + l2 * tri.z[2]) * 0xFFFFFF + 0.5f);
+                if (st.depthTest && !sw_compare(st.depthFunc, z, depth)) {
+                    if (st.stencilTest) {
+                        newStencil = sw_stencilop(st.stencilOpZFail, stencil, st.stencilRef);
+                        ds = (ds & 0xFFFFFF) | (u32)((stencil & ~st.stencilMask) | (newStencil & st.stencilMask)) << 24;
+                    }
+                    continue;
+                }
+
+                if (st.stencilTest) newStencil = sw_stencilop(st.stencilOpZPass, stencil, st.stencilRef);
+                if (st.depthTest && st.depthMask) depth = z;
+                ds = depth | (u32)((stencil & ~st.stencilMask) | (newStencil & st.stencilMask)) << 24;
+
+                u32& pixel = colorBuffer[y * width + x];
+                if (st.blend) {
+                    u8 dst[4] = {(u8)(pixel >> 24), (u8)(pixel >> 16), (u8)(pixel >> 8), (u8)pixel};
+                    u8 src[4] = {color[0], color[1], color[2], color[3]};
+                    for (int c = 0; c < 4; ++c) {
+                        u32 v = src[c] * sw_blendfactor(st.blendSrc, c, src, dst, st.blendColor) +
+                                dst[c] * sw_blendfactor(st.blendDst, c, src, dst, st.blendColor);
+                        color[c] = std::min<u32>((v + 127) / 255, 255);
+                    }
+                }
+
+                u32 value = (color[0] << 24) | (color[1] << 16) | (color[2] << 8) | color[3];
+                pixel = (pixel & ~st.colorMask) | (value & st.colorMask);
+            }
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------------------------ */
+
+#define RGBA8(r,g,b,a) ( (((r)&0xFF)<<24) | (((g)&0xFF)<<16) | (((b)&0xFF)<<8) | (((a)&0xFF)<<0) )
+
+void gfx_device_sw::clear(GLbitfield mask) {
+    rasterize();
+
+    sw_fragment_state st;
+    if (g_state->enableScissorTest) {
+        gfx_vec4i box = g_state->scissorBox;
+        st.scissorMode = ext_state.scissorMode;
+        st.scissor[0] = box.x;
+        st.scissor[1] = height - (box.y + box.w);
+        st.scissor[2] = box.x + box.z;
+        st.scissor[3] = height - box.y;
+    }
+
+    u32 colorMask = 0, dsMask = 0;
+    if (mask & GL_COLOR_BUFFER_BIT) {
+        colorMask = (g_state->colorMaskRed ? 0xFF000000 : 0) | (g_state->colorMaskGreen ? 0x00FF0000 : 0) |
+                    (g_state->colorMaskBlue ? 0x0000FF00 : 0) | (g_state->colorMaskAlpha ? 0x000000FF : 0);
+    }
+    if ((mask & GL_DEPTH_BUFFER_BIT) && g_state->depthMask) dsMask |= 0xFFFFFF;
+    if (mask & GL_STENCIL_BUFFER_BIT) dsMask |= (g_state->stencilMask & 0xFF) << 24;
+    if (!colorMask && !dsMask) return;
+
+    vec4 c = g_state->clearColor;
+    u32 color = RGBA8((int)(c.x * 255.0f), (int)(c.y * 255.0f), (int)(c.z * 255.0f), (int)(c.w * 255.0f));
+    u32 ds = ((u32)(g_state->clearStencil & 0xFF) << 24) | (u32)(clampf(g_state->clearDepth, 0, 1) * 0xFFFFFF);
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            if (!sw_scissor(st, x, y)) continue;
+            u32& pixel = colorBuffer[y * width + x];
+            u32& depth = depthBuffer[y * width + x];
+            pixel = (pixel & ~colorMask) | (color & colorMask);
+            depth = (depth & ~dsMask) | (ds & dsMask);
+        }
+    }
+}
+
+void gfx_device_sw::flush(u8 *fb, int w, int h, int format) {
+    rasterize();
+
+    // same orientation as the display transfer out of the PICA200 framebuffer
+    static const int bpp[] = {4, 3, 2, 2, 2};
+    int b = bpp[format <= GX_TRANSFER_FMT_RGBA4 ? format : GX_TRANSFER_FMT_RGBA8];
+    for (int y = 0; y < std::min(h, height); ++y) {
+        for (int x = 0; x < std::min(w, width); ++x) {
+            u32 v = colorBuffer[y * width + x];
+            u32 r = v >> 24, g = (v >> 16) & 0xFF, bl = (v >> 8) & 0xFF, a = v & 0xFF;
+            u8 *p = fb + (y * w + x) * b;
+            u16 out;
+            switch (format) {
+                case GX_TRANSFER_FMT_RGB8:
+                    p[0] = bl; p[1] = g; p[2] = r;
+                    continue;
+                case GX_TRANSFER_FMT_RGB565:
+                    out = ((r >> 3) << 11) | ((g >> 2) << 5) | (bl >> 3);
+                    break;
+                case GX_TRANSFER_FMT_RGB5A1:
+                    out = ((r >> 3) << 11) | ((g >> 3) << 6) | ((bl >> 3) << 1) | (a >> 7);
+                    break;
+                case GX_TRANSFER_FMT_RGBA4:
+                    out = ((r >> 4) << 12) | ((g >> 4) << 8) | ((bl >> 4) << 4) | (a >> 4);
+                    break;
+                default:
+                    p[0] = a; p[1] = bl; p[2] = g; p[3] = r;
+                    continue;
+            }
+            p[0] = out & 0xFF;
+            p[1] = out >> 8;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef DRIVER_SW_H
+#define DRIVER_SW_H
+
+#include "gfx_device_internal.h"
+
+#ifdef CTRGL_HOST
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define SW_TILE_SIZE 32 // pixels per side of a bin
+#define SW_MAX_PENDING 0x10000 // triangles binned before the tiles are rasterized anyway
+
+enum sw_texenv {
+    SW_TEXENV_REPLACE = 0, // primary color only
+    SW_TEXENV_MODULATE,    // texture * primary color
+    SW_TEXENV_ALPHA        // primary color, alpha modulated by the texture
+};
+
+/* fragment state a draw was recorded with, the tiles run after the GL state moved on */
+struct sw_fragment_state {
+    const u8 *texture = NULL; // RGBA8 texels, row 0 is t = 0
+    int texWidth = 0;
+    int texHeight = 0;
+    u8 texEnv = SW_TEXENV_REPLACE;
+    u8 minFilter = GPU_LINEAR;
+    u8 magFilter = GPU_LINEAR;
+    u8 wrapS = GPU_REPEAT;
+    u8 wrapT = GPU_REPEAT;
+
+    bool alphaTest = false;
+    GLenum alphaFunc = GL_ALWAYS;
+    u8 alphaRef = 0;
+
+    bool stencilTest = false;
+    GLenum stencilFunc = GL_ALWAYS;
+    u8 stencilRef = 0;
+    u8 stencilFuncMask = 0xFF;
+    u8 stencilMask = 0xFF;
+    GLenum stencilOpSFail = GL_KEEP;
+    GLenum stencilOpZFail = GL_KEEP;
+    GLenum stencilOpZPass = GL_KEEP;
+
+    bool depthTest = false;
+    GLenum depthFunc = GL_LESS;
+    bool depthMask = true;
+
+    bool blend = false;
+    GLenum blendSrc = GL_ONE;
+    GLenum blendDst = GL_ZERO;
+    u8 blendColor[4] = {0, 0, 0, 0};
+
+    u32 colorMask = 0xFFFFFFFF; // bits of an RGBA8 pixel that are written
+
+    GPU_SCISSORMODE scissorMode = GPU_SCISSOR_DISABLE;
+    int scissor[4] = {0, 0, 0, 0}; // x0, y0, x1, y1 in buffer rows, exclusive
+};
+
+/* post transform vertex, everything the rasterizer interpolates */
+struct sw_vertex {
+    vec4 position; // clip space
+    vec4 color;
+    float s, t;
+};
+
+/* triangle in 28.4 fixed point buffer coordinates, y pointing down */
+struct sw_triangle {
+    s64 a[3], b[3], c[3]; // edge functions, the pixel is inside when all are >= 0
+    float invArea;
+    float z[3];
+    float invW[3];
+    float color[3][4]; // divided by w
+    float st[3][2]; // divided by w
+    int minX, minY, maxX, maxY; // inclusive pixel bounds
+    u32 state;
+    bool minify;
+};
+
+struct gfx_device_sw : public gfx_device {
+    u32 *colorBuffer; // RGBA8 like the PICA200 writes it, row 0 is the top of the window
+    u32 *depthBuffer; // 24 bit depth with stencil in the top byte
+    int tilesX, tilesY;
+
+    std::vector<sw_fragment_state> states;
+    std::vector<sw_triangle> triangles;
+    std::vector<std::vector<u32> > bins; // triangle indices per tile, in submission order
+    std::vector<sw_vertex> transformed;
+    std::vector<sw_vertex> clipped;
+
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::atomic<int> nextTile;
+    u32 generation; // bumped for every rasterize pass the workers join
+    u32 running; // workers still busy with the current pass
+    bool quit;
+
+    u32 passes;
+    u32 stalls;
+    u64 stallTicks;
+
+    gfx_device_sw(gfx_state *state, int w, int h);
+    ~gfx_device_sw();
+    void bind();
+    void submit();
+    void finish();
+    void release(void *data, bool vram = false);
+    void resize(int w, int h);
+    void get_stats(gfx_device_stats *stats);
+    void clear(GLbitfield mask);
+    void flush(u8* fb, int w, int h, int f);
+    void render_vertices(const mat4& projection, const mat4& modelview);
+    void render_vertices_vbo(const mat4& projection, const mat4& modelview, u8 *data, GLuint units, u8 format, const gfx_vertex_attributes& constant);
+    void render_vertices_array(GLenum mode, GLint first, GLsizei count, const mat4& projection, const mat4& modelview);
+    void render_elements_array(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLuint start, GLuint end, const mat4& projection, const mat4& modelview);
+    void buffer_data(gfx_buffer& buf, GLsizeiptr size, const GLvoid *data);
+    void buffer_sub_data(gfx_buffer& buf, GLintptr offset, GLsizeiptr size, const GLvoid *data);
+    void free_buffer(gfx_buffer& buf);
+    void lock_arrays(u32 first, u32 count);
+    void unlock_arrays();
+    void free_vertex_array(gfx_vertex_array& vao);
+    void repack_texture(gfx_texture& tex);
+    void wait_texture(gfx_texture& tex);
+    void free_texture(gfx_texture& tex);
+    u8 *cache_vertex_list(GLuint *size);
+    bool stream_grow(u32 n);
+
+    void allocate_buffers();
+    u32 capture_state();
+    void draw(GLenum mode, const u8 *vertices, u8 format, const gfx_vertex_attributes& constant, u32 count,
+              const mat4& projection, const mat4& modelview);
+    void shade(const u8 *in, u8 format, const gfx_vertex_attributes& constant, sw_vertex& out, const mat4& mvp, const mat4& modelview);
+    void clip_triangle(const sw_vertex& v0, const sw_vertex& v1, const sw_vertex& v2, u32 state);
+    void setup_triangle(const sw_vertex& v0, const sw_vertex& v1, const sw_vertex& v2, u32 state);
+    void rasterize();
+    void rasterize_tile(int tile);
+    void worker();
+};
+
+#endif
+
+#endif
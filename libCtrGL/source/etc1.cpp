@@ -0,0 +1,227 @@
+#include "etc1.h"
+#include <climits>
+
+// intensity modifiers of the 8 tables, in pixel index order
+static const int modifiers[8][4] = {
+    {2, 8, -2, -8},
+    {5, 17, -5, -17},
+    {9, 29, -9, -29},
+    {13, 42, -13, -42},
+    {18, 60, -18, -60},
+    {24, 80, -24, -80},
+    {33, 106, -33, -106},
+    {47, 183, -47, -183},
+};
+
+static u64 load_block(const u8 *block) {
+    u64 v = 0;
+    for (int i = 0; i < ETC1_BLOCK_SIZE; ++i) v = (v << 8) | block[i];
+    return v;
+}
+
+static void store_block(u64 v, u8 *block) {
+    for (int i = 0; i < ETC1_BLOCK_SIZE; ++i) block[ETC1_BLOCK_SIZE - 1 - i] = v >> (8 * i);
+}
+
+static int clamp_u8(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static int expand5(int v) {
+    return (v << 3) | (v >> 2);
+}
+
+/* bit of the pixel index LSBs, the MSBs are 16 bits above, pixels are numbered down the columns */
+static int pixel_bit(int x, int y) {
+    return x * 4 + y;
+}
+
+static int subblock(u64 v, int x, int y) {
+    return (v & (1ull << 32)) ? y >= 2 : x >= 2;
+}
+
+/* the base colors of both subblocks */
+static void block_colors(u64 v, int colors[2][3]) {
+    for (int c = 0; c < 3; ++c) {
+        if (v & (1ull << 33)) {
+            // 5 bit color and a 3 bit signed offset to the second one
+            int base = (v >> (59 - 8 * c)) & 0x1F;
+            int delta = (v >> (56 - 8 * c)) & 0x7;
+            if (delta >= 4) delta -= 8;
+            colors[0][c] = expand5(base);
+            colors[1][c] = expand5((base + delta) & 0x1F);
+        } else {
+            colors[0][c] = ((v >> (60 - 8 * c)) & 0xF) * 0x11;
+            colors[1][c] = ((v >> (56 - 8 * c)) & 0xF) * 0x11;
+        }
+    }
+}
+
+void etc1_decode_block(const u8 *block, u8 *rgba) {
+    u64 v = load_block(block);
+    int colors[2][3];
+    block_colors(v, colors);
+    int tables[2] = {(int)((v >> 37) & 7), (int)((v >> 34) & 7)};
+
+    for (int y = 0; y < 4; ++y) {
+        for (int x = 0; x < 4; ++x) {
+            int s = subblock(v, x, y);
+            int bit = pixel_bit(x, y);
+            int index = (((v >> (16 + bit)) & 1) << 1) | ((v >> bit) & 1);
+            int m = modifiers[tables[s]][index];
+            u8 *p = rgba + (y * 4 + x) * 4;
+            for (int c = 0; c < 3; ++c) p[c] = clamp_u8(colors[s][c] + m);
+            p[3] = 0xFF;
+        }
+    }
+}
+
+/* picks the table that fits the pixels of subblock s best around base, returns the error and ors the table and the
+   pixel indices into v */
+static int encode_subblock(const u8 *rgba, u64& v, int s, const int base[3]) {
+    int best = INT_MAX;
+    u64 bestBits = 0;
+    int bestTable = 0;
+    for (int t = 0; t < 8; ++t) {
+        int error = 0;
+        u64 bits = 0;
+        for (int y = 0; y < 4; ++y) {
+            for (int x = 0; x < 4; ++x) {
+                if (subblock(v, x, y) != s) continue;
+                const u8 *p = rgba + (y * 4 + x) * 4;
+                int pixelError = INT_MAX, index = 0;
+                for (int i = 0; i < 4; ++i) {
+                    int e = 0;
+                    for (int c = 0; c < 3; ++c) {
+                        int d = clamp_u8(base[c] + modifiers[t][i]) - p[c];
+                        e += d * d;
+                    }
+                    if (e < pixelError) {
+                        pixelError = e;
+                        index = i;
+                    }
+                }
+                error += pixelError;
+                int bit = pixel_bit(x, y);
+                bits |= ((u64)(index >> 1) << (16 + bit)) | ((u64)(index & 1) << bit);
+            }
+        }
+        if (error < best) {
+            best = error;
+            bestBits = bits;
+            bestTable = t;
+        }
+    }
+    v |= bestBits | ((u64)bestTable << (s ? 34 : 37));
+    return best;
+}
+
+/* both subblock orientations around the average colors, differential when they are close enough */
+void etc1_encode_block(const u8 *rgba, u8 *block) {
+    u64 best = 0;
+    int bestError = INT_MAX;
+    for (int flip = 0; flip < 2; ++flip) {
+        u64 v = (u64)flip << 32;
+        int sums[2][3] = {{0, 0, 0}, {0, 0, 0}};
+        for (int y = 0; y < 4; ++y) {
+            for (int x = 0; x < 4; ++x) {
+                int s = subblock(v, x, y);
+                for (int c = 0; c < 3; ++c) sums[s][c] += rgba[(y * 4 + x) * 4 + c];
+            }
+        }
+
+        // averages of 8 pixels rounded to 5 and 4 bits
+        int q5[2][3], q4[2][3];
+        bool differential = true;
+        for (int c = 0; c < 3; ++c) {
+            for (int s = 0; s < 2; ++s) {
+                q5[s][c] = (sums[s][c] * 31 + 1020) / 2040;
+                q4[s][c] = (sums[s][c] * 15 + 1020) / 2040;
+            }
+            // a flipped block with an offset of -4 has no exact etc1_flip_block
+            int delta = q5[1][c] - q5[0][c];
+            if (delta < (flip ? -3 : -4) || delta > 3) differential = false;
+        }
+
+        int base[2][3];
+        if (differential) v |= 1ull << 33;
+        for (int c = 0; c < 3; ++c) {
+            if (differential) {
+                v |= ((u64)q5[0][c] << (59 - 8 * c)) | ((u64)((q5[1][c] - q5[0][c]) & 7) << (56 - 8 * c));
+                base[0][c] = expand5(q5[0][c]);
+                base[1][c] = expand5(q5[1][c]);
+            } else {
+                v |= ((u64)q4[0][c] << (60 - 8 * c)) | ((u64)q4[1][c] << (56 - 8 * c));
+                base[0][c] = q4[0][c] * 0x11;
+                base[1][c] = q4[1][c] * 0x11;
+            }
+        }
+
+        int error = encode_subblock(rgba, v, 0, base[0]) + encode_subblock(rgba, v, 1, base[1]);
+        if (error < bestError) {
+            bestError = error;
+            best = v;
+        }
+    }
+    store_block(best, block);
+}
+
+void etc1_flip_block(const u8 *block, u8 *flipped) {
+    u64 v = load_block(block);
+    u64 out = v & 0xFFFFFFFF00000000ull;
+    for (int x = 0; x < 4; ++x) {
+        for (int y = 0; y < 4; ++y) {
+            int from = pixel_bit(x, y), to = pixel_bit(x, 3 - y);
+            out |= (((v >> (16 + from)) & 1) << (16 + to)) | (((v >> from) & 1) << to);
+        }
+    }
+
+    if (v & (1ull << 32)) {
+        // the subblocks are the top and bottom halves, so they trade colors and tables
+        out &= ~(0x3Full << 34);
+        out |= (((v >> 34) & 7) << 37) | (((v >> 37) & 7) << 34);
+        for (int c = 0; c < 3; ++c) {
+            out &= ~(0xFFull << (56 - 8 * c));
+            if (v & (1ull << 33)) {
+                int base = (v >> (59 - 8 * c)) & 0x1F;
+                int delta = (v >> (56 - 8 * c)) & 0x7;
+                if (delta >= 4) delta -= 8;
+                if (delta == -4) {
+                    // +4 has no encoding, the flipped pixels are compressed again instead
+                    u8 rgba[16 * 4], rows[16 * 4];
+                    etc1_decode_block(block, rgba);
+                    for (int y = 0; y < 4; ++y) {
+                        for (int i = 0; i < 16; ++i) rows[y * 16 + i] = rgba[(3 - y) * 16 + i];
+                    }
+                    etc1_encode_block(rows, flipped);
+                    return;
+                }
+                out |= ((u64)(base + delta) << (59 - 8 * c)) | ((u64)(-delta & 7) << (56 - 8 * c));
+            } else {
+                out |= (((v >> (60 - 8 * c)) & 0xF) << (56 - 8 * c)) | (((v >> (56 - 8 * c)) & 0xF) << (60 - 8 * c));
+            }
+        }
+    }
+    store_block(out, flipped);
+}
+
+u64 etc1_encode_alpha(const u8 *rgba) {
+    u64 alpha = 0;
+    for (int y = 0; y < 4; ++y) {
+        for (int x = 0; x < 4; ++x) {
+            u64 a = (rgba[(y * 4 + x) * 4 + 3] * 15 + 127) / 255;
+            alpha |= a << (4 * pixel_bit(x, y));
+        }
+    }
+    return alpha;
+}
+
+u64 etc1_flip_alpha(u64 alpha) {
+    u64 out = 0;
+    for (int x = 0; x < 4; ++x) {
+        for (int y = 0; y < 4; ++y) {
+            out |= ((alpha >> (4 * pixel_bit(x, y))) & 0xF) << (4 * pixel_bit(x, 3 - y));
+        }
+    }
+    return out;
+}
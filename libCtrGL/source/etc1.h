@@ -0,0 +1,21 @@
+#ifndef ETC1_H
+#define ETC1_H
+
+#include <3ds.h>
+
+#define ETC1_BLOCK_SIZE 8 // bytes of a 4x4 block, stored big endian as in GL_OES_compressed_ETC1_RGB8_texture
+
+/* pixel (x, y) of a block as RGBA bytes at rgba[(y * 4 + x) * 4], alpha is always 255 */
+void etc1_decode_block(const u8 *block, u8 *rgba);
+
+/* compresses 4x4 RGBA pixels laid out like etc1_decode_block writes them, alpha is ignored */
+void etc1_encode_block(const u8 *rgba, u8 *block);
+
+/* the block with its rows in reverse order */
+void etc1_flip_block(const u8 *block, u8 *flipped);
+
+/* ETC1A4 alpha words hold 4 bits per pixel, pixel (x, y) at bit 4 * (x * 4 + y) */
+u64 etc1_encode_alpha(const u8 *rgba);
+u64 etc1_flip_alpha(u64 alpha);
+
+#endif
@@ -12,9 +12,11 @@ typedef char s8;
 #include <3ds.h>
 #endif
 
+#include <gfx_device.h>
+
 struct gfx_state;
 struct gfx_texture;
-struct gfx_device_3ds;
+class gfx_device;
 
 template <class T>
 class sbuffer {
@@ -115,6 +117,199 @@ struct vertex {
     }
 };
 
+/* attributes a vertex carries after its float3 position, in this order */
+enum gfx_vertex_format_bits {
+    GFX_VERTEX_TEXCOORD = 1 << 0, // 2 floats
+    GFX_VERTEX_COLOR    = 1 << 1, // 4 unsigned bytes, 255 is 1.0
+    GFX_VERTEX_NORMAL   = 1 << 2, // 3 floats
+    GFX_VERTEX_ALL      = 0x7
+};
+
+inline u32 gfx_vertex_stride(u8 format) {
+    return 12 + ((format & GFX_VERTEX_TEXCOORD) ? 8 : 0) + ((format & GFX_VERTEX_COLOR) ? 4 : 0) + ((format & GFX_VERTEX_NORMAL) ? 12 : 0);
+}
+
+inline u8 gfx_color_byte(float c) {
+    return (u8)(c <= 0.0f ? 0.0f : (c >= 1.0f ? 255.0f : c * 255.0f + 0.5f));
+}
+
+/* per vertex attributes besides the position */
+struct gfx_vertex_attributes {
+    vec4 texCoord;
+    vec4 color;
+    vec4 normal;
+};
+
+/* writes one vertex in the layout the GPU reads, returns the end of it */
+inline u8 *gfx_pack_vertex(u8 *dst, u8 format, float x, float y, float z, const gfx_vertex_attributes& attr) {
+    float *f = (float*)dst;
+    *f++ = x;
+    *f++ = y;
+    *f++ = z;
+    if (format & GFX_VERTEX_TEXCOORD) {
+        *f++ = attr.texCoord.x;
+        *f++ = attr.texCoord.y;
+    }
+    if (format & GFX_VERTEX_COLOR) {
+        u8 *c = (u8*)f;
+        c[0] = gfx_color_byte(attr.color.x);
+        c[1] = gfx_color_byte(attr.color.y);
+        c[2] = gfx_color_byte(attr.color.z);
+        c[3] = gfx_color_byte(attr.color.w);
+        f++;
+    }
+    if (format & GFX_VERTEX_NORMAL) {
+        *f++ = attr.normal.x;
+        *f++ = attr.normal.y;
+        *f++ = attr.normal.z;
+    }
+    return (u8*)f;
+}
+
+/* reads one vertex back, attributes the format lacks are left as they are */
+inline const u8 *gfx_unpack_vertex(const u8 *src, u8 format, float pos[3], gfx_vertex_attributes& attr) {
+    const float *f = (const float*)src;
+    pos[0] = *f++;
+    pos[1] = *f++;
+    pos[2] = *f++;
+    if (format & GFX_VERTEX_TEXCOORD) {
+        attr.texCoord = vec4(f[0], f[1], 0.0f, 1.0f);
+        f += 2;
+    }
+    if (format & GFX_VERTEX_COLOR) {
+        const u8 *c = (const u8*)f;
+        attr.color = vec4(c[0] / 255.0f, c[1] / 255.0f, c[2] / 255.0f, c[3] / 255.0f);
+        f++;
+    }
+    if (format & GFX_VERTEX_NORMAL) {
+        attr.normal = vec4(f[0], f[1], f[2], 0.0f);
+        f += 3;
+    }
+    return (const u8*)f;
+}
+
+/* client arrays in attribute order, array i feeds shader input v<i> */
+enum gfx_array {
+    GFX_ARRAY_VERTEX = 0,
+    GFX_ARRAY_TEXCOORD,
+    GFX_ARRAY_COLOR,
+    GFX_ARRAY_NORMAL,
+    GFX_ARRAY_COUNT
+};
+
+/* a glVertexPointer style array, stride 0 means tightly packed */
+struct gfx_client_array {
+    GLboolean enabled = GL_FALSE;
+    GLint size = 4;
+    GLenum type = GL_FLOAT;
+    GLsizei stride = 0;
+    const GLvoid *pointer = nullptr;
+    GLuint buffer = 0; // buffer object the pointer is an offset into, 0 for client memory
+};
+
+/* buffer object storage, GPU visible so draws read it in place */
+struct gfx_buffer {
+    GLuint bname;
+    GLenum usage = GL_STATIC_DRAW;
+    GLsizeiptr size = 0;
+    u8 *data = NULL;
+    bool vram = false; // the CPU only writes data through DMA
+
+    gfx_buffer(GLuint name = 0) {
+        bname = name;
+    }
+
+    bool operator==(const gfx_buffer& b) const {
+        return b.bname == bname;
+    }
+};
+
+/* client arrays and element buffer binding of a glGenVertexArraysOES object, while it is bound they live in
+   gfx_state and this copy is stale */
+struct gfx_vertex_array {
+    GLuint aname;
+    gfx_client_array clientArrays[GFX_ARRAY_COUNT];
+    GLuint elementArrayBuffer = 0;
+    GLuint generation = 0; // bumped whenever the arrays or the binding change
+    void *cache = nullptr; // attribute setup the device derived from them, owned by the device
+
+    gfx_vertex_array(GLuint name = 0) {
+        aname = name;
+    }
+
+    bool operator==(const gfx_vertex_array& a) const {
+        return a.aname == aname;
+    }
+};
+
+/* bytes per component of a client array type */
+inline u32 gfx_array_type_size(GLenum type) {
+    switch (type) {
+        case GL_BYTE:
+        case GL_UNSIGNED_BYTE: return 1;
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT: return 2;
+        case GL_FLOAT: return 4;
+#ifndef SPEC_GLES
+        case GL_INT:
+        case GL_UNSIGNED_INT: return 4;
+        case GL_DOUBLE: return 8;
+#endif
+    }
+    return 0;
+}
+
+/* component k of an array element, normalized integers map to [0, 1] or [-1, 1] as for GL colors and normals */
+inline float gfx_array_component(const u8 *p, GLenum type, u32 k, bool normalized) {
+    switch (type) {
+        case GL_BYTE: return ((const s8*)p)[k] * (normalized ? 1.0f / 127.0f : 1.0f);
+        case GL_UNSIGNED_BYTE: return p[k] * (normalized ? 1.0f / 255.0f : 1.0f);
+        case GL_SHORT: return ((const s16*)p)[k] * (normalized ? 1.0f / 32767.0f : 1.0f);
+        case GL_UNSIGNED_SHORT: return ((const u16*)p)[k] * (normalized ? 1.0f / 65535.0f : 1.0f);
+#ifndef SPEC_GLES
+        case GL_INT: return (float)(((const s32*)p)[k] * (normalized ? 1.0 / 2147483647.0 : 1.0));
+        case GL_UNSIGNED_INT: return (float)(((const u32*)p)[k] * (normalized ? 1.0 / 4294967295.0 : 1.0));
+        case GL_DOUBLE: return (float)((const double*)p)[k];
+#endif
+    }
+    return ((const float*)p)[k];
+}
+
+inline u32 gfx_array_stride(const gfx_client_array& array) {
+    return array.stride ? array.stride : array.size * gfx_array_type_size(array.type);
+}
+
+/* bytes per glDrawElements index */
+inline u32 gfx_index_size(GLenum type) {
+    switch (type) {
+        case GL_UNSIGNED_BYTE: return 1;
+        case GL_UNSIGNED_SHORT: return 2;
+#ifndef SPEC_GLES
+        case GL_UNSIGNED_INT: return 4;
+#endif
+    }
+    return 0;
+}
+
+inline u32 gfx_index(const GLvoid *indices, GLenum type, u32 i) {
+    switch (type) {
+        case GL_UNSIGNED_BYTE: return ((const u8*)indices)[i];
+        case GL_UNSIGNED_SHORT: return ((const u16*)indices)[i];
+    }
+    return ((const u32*)indices)[i];
+}
+
+/* vertices of the glBegin/glEnd batch being recorded */
+struct gfx_vertex_stream {
+    u8 *base = NULL; // first vertex of the batch
+    u32 size = 0; // bytes of room at base
+    u32 count = 0; // vertices written since the batch started
+    u32 capacity = 0; // vertices that fit before the device has to make room
+    u8 format = GFX_VERTEX_ALL; // attributes stored per vertex
+    u8 stride = 48;
+    u8 attributes = GFX_VERTEX_ALL; // attributes the batch was started for
+    gfx_vertex_attributes constant; // values of the attributes not in format, shared by every vertex
+};
 
 struct gfx_texture {
     GLuint tname;
@@ -124,6 +319,9 @@ struct gfx_texture {
     GLsizei width;
     GLsizei height;
     GLenum format;
+    GPU_TEXCOLOR texelFormat = GPU_RGBA8; // unpackedColorBuffer holds texels the way the texture unit reads them, ETC blocks as uploaded
+    u32 colorBufferSize = 0;
+    u32 transfer = 0; // GX operation still tiling unpackedColorBuffer into colorBuffer, 0 once it is done
     GPU_TEXTURE_FILTER_PARAM min_filter = GPU_LINEAR;
     GPU_TEXTURE_FILTER_PARAM mag_filter = GPU_LINEAR;
     GPU_TEXTURE_WRAP_PARAM wrap_s = GPU_REPEAT;
@@ -147,6 +345,34 @@ struct gfx_texture {
     }
 };
 
+/* bytes per texel of the PICA formats glTexImage2D stores */
+inline u32 gfx_texel_size(GPU_TEXCOLOR format) {
+    switch (format) {
+        case GPU_RGBA8: return 4;
+        case GPU_RGB8: return 3;
+        case GPU_RGBA5551:
+        case GPU_RGB565:
+        case GPU_RGBA4:
+        case GPU_LA8:
+        case GPU_HILO8: return 2;
+        case GPU_L8:
+        case GPU_A8:
+        case GPU_LA4: return 1;
+        default: break;
+    }
+    return 0;
+}
+
+/* bytes of a whole image, the ETC formats take 8 bytes per 4x4 block and ETC1A4 another 8 for the alpha */
+inline u32 gfx_image_size(GPU_TEXCOLOR format, u32 width, u32 height) {
+    switch (format) {
+        case GPU_ETC1: return width * height / 2;
+        case GPU_ETC1A4: return width * height;
+        default: break;
+    }
+    return gfx_texel_size(format) * width * height;
+}
+
 struct gfx_vec4i {
     GLint x;
     GLint y;
@@ -190,6 +416,8 @@ struct gfx_command {
         BLEND_COLOR,
         CLEAR_DEPTH,
         DEPTH_FUNC,
+        CLEAR_STENCIL,
+        COMPRESSED_TEX_IMAGE_2D,
         NONE
     };
 
@@ -240,6 +468,7 @@ struct gfx_light {
     float constantAttenuation = 1.0; // [0.0, inf]
     float linearAttenuation = 0.0; // [0.0, inf]
     float quadraticAttenuation = 0.0; // [0.0, inf]
+    GLuint generation = 0; // bumped on every change
 };
 
 struct gfx_material {
@@ -253,9 +482,23 @@ struct gfx_material {
     float specularColorIndex = 1.0;
 };
 
+/* register groups the driver has to emit again before the next draw */
+enum gfx_dirty_bits {
+    GFX_DIRTY_FRAMEBUFFER = 1 << 0,
+    GFX_DIRTY_SCISSOR     = 1 << 1,
+    GFX_DIRTY_DEPTH       = 1 << 2, // depth test and color/depth write mask
+    GFX_DIRTY_STENCIL     = 1 << 3,
+    GFX_DIRTY_BLEND       = 1 << 4,
+    GFX_DIRTY_ALPHA_TEST  = 1 << 5,
+    GFX_DIRTY_TEXTURE     = 1 << 6, // texture unit 0 and the combiner sampling it
+    GFX_DIRTY_FIXED       = 1 << 7, // depth map, culling, early depth, unused combiners
+    GFX_DIRTY_ALL         = 0xFF
+};
+
 struct gfx_state {
-    gfx_device_3ds* device;
+    gfx_device* device;
     int flags;
+    GLbitfield dirty = GFX_DIRTY_ALL;
 
     vec4 clearColor;
 
@@ -268,6 +511,12 @@ struct gfx_state {
     s8 currentProjectionMatrix = 0;
     s8 currentTextureMatrix = 0;
 
+    // bumped whenever the top of the stack changes
+    GLuint modelviewGeneration = 0;
+    GLuint projectionGeneration = 0;
+    GLuint textureGeneration = 0;
+    GLuint viewportGeneration = 0;
+
     GLenum matrixMode = GL_MODELVIEW;
 
 #ifndef DISABLE_ERRORS
@@ -276,7 +525,6 @@ struct gfx_state {
 
     GLboolean withinBeginEndBlock = GL_FALSE;
 
-    sbuffer<vertex> vertexBuffer;
     vec4 currentVertexColor = vec4(1, 1, 1, 1);
     vec4 currentTextureCoord = vec4(0, 0, 0, 1);
     vec4 currentVertexNormal = vec4(0, 0, 1, 0);
@@ -296,6 +544,7 @@ struct gfx_state {
     GLclampf alphaTestRef = 0.0;
 
     GLfloat clearDepth = 1.0f;
+    GLint clearStencil = 0;
     GLenum depthFunc = GL_LESS;
 
     GLboolean colorMaskRed = GL_TRUE;
@@ -331,6 +580,57 @@ struct gfx_state {
     GLboolean lightModelTwoSided = GL_FALSE; //TODO implement two-sided lighting
     gfx_material material;
 
+
+    gfx_client_array clientArrays[GFX_ARRAY_COUNT];
+
+    sbuffer<gfx_buffer> buffers;
+    GLuint arrayBuffer = 0;
+    GLuint elementArrayBuffer = 0;
+
+    GLint lockFirst = 0;
+    GLsizei lockCount = 0; // 0 while glLockArraysEXT holds no range
+
+    sbuffer<gfx_vertex_array> vertexArrays;
+    gfx_vertex_array defaultVertexArray; // object 0 while another one is bound
+    GLuint vertexArray = 0; // bound vertex array object
+    GLuint arraysGeneration = 0; // of the bound object, bumped whenever its arrays change
+    void *arraysCache = nullptr; // of the bound object
+    GLuint bufferGeneration = 0; // bumped whenever a buffer object gets new storage
+
+    gfx_vertex_array *getVertexArray(GLuint name) const {
+        for (unsigned int i = 0; i < vertexArrays.size(); i++) {
+            if (vertexArrays[i].aname == name) {
+                return &vertexArrays[i];
+            }
+        }
+        return nullptr;
+    }
+
+    gfx_buffer *getBuffer(GLuint name) const {
+        for (unsigned int i = 0; i < buffers.size(); i++) {
+            if (buffers[i].bname == name) {
+                return &buffers[i];
+            }
+        }
+        return nullptr;
+    }
+
+    /* first element of a client array, NULL if the buffer it was specified in has no storage */
+    const u8 *arrayData(const gfx_client_array& array) const {
+        if (!array.buffer) return (const u8*)array.pointer;
+        gfx_buffer *buf = getBuffer(array.buffer);
+        return buf && buf->data ? buf->data + (uintptr_t)array.pointer : NULL;
+    }
+
+    gfx_vertex_attributes currentAttributes() const {
+        gfx_vertex_attributes attr;
+        attr.texCoord = currentTextureCoord;
+        attr.color = currentVertexColor;
+        attr.normal = currentVertexNormal;
+        return attr;
+    }
+
+    // last, so GLES builds without lists share the layout libcaelina allocates
 #ifndef DISABLE_LISTS
     sbuffer<gfx_display_list> displayLists;
     GLuint nextDisplayListName = 1;
@@ -340,18 +640,24 @@ struct gfx_state {
     GLuint displayListCallDepth = 0;
     u8 *endVBOData;
     GLsizei endVBOUnits;
+    u8 endVBOFormat;
+    const gfx_vertex_attributes *endVBOConstant;
 #endif
+};
 
-    GLint vertexPtrSize = 0;
-    GLenum vertexPtrType = GL_FLOAT;
-    GLsizei vertexPtrStride = 0;
-    const GLvoid *vertexPtr = nullptr;
+/* PICA200 extension state */
+struct gfx_device_3ds_ext {
+
+    GPU_SCISSORMODE scissorMode = GPU_SCISSOR_NORMAL;
 };
 
+/* a rendering backend, the GL layer records and draws only through these */
 class gfx_device {
 public:
     int width, height;
     gfx_state* g_state = NULL;
+    gfx_device_3ds_ext ext_state;
+    gfx_vertex_stream stream;
     
     gfx_device(gfx_state *state, int w, int h) {
         g_state = state;
@@ -366,6 +672,8 @@ public:
         }
     }
 
+    virtual ~gfx_device() {}
+
     int getWidth() {
         return width;
     }
@@ -373,9 +681,74 @@ public:
     int getHeight() {
         return height;
     }
+
+    /* starts a batch that reads the given attributes, until one of them varies it is stored once */
+    void stream_begin(u8 attributes) {
+        stream.attributes = attributes;
+        stream.format = 0;
+        stream.stride = gfx_vertex_stride(0);
+        stream.count = 0;
+        stream.capacity = stream.size / stream.stride;
+    }
+
+    /* stores the given attributes per vertex from now on, the vertices so far get the constant values */
+    void stream_widen(u8 format) {
+        u32 stride = gfx_vertex_stride(format);
+        for (;;) {
+            u32 extra = (stream.count * (stride - stream.stride) + stream.stride - 1) / stream.stride;
+            if (stream.count + extra <= stream.capacity) break;
+            // the device may draw the batch so far early to make room or drop it, which leaves fewer vertices to widen
+            stream_grow(extra);
+        }
+        u32 count = stream.count;
+
+        // back to front, a vertex only ever moves up over the ones already expanded
+        for (u32 i = count; i-- > 0;) {
+            float pos[3];
+            gfx_vertex_attributes attr = stream.constant;
+            gfx_unpack_vertex(stream.base + i * stream.stride, stream.format, pos, attr);
+            gfx_pack_vertex(stream.base + i * stride, format, pos[0], pos[1], pos[2], attr);
+        }
+        stream.format = format;
+        stream.stride = stride;
+        stream.capacity = stream.size / stride;
+    }
+
+    /* room for n more vertices of the current batch, NULL if the device dropped the batch for lack of it */
+    u8 *stream_vertices(u32 n) {
+        if (stream.count + n > stream.capacity && !stream_grow(n)) return NULL;
+        u8 *v = stream.base + stream.count * stream.stride;
+        stream.count += n;
+        return v;
+    }
+
+    virtual void bind() = 0;
+    virtual void submit() = 0;
+    virtual void finish() = 0;
+    virtual void release(void *data, bool vram = false) = 0;
+    virtual void resize(int w, int h) = 0;
+    virtual void get_stats(gfx_device_stats *stats) = 0;
+    virtual void clear(GLbitfield mask) = 0;
+    virtual void flush(u8* fb, int w, int h, int f) = 0;
+    virtual void render_vertices(const mat4& projection, const mat4& modelview) = 0;
+    virtual void render_vertices_vbo(const mat4& projection, const mat4& modelview, u8 *data, GLuint units, u8 format, const gfx_vertex_attributes& constant) = 0;
+    virtual void render_vertices_array(GLenum mode, GLint first, GLsizei count, const mat4& projection, const mat4& modelview) = 0;
+    virtual void render_elements_array(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLuint start, GLuint end, const mat4& projection, const mat4& modelview) = 0;
+    virtual void buffer_data(gfx_buffer& buf, GLsizeiptr size, const GLvoid *data) = 0;
+    virtual void buffer_sub_data(gfx_buffer& buf, GLintptr offset, GLsizeiptr size, const GLvoid *data) = 0;
+    virtual void free_buffer(gfx_buffer& buf) = 0;
+    virtual void lock_arrays(u32 first, u32 count) = 0;
+    virtual void unlock_arrays() = 0;
+    virtual void free_vertex_array(gfx_vertex_array& vao) = 0;
+    virtual void repack_texture(gfx_texture& tex) = 0;
+    virtual void wait_texture(gfx_texture& tex) = 0; // before unpackedColorBuffer is written or freed
+    virtual void free_texture(gfx_texture& tex) = 0;
+    virtual u8 *cache_vertex_list(GLuint *size) = 0;
+    virtual bool stream_grow(u32 n) = 0; // false if the batch had to be dropped instead
 };
 
 #include "driver_3ds.h"
+#include "driver_sw.h"
 
 
 inline float min(float a, float b) {
@@ -51,6 +51,30 @@ void glGetIntegerv (GLenum pname, GLint *params) {
         case (GL_MAX_PROJECTION_STACK_DEPTH): {
             params[0] = IMPL_MAX_PROJECTION_STACK_DEPTH;
         } break;
+        case (GL_ARRAY_BUFFER_BINDING): {
+            params[0] = g_state->arrayBuffer;
+        } break;
+        case (GL_ELEMENT_ARRAY_BUFFER_BINDING): {
+            params[0] = g_state->elementArrayBuffer;
+        } break;
+        case (GL_VERTEX_ARRAY_BINDING_OES): {
+            params[0] = g_state->vertexArray;
+        } break;
+        case (GL_NUM_COMPRESSED_TEXTURE_FORMATS): {
+            params[0] = 2;
+        } break;
+        case (GL_COMPRESSED_TEXTURE_FORMATS): {
+            params[0] = GL_ETC1_RGB8_OES;
+            params[1] = GL_ETC1_ALPHA4_RGB8_DMP;
+        } break;
+#ifndef SPEC_GLES
+        case (GL_ARRAY_ELEMENT_LOCK_FIRST_EXT): {
+            params[0] = g_state->lockFirst;
+        } break;
+        case (GL_ARRAY_ELEMENT_LOCK_COUNT_EXT): {
+            params[0] = g_state->lockCount;
+        } break;
+#endif
     }
 }
 
@@ -141,6 +165,7 @@ void glDepthFunc( GLenum func ) {
 #endif
 
   g_state->depthFunc = func;
+  g_state->dirty |= GFX_DIRTY_DEPTH;
 }
 
 void glClear (GLbitfield mask) {
@@ -164,18 +189,21 @@ void glClear (GLbitfield mask) {
     }
 #endif
 
-    if(mask & GL_COLOR_BUFFER_BIT) {
-        g_state->device->clear(g_state->clearColor.x,
-                               g_state->clearColor.y,
-                               g_state->clearColor.z,
-                               g_state->clearColor.w);
-    }
-    if(mask & GL_DEPTH_BUFFER_BIT) {
-        g_state->device->clearDepth(g_state->clearDepth);
-    }
-    if(mask & GL_STENCIL_BUFFER_BIT) {
-        //TODO implement stencil operations
-    }
+    g_state->device->clear(mask);
+}
+
+void glFlush (void) {
+    CHECK_NULL(g_state);
+    CHECK_WITHIN_BEGIN_END(g_state);
+
+    g_state->device->submit();
+}
+
+void glFinish (void) {
+    CHECK_NULL(g_state);
+    CHECK_WITHIN_BEGIN_END(g_state);
+
+    g_state->device->finish();
 }
 
 
@@ -209,6 +237,7 @@ void glViewport( GLint x, GLint y, GLsizei width, GLsizei height ) {
     float vw = (float)width;
     float vh = (float)height;
     g_state->viewportMatrix = mat4::viewport(((float)x / w), (float)y / h,  vw / (float)w, vh / (float)h);
+    ++g_state->viewportGeneration;
 }
 
 
@@ -231,18 +260,22 @@ void glEnable( GLenum cap ) {
     switch(cap) {
         case (GL_TEXTURE_2D): {
             g_state->enableTexture2D = GL_TRUE;
+            g_state->dirty |= GFX_DIRTY_TEXTURE;
         } break;
 
         case (GL_DEPTH_TEST): {
             g_state->enableDepthTest = GL_TRUE;
+            g_state->dirty |= GFX_DIRTY_DEPTH;
         } break;
 
         case (GL_BLEND): {
             g_state->enableBlend = GL_TRUE;
+            g_state->dirty |= GFX_DIRTY_BLEND;
         } break;
 
         case (GL_SCISSOR_TEST): {
             g_state->enableScissorTest = GL_TRUE;
+            g_state->dirty |= GFX_DIRTY_SCISSOR;
         } break;
             
         case (GL_LIGHTING): {
@@ -262,10 +295,12 @@ void glEnable( GLenum cap ) {
 
         case (GL_ALPHA_TEST): {
             g_state->enableAlphaTest = GL_TRUE;
+            g_state->dirty |= GFX_DIRTY_ALPHA_TEST;
         } break;
 
         case (GL_STENCIL_TEST): {
             g_state->enableStencilTest = GL_TRUE;
+            g_state->dirty |= GFX_DIRTY_STENCIL;
         } break;
 
 #ifndef DISABLE_ERRORS
@@ -296,18 +331,22 @@ void glDisable( GLenum cap ) {
     switch(cap) {
         case (GL_TEXTURE_2D): {
             g_state->enableTexture2D = GL_FALSE;
+            g_state->dirty |= GFX_DIRTY_TEXTURE;
         } break;
             
         case (GL_DEPTH_TEST): {
             g_state->enableDepthTest = GL_FALSE;
+            g_state->dirty |= GFX_DIRTY_DEPTH;
         } break;
             
         case (GL_BLEND): {
             g_state->enableBlend = GL_FALSE;
+            g_state->dirty |= GFX_DIRTY_BLEND;
         } break;
             
         case (GL_SCISSOR_TEST): {
             g_state->enableScissorTest = GL_FALSE;
+            g_state->dirty |= GFX_DIRTY_SCISSOR;
         } break;
             
         case (GL_LIGHTING): {
@@ -327,10 +366,12 @@ void glDisable( GLenum cap ) {
 
         case (GL_ALPHA_TEST): {
             g_state->enableAlphaTest = GL_FALSE;
+            g_state->dirty |= GFX_DIRTY_ALPHA_TEST;
         } break;
 
         case (GL_STENCIL_TEST): {
             g_state->enableStencilTest = GL_FALSE;
+            g_state->dirty |= GFX_DIRTY_STENCIL;
         } break;
 #ifndef DISABLE_ERRORS
         default: {
@@ -358,14 +399,45 @@ void glDepthMask( GLboolean flag ) {
     CHECK_WITHIN_BEGIN_END(g_state);
 
     g_state->depthMask = flag != 0;
+    g_state->dirty |= GFX_DIRTY_DEPTH;
+}
+
+static gfx_client_array *getClientArray(GLenum array) {
+  switch (array) {
+    case GL_VERTEX_ARRAY: return &g_state->clientArrays[GFX_ARRAY_VERTEX];
+    case GL_TEXTURE_COORD_ARRAY: return &g_state->clientArrays[GFX_ARRAY_TEXCOORD];
+    case GL_COLOR_ARRAY: return &g_state->clientArrays[GFX_ARRAY_COLOR];
+    case GL_NORMAL_ARRAY: return &g_state->clientArrays[GFX_ARRAY_NORMAL];
+  }
+  return NULL;
 }
 
 void glEnableClientState (GLenum array) {
-  // TODO
+  CHECK_NULL(g_state);
+
+  gfx_client_array *a = getClientArray(array);
+  if (!a) {
+#ifndef DISABLE_ERRORS
+    setError(GL_INVALID_ENUM);
+#endif
+    return;
+  }
+  a->enabled = GL_TRUE;
+  ++g_state->arraysGeneration;
 }
 
 void glDisableClientState (GLenum array) {
-  // TODO
+  CHECK_NULL(g_state);
+
+  gfx_client_array *a = getClientArray(array);
+  if (!a) {
+#ifndef DISABLE_ERRORS
+    setError(GL_INVALID_ENUM);
+#endif
+    return;
+  }
+  a->enabled = GL_FALSE;
+  ++g_state->arraysGeneration;
 }
 
 }
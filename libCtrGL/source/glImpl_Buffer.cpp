@@ -0,0 +1,187 @@
+#include "glImpl.h"
+#include <cstdlib>
+
+extern gfx_state *g_state;
+
+/* name bound to a buffer target, NULL for targets that don't exist */
+static GLuint *getBufferBinding(GLenum target) {
+    switch (target) {
+        case GL_ARRAY_BUFFER: return &g_state->arrayBuffer;
+        case GL_ELEMENT_ARRAY_BUFFER: return &g_state->elementArrayBuffer;
+    }
+    return NULL;
+}
+
+/* buffer bound to a target, with the error GL raises when there is none */
+static gfx_buffer *getBoundBuffer(GLenum target) {
+    GLuint *binding = getBufferBinding(target);
+    if (!binding) {
+#ifndef DISABLE_ERRORS
+        setError(GL_INVALID_ENUM);
+#endif
+        return NULL;
+    }
+
+    gfx_buffer *buf = *binding ? g_state->getBuffer(*binding) : NULL;
+#ifndef DISABLE_ERRORS
+    if (!buf) setError(GL_INVALID_OPERATION);
+#endif
+    return buf;
+}
+
+extern "C"
+{
+
+GLboolean glIsBuffer( GLuint buffer ) {
+    CHECK_NULL(g_state, GL_FALSE);
+
+    return buffer != 0 && g_state->getBuffer(buffer) ? GL_TRUE : GL_FALSE;
+}
+
+void glGenBuffers( GLsizei n, GLuint *buffers ) {
+    CHECK_NULL(g_state);
+
+#ifndef DISABLE_ERRORS
+    if (n < 0) {
+        setError(GL_INVALID_VALUE);
+        return;
+    }
+#endif
+
+    for (GLsizei i = 0; i < n; ++i) {
+        GLuint bname = rand() + 1;
+        while (g_state->buffers.contains(gfx_buffer(bname))) {
+            bname = rand() + 1;
+        }
+        buffers[i] = bname;
+
+        g_state->buffers.push(gfx_buffer(bname));
+    }
+}
+
+void glDeleteBuffers( GLsizei n, const GLuint *buffers ) {
+    CHECK_NULL(g_state);
+
+#ifndef DISABLE_ERRORS
+    if (n < 0) {
+        setError(GL_INVALID_VALUE);
+        return;
+    }
+#endif
+
+    for (GLsizei i = 0; i < n; ++i) {
+        gfx_buffer *buf = buffers[i] ? g_state->getBuffer(buffers[i]) : NULL;
+        if (!buf) continue;
+
+        g_state->device->free_buffer(*buf);
+        g_state->buffers.erase(buf);
+        ++g_state->bufferGeneration;
+
+        // arrays still pointing into it draw nothing until they are specified again
+        if (g_state->arrayBuffer == buffers[i]) g_state->arrayBuffer = 0;
+        if (g_state->elementArrayBuffer == buffers[i]) {
+            g_state->elementArrayBuffer = 0;
+            ++g_state->arraysGeneration;
+        }
+    }
+}
+
+void glBindBuffer( GLenum target, GLuint buffer ) {
+    CHECK_NULL(g_state);
+
+    GLuint *binding = getBufferBinding(target);
+    if (!binding) {
+#ifndef DISABLE_ERRORS
+        setError(GL_INVALID_ENUM);
+#endif
+        return;
+    }
+
+    if (buffer && !g_state->getBuffer(buffer)) {
+        g_state->buffers.push(gfx_buffer(buffer));
+    }
+    *binding = buffer;
+    if (target == GL_ELEMENT_ARRAY_BUFFER) ++g_state->arraysGeneration;
+}
+
+void glBufferData( GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage ) {
+    CHECK_NULL(g_state);
+
+#ifndef DISABLE_ERRORS
+    switch (usage) {
+        case GL_STATIC_DRAW:
+        case GL_DYNAMIC_DRAW:
+#ifndef SPEC_GLES
+        case GL_STREAM_DRAW:
+        case GL_STREAM_READ:
+        case GL_STREAM_COPY:
+        case GL_STATIC_READ:
+        case GL_STATIC_COPY:
+        case GL_DYNAMIC_READ:
+        case GL_DYNAMIC_COPY:
+#endif
+        {
+
+        } break;
+
+        default:
+            setError(GL_INVALID_ENUM);
+            return;
+    }
+#endif
+
+    // the device would allocate and copy a negative size
+    if (size < 0) {
+#ifndef DISABLE_ERRORS
+        setError(GL_INVALID_VALUE);
+#endif
+        return;
+    }
+
+    gfx_buffer *buf = getBoundBuffer(target);
+    if (!buf) return;
+
+    buf->usage = usage;
+    g_state->device->buffer_data(*buf, size, data);
+    ++g_state->bufferGeneration;
+}
+
+void glBufferSubData( GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data ) {
+    CHECK_NULL(g_state);
+
+    gfx_buffer *buf = getBoundBuffer(target);
+    if (!buf) return;
+
+    // the device copies into the storage without checking
+    if (offset < 0 || size < 0 || offset + size > buf->size) {
+#ifndef DISABLE_ERRORS
+        setError(GL_INVALID_VALUE);
+#endif
+        return;
+    }
+
+    if (size && data) g_state->device->buffer_sub_data(*buf, offset, size, data);
+}
+
+void glGetBufferParameteriv( GLenum target, GLenum pname, GLint *params ) {
+    CHECK_NULL(g_state);
+
+    gfx_buffer *buf = getBoundBuffer(target);
+    if (!buf) return;
+
+    switch (pname) {
+        case GL_BUFFER_SIZE: {
+            params[0] = buf->size;
+        } break;
+        case GL_BUFFER_USAGE: {
+            params[0] = buf->usage;
+        } break;
+        default: {
+#ifndef DISABLE_ERRORS
+            setError(GL_INVALID_ENUM);
+#endif
+        } break;
+    }
+}
+
+} // extern "C"
@@ -83,6 +83,7 @@ void glBlendFunc( GLenum sfactor, GLenum dfactor ) {
 
     g_state->blendSrcFactor = sfactor;
     g_state->blendDstFactor = dfactor;
+    g_state->dirty |= GFX_DIRTY_BLEND;
 }
 
 
@@ -111,6 +112,7 @@ void glScissor( GLint x, GLint y, GLsizei width, GLsizei height) {
 #endif
     
     g_state->scissorBox = {x, y, width, height};
+    g_state->dirty |= GFX_DIRTY_SCISSOR;
 }
 
 void glBlendColor( GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha ) {
@@ -138,6 +140,7 @@ void glBlendColor( GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha )
     Value |= ((GLuint)(clampf(blue, 0.0f, 1.0f) * 255.0f) & 0xFF) << 16;
     Value |= ((GLuint)(clampf(alpha, 0.0f, 1.0f) * 255.0f) & 0xFF) << 24;
     g_state->blendColor = Value;
+    g_state->dirty |= GFX_DIRTY_BLEND;
 }
 
 void glAlphaFunc( GLenum func, GLclampf ref ) {
@@ -179,6 +182,7 @@ void glAlphaFunc( GLenum func, GLclampf ref ) {
 
     g_state->alphaTestFunc = func;
     g_state->alphaTestRef = clampf(ref, 0.0, 1.0);
+    g_state->dirty |= GFX_DIRTY_ALPHA_TEST;
 }
 
 void glColorMask( GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha ) {
@@ -202,6 +206,7 @@ void glColorMask( GLboolean red, GLboolean green, GLboolean blue, GLboolean alph
     g_state->colorMaskGreen = green != 0;
     g_state->colorMaskBlue = blue != 0;
     g_state->colorMaskAlpha = alpha != 0;
+    g_state->dirty |= GFX_DIRTY_DEPTH;
 }
 
     
@@ -106,6 +106,7 @@ void glLightf( GLenum light, GLenum pname, GLfloat param ) {
 #endif
     }
 
+    ++g_state->lights[light_index].generation;
 }
 
 #ifndef DISABLE_LISTS
@@ -245,14 +246,16 @@ void glLightfv( GLenum light, GLenum pname, const GLfloat *params ) {
             upper3x3[0 + 3] = 0.0;
             upper3x3[4 + 3] = 0.0;
             upper3x3[8 + 3] = 0.0;
-            g_state->lights[0].spotlightDirection = upper3x3 * vec4(params[0], params[1], params[2], 0.0);
-        }
+            g_state->lights[light_index].spotlightDirection = upper3x3 * vec4(params[0], params[1], params[2], 0.0);
+        } break;
 #ifndef DISABLE_ERRORS
         default: {
             setError(GL_INVALID_ENUM);
         } return;
 #endif
     }
+
+    ++g_state->lights[light_index].generation;
 }
 
 }
\ No newline at end of file
@@ -38,6 +38,9 @@ static void executeList(gfx_display_list *list) {
             case gfx_command::END:
                 g_state->endVBOData = comm.vdata;
                 g_state->endVBOUnits = comm.vdata_units;
+                g_state->endVBOFormat = comm.uint1;
+                // cache_vertex_list keeps the constant attributes after the vertices
+                g_state->endVBOConstant = (const gfx_vertex_attributes*)(comm.vdata + comm.vdata_units * gfx_vertex_stride(comm.uint1));
                 glEnd();
                 break;
             case gfx_command::BIND_TEXTURE:
@@ -47,6 +50,10 @@ static void executeList(gfx_display_list *list) {
                 glTexImage2D(comm.enum1, comm.int1, comm.int2, comm.size1, comm.size2,
                              comm.int3, comm.enum2, comm.enum3, comm.voidp);
                 break;
+            case gfx_command::COMPRESSED_TEX_IMAGE_2D:
+                glCompressedTexImage2D(comm.enum1, comm.int1, comm.enum2, comm.size1, comm.size2,
+                                       comm.int3, comm.uint1, comm.voidp);
+                break;
             case gfx_command::ROTATE:
                 glRotatef(comm.floats[0], comm.floats[1], comm.floats[2], comm.floats[3]);
                 break;
@@ -116,6 +123,9 @@ static void executeList(gfx_display_list *list) {
             case gfx_command::DEPTH_FUNC:
                 glDepthFunc(comm.enum1);
                 break;
+            case gfx_command::CLEAR_STENCIL:
+                glClearStencil(comm.int1);
+                break;
             case gfx_command::NONE:
                 break;
         }
@@ -229,7 +239,7 @@ void glDeleteLists(	GLuint list, GLsizei range ) {
         gfx_display_list *dl = getList(list);
         if (!dl) continue;
         for (gfx_command &comm : dl->commands) {
-            if (comm.vdata) linearFree(comm.vdata);
+            if (comm.vdata) g_state->device->release(comm.vdata);
             comm.vdata = nullptr;
         }
         g_state->displayLists.erase(dl);
@@ -27,12 +27,15 @@ void glLoadIdentity (void) {
     switch(g_state->matrixMode) {
         case (GL_MODELVIEW): {
             g_state->modelviewMatrixStack[g_state->currentModelviewMatrix] = mat4();
+            ++g_state->modelviewGeneration;
         } break;
         case (GL_PROJECTION): {
             g_state->projectionMatrixStack[g_state->currentProjectionMatrix] = mat4();
+            ++g_state->projectionGeneration;
         } break;
         case (GL_TEXTURE): {
             g_state->textureMatrixStack[g_state->currentTextureMatrix] = mat4();
+            ++g_state->textureGeneration;
         } break;
     }
 }
@@ -61,6 +64,7 @@ void glPopMatrix (void) {
             }
 #endif
             g_state->currentModelviewMatrix--;
+            ++g_state->modelviewGeneration;
         } break;
 
         case (GL_PROJECTION): {
@@ -72,6 +76,7 @@ void glPopMatrix (void) {
 #endif
 
             g_state->currentProjectionMatrix--;
+            ++g_state->projectionGeneration;
         } break;
 
         case (GL_TEXTURE): {
@@ -83,6 +88,7 @@ void glPopMatrix (void) {
 #endif
 
             g_state->currentTextureMatrix--;
+            ++g_state->textureGeneration;
         } break;
 
     }
@@ -201,12 +207,15 @@ void glRotatef( GLfloat angle, GLfloat x, GLfloat y, GLfloat z ) {
     switch(g_state->matrixMode) {
         case (GL_MODELVIEW): {
             g_state->modelviewMatrixStack[g_state->currentModelviewMatrix] = g_state->modelviewMatrixStack[g_state->currentModelviewMatrix] * rotation;
+            ++g_state->modelviewGeneration;
         } break;
         case (GL_PROJECTION): {
             g_state->projectionMatrixStack[g_state->currentProjectionMatrix] = g_state->projectionMatrixStack[g_state->currentProjectionMatrix] * rotation;
+            ++g_state->projectionGeneration;
         } break;
         case (GL_TEXTURE): {
             g_state->textureMatrixStack[g_state->currentTextureMatrix] = g_state->textureMatrixStack[g_state->currentTextureMatrix] * rotation;
+            ++g_state->textureGeneration;
         } break;
     }
 }
@@ -234,12 +243,15 @@ void glTranslatef (GLfloat x, GLfloat y, GLfloat z) {
     switch(g_state->matrixMode) {
         case (GL_MODELVIEW): {
             g_state->modelviewMatrixStack[g_state->currentModelviewMatrix] = g_state->modelviewMatrixStack[g_state->currentModelviewMatrix] * translation;
+            ++g_state->modelviewGeneration;
         } break;
         case (GL_PROJECTION): {
             g_state->projectionMatrixStack[g_state->currentProjectionMatrix] = g_state->projectionMatrixStack[g_state->currentProjectionMatrix] * translation;
+            ++g_state->projectionGeneration;
         } break;
         case (GL_TEXTURE): {
             g_state->textureMatrixStack[g_state->currentTextureMatrix] = g_state->textureMatrixStack[g_state->currentTextureMatrix] * translation;
+            ++g_state->textureGeneration;
         } break;
     }
 }
@@ -267,12 +279,15 @@ void glScalef( GLfloat x, GLfloat y, GLfloat z ) {
     switch(g_state->matrixMode) {
         case (GL_MODELVIEW): {
             g_state->modelviewMatrixStack[g_state->currentModelviewMatrix] = g_state->modelviewMatrixStack[g_state->currentModelviewMatrix] * scale;
+            ++g_state->modelviewGeneration;
         } break;
         case (GL_PROJECTION): {
             g_state->projectionMatrixStack[g_state->currentProjectionMatrix] = g_state->projectionMatrixStack[g_state->currentProjectionMatrix] * scale;
+            ++g_state->projectionGeneration;
         } break;
         case (GL_TEXTURE): {
             g_state->textureMatrixStack[g_state->currentTextureMatrix] = g_state->textureMatrixStack[g_state->currentTextureMatrix] * scale;
+            ++g_state->textureGeneration;
         } break;
     }
 }
@@ -312,12 +327,15 @@ void glOrtho( GLdouble left, GLdouble right, GLdouble bottom, GLdouble top, GLdo
     switch(g_state->matrixMode) {
         case (GL_MODELVIEW): {
             g_state->modelviewMatrixStack[g_state->currentModelviewMatrix] = g_state->modelviewMatrixStack[g_state->currentModelviewMatrix] * ortho;
+            ++g_state->modelviewGeneration;
         } break;
         case (GL_PROJECTION): {
             g_state->projectionMatrixStack[g_state->currentProjectionMatrix] = g_state->projectionMatrixStack[g_state->currentProjectionMatrix] * ortho;
+            ++g_state->projectionGeneration;
         } break;
         case (GL_TEXTURE): {
             g_state->textureMatrixStack[g_state->currentTextureMatrix] = g_state->textureMatrixStack[g_state->currentTextureMatrix] * ortho;
+            ++g_state->textureGeneration;
         } break;
     }
 }
@@ -341,12 +359,15 @@ void glOrthof (GLfloat left, GLfloat right, GLfloat bottom, GLfloat top, GLfloat
   switch(g_state->matrixMode) {
     case (GL_MODELVIEW): {
       g_state->modelviewMatrixStack[g_state->currentModelviewMatrix] = g_state->modelviewMatrixStack[g_state->currentModelviewMatrix] * ortho;
+      ++g_state->modelviewGeneration;
     } break;
     case (GL_PROJECTION): {
       g_state->projectionMatrixStack[g_state->currentProjectionMatrix] = g_state->projectionMatrixStack[g_state->currentProjectionMatrix] * ortho;
+      ++g_state->projectionGeneration;
     } break;
     case (GL_TEXTURE): {
       g_state->textureMatrixStack[g_state->currentTextureMatrix] = g_state->textureMatrixStack[g_state->currentTextureMatrix] * ortho;
+      ++g_state->textureGeneration;
     } break;
   }
 }
@@ -388,12 +409,15 @@ void glFrustum ( GLdouble left, GLdouble right, GLdouble bottom, GLdouble top, G
   switch(g_state->matrixMode) {
     case (GL_MODELVIEW): {
       g_state->modelviewMatrixStack[g_state->currentModelviewMatrix] = g_state->modelviewMatrixStack[g_state->currentModelviewMatrix] * frustum;
+      ++g_state->modelviewGeneration;
     } break;
     case (GL_PROJECTION): {
       g_state->projectionMatrixStack[g_state->currentProjectionMatrix] = g_state->projectionMatrixStack[g_state->currentProjectionMatrix] * frustum;
+      ++g_state->projectionGeneration;
     } break;
     case (GL_TEXTURE): {
       g_state->textureMatrixStack[g_state->currentTextureMatrix] = g_state->textureMatrixStack[g_state->currentTextureMatrix] * frustum;
+      ++g_state->textureGeneration;
     } break;
   }
 }
@@ -417,12 +441,15 @@ void glFrustumf (GLfloat left, GLfloat right, GLfloat bottom, GLfloat top, GLflo
     switch(g_state->matrixMode) {
         case (GL_MODELVIEW): {
             g_state->modelviewMatrixStack[g_state->currentModelviewMatrix] = g_state->modelviewMatrixStack[g_state->currentModelviewMatrix] * frustum;
+            ++g_state->modelviewGeneration;
         } break;
         case (GL_PROJECTION): {
             g_state->projectionMatrixStack[g_state->currentProjectionMatrix] = g_state->projectionMatrixStack[g_state->currentProjectionMatrix] * frustum;
+            ++g_state->projectionGeneration;
         } break;
         case (GL_TEXTURE): {
             g_state->textureMatrixStack[g_state->currentTextureMatrix] = g_state->textureMatrixStack[g_state->currentTextureMatrix] * frustum;
+            ++g_state->textureGeneration;
         } break;
     }
 }
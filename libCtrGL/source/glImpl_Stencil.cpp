@@ -48,6 +48,7 @@ void glStencilFunc( GLenum func, GLint ref, GLuint mask ) {
     g_state->stencilFunc = func;
     g_state->stencilRef = clampi(ref, 0, (2 << 8) - 1); // TODO get number of actual stencil bits
     g_state->stencilFuncMask = mask;
+    g_state->dirty |= GFX_DIRTY_STENCIL;
 }
 
 void glStencilMask( GLuint mask ) {
@@ -65,6 +66,7 @@ void glStencilMask( GLuint mask ) {
 #endif
 
     g_state->stencilMask = mask;
+    g_state->dirty |= GFX_DIRTY_STENCIL;
 
 }
 
@@ -154,6 +156,26 @@ void glStencilOp( GLenum fail, GLenum zfail, GLenum zpass ) {
     g_state->stencilOpSFail = fail;
     g_state->stencilOpZFail = zfail;
     g_state->stencilOpZPass = zpass;
+    g_state->dirty |= GFX_DIRTY_STENCIL;
+}
+
+void glClearStencil( GLint s ) {
+    CHECK_NULL(g_state);
+
+#ifndef DISABLE_LISTS
+    if (g_state->withinNewEndListBlock && g_state->displayListCallDepth == 0) {
+        gfx_command comm;
+        comm.type = gfx_command::CLEAR_STENCIL;
+        comm.int1 = s;
+        getList(g_state->currentDisplayList)->commands.push_back(comm);
+    }
+
+    CHECK_COMPILE_AND_EXECUTE(g_state);
+#endif
+
+    CHECK_WITHIN_BEGIN_END(g_state);
+
+    g_state->clearStencil = s & 0xFF; // TODO get number of actual stencil bits
 }
 
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "glImpl.h"
 #include "gfx_device.h"
+#include "etc1.h"
 #include <cstdlib>
+#include <cstring>
 
 extern gfx_state *g_state;
 
@@ -24,6 +26,204 @@ gfx_texture *getTexture(GLuint name) {
     return nullptr;
 }
 
+/* PICA format an upload is kept in, the 16 bit GL types already have the texture unit's bit layout */
+static GPU_TEXCOLOR gl_texel_format(GLenum format, GLenum type) {
+    switch (type) {
+        case GL_UNSIGNED_SHORT_5_6_5: return GPU_RGB565;
+        case GL_UNSIGNED_SHORT_4_4_4_4: return GPU_RGBA4;
+        case GL_UNSIGNED_SHORT_5_5_5_1: return GPU_RGBA5551;
+    }
+    switch (format) {
+        case GL_RGB: return GPU_RGB8;
+        case GL_ALPHA: return GPU_A8;
+        case GL_LUMINANCE: return GPU_L8;
+        case GL_LUMINANCE_ALPHA: return GPU_LA8;
+    }
+    return GPU_RGBA8;
+}
+
+/* bytes per pixel of an upload, 0 for the ones that can't be unpacked */
+static u32 gl_pixel_size(GLenum format, GLenum type) {
+    switch (type) {
+        case GL_UNSIGNED_SHORT_5_6_5:
+        case GL_UNSIGNED_SHORT_4_4_4_4:
+        case GL_UNSIGNED_SHORT_5_5_5_1: return 2;
+        case GL_UNSIGNED_BYTE: break;
+        default: return 0;
+    }
+    switch (format) {
+        case GL_RGBA:
+#ifndef SPEC_GLES
+        case GL_BGRA:
+#else
+        case GL_BGRA_EXT:
+#endif
+            return 4;
+        case GL_RGB: return 3;
+        case GL_LUMINANCE_ALPHA: return 2;
+        case GL_ALPHA:
+        case GL_LUMINANCE: return 1;
+    }
+    return 0;
+}
+
+static GLubyte expand5(u32 v) { return (v << 3) | (v >> 2); }
+static GLubyte expand6(u32 v) { return (v << 2) | (v >> 4); }
+
+/* one pixel of an upload as RGBA bytes */
+static void gl_unpack_texel(const GLubyte *p, GLenum format, GLenum type, GLubyte rgba[4]) {
+#ifndef SPEC_GLES
+    bool bgra = format == GL_BGRA;
+#else
+    bool bgra = format == GL_BGRA_EXT;
+#endif
+    GLushort v = 0;
+    if (type != GL_UNSIGNED_BYTE) memcpy(&v, p, 2);
+
+    switch (type) {
+        case GL_UNSIGNED_SHORT_5_6_5: {
+            rgba[0] = expand5(v >> 11);
+            rgba[1] = expand6((v >> 5) & 0x3F);
+            rgba[2] = expand5(v & 0x1F);
+            rgba[3] = 0xFF;
+        } return;
+        case GL_UNSIGNED_SHORT_4_4_4_4: {
+            rgba[bgra ? 2 : 0] = (v >> 12) * 0x11;
+            rgba[1] = ((v >> 8) & 0xF) * 0x11;
+            rgba[bgra ? 0 : 2] = ((v >> 4) & 0xF) * 0x11;
+            rgba[3] = (v & 0xF) * 0x11;
+        } return;
+        case GL_UNSIGNED_SHORT_5_5_5_1: {
+            rgba[bgra ? 2 : 0] = expand5(v >> 11);
+            rgba[1] = expand5((v >> 6) & 0x1F);
+            rgba[bgra ? 0 : 2] = expand5((v >> 1) & 0x1F);
+            rgba[3] = 0xFF * (v & 1);
+        } return;
+    }
+
+    switch (format) {
+        case GL_RGB: {
+            rgba[0] = p[0];
+            rgba[1] = p[1];
+            rgba[2] = p[2];
+            rgba[3] = 0xFF;
+        } return;
+        case GL_ALPHA: {
+            rgba[0] = rgba[1] = rgba[2] = 0;
+            rgba[3] = p[0];
+        } return;
+        case GL_LUMINANCE: {
+            rgba[0] = rgba[1] = rgba[2] = p[0];
+            rgba[3] = 0xFF;
+        } return;
+        case GL_LUMINANCE_ALPHA: {
+            rgba[0] = rgba[1] = rgba[2] = p[0];
+            rgba[3] = p[1];
+        } return;
+    }
+
+    rgba[0] = p[bgra ? 2 : 0];
+    rgba[1] = p[1];
+    rgba[2] = p[bgra ? 0 : 2];
+    rgba[3] = p[3];
+}
+
+/* one texel in a PICA format, wider formats are stored with the last component first */
+static void gl_pack_texel(GLubyte *dst, GPU_TEXCOLOR format, const GLubyte rgba[4]) {
+    GLushort v;
+    switch (format) {
+        case GPU_RGBA8: {
+            dst[0] = rgba[3];
+            dst[1] = rgba[2];
+            dst[2] = rgba[1];
+            dst[3] = rgba[0];
+        } return;
+        case GPU_RGB8: {
+            dst[0] = rgba[2];
+            dst[1] = rgba[1];
+            dst[2] = rgba[0];
+        } return;
+        case GPU_RGB565: {
+            v = ((rgba[0] >> 3) << 11) | ((rgba[1] >> 2) << 5) | (rgba[2] >> 3);
+        } break;
+        case GPU_RGBA5551: {
+            v = ((rgba[0] >> 3) << 11) | ((rgba[1] >> 3) << 6) | ((rgba[2] >> 3) << 1) | (rgba[3] >> 7);
+        } break;
+        case GPU_RGBA4: {
+            v = ((rgba[0] >> 4) << 12) | ((rgba[1] >> 4) << 8) | ((rgba[2] >> 4) << 4) | (rgba[3] >> 4);
+        } break;
+        case GPU_LA8: {
+            dst[0] = rgba[3];
+            dst[1] = rgba[0];
+        } return;
+        case GPU_L8: {
+            dst[0] = rgba[0];
+        } return;
+        case GPU_A8: {
+            dst[0] = rgba[3];
+        } return;
+        default: return;
+    }
+    memcpy(dst, &v, 2);
+}
+
+/* converts n pixels of an upload into texels of the given format */
+static void gl_unpack_row(GLubyte *dst, GPU_TEXCOLOR texel, const GLubyte *src, GLenum format, GLenum type, GLsizei n) {
+    u32 size = gl_pixel_size(format, type);
+    // the packed types and single channels are stored the way the texture unit reads them
+    if ((format == GL_RGB || format == GL_RGBA || format == GL_ALPHA || format == GL_LUMINANCE) &&
+        size < 3 && gl_texel_format(format, type) == texel) {
+        memcpy(dst, src, n * size);
+        return;
+    }
+
+    u32 texelSize = gfx_texel_size(texel);
+    GLubyte rgba[4];
+    for (GLsizei i = 0; i < n; ++i) {
+        gl_unpack_texel(src + i * size, format, type, rgba);
+        gl_pack_texel(dst + i * texelSize, texel, rgba);
+    }
+}
+
+/* bytes between the rows of an upload */
+static u32 gl_row_size(GLsizei width, u32 size) {
+    u32 align = g_state->unpackAlignment;
+    return (width * size + align - 1) / align * align;
+}
+
+/* PICA format of the compressed internal formats, false for the others */
+static bool gl_compressed_texel(GLenum internalFormat, GPU_TEXCOLOR& texel) {
+    switch (internalFormat) {
+        case GL_ETC1_RGB8_OES: texel = GPU_ETC1; return true;
+        case GL_ETC1_ALPHA4_RGB8_DMP: texel = GPU_ETC1A4; return true;
+    }
+    return false;
+}
+
+/* encodes an upload into ETC blocks, laid out the way glCompressedTexImage2D takes them */
+static void gl_compress_image(GLubyte *dst, GPU_TEXCOLOR texel, const GLubyte *pixels, GLenum format, GLenum type,
+                              GLsizei width, GLsizei height) {
+    u32 size = gl_pixel_size(format, type);
+    u32 stride = gl_row_size(width, size);
+    GLubyte rgba[16 * 4];
+    for (GLsizei by = 0; by < height; by += 4) {
+        for (GLsizei bx = 0; bx < width; bx += 4) {
+            for (int y = 0; y < 4; ++y) {
+                for (int x = 0; x < 4; ++x) {
+                    gl_unpack_texel(pixels + (by + y) * stride + (bx + x) * size, format, type, rgba + (y * 4 + x) * 4);
+                }
+            }
+            if (texel == GPU_ETC1A4) {
+                u64 alpha = etc1_encode_alpha(rgba);
+                memcpy(dst, &alpha, sizeof(alpha));
+                dst += sizeof(alpha);
+            }
+            etc1_encode_block(rgba, dst);
+            dst += ETC1_BLOCK_SIZE;
+        }
+    }
+}
+
 extern "C"
 {
 
@@ -114,6 +314,7 @@ void glDeleteTextures( GLsizei n, const GLuint *textures) {
             g_state->currentBoundTexture = 0;
         }
     }
+    g_state->dirty |= GFX_DIRTY_TEXTURE;
 
 }
 
@@ -168,6 +369,7 @@ void glBindTexture( GLenum target, GLuint texture ) {
 #endif
 
     g_state->currentBoundTexture = text->tname;
+    g_state->dirty |= GFX_DIRTY_TEXTURE;
 }
 
 
@@ -183,7 +385,7 @@ void glTexImage2D( GLenum target, GLint level, GLint internalFormat, GLsizei wid
         comm.int2 = internalFormat;
         comm.size1 = width;
         comm.size2 = height;
-        comm.int2 = border;
+        comm.int3 = border;
         comm.enum2 = format;
         comm.enum3 = type;
         comm.voidp = (GLvoid *)pixels;
@@ -251,7 +453,9 @@ void glTexImage2D( GLenum target, GLint level, GLint internalFormat, GLsizei wid
         case (GL_BGRA_EXT):
 #endif
         case (GL_LUMINANCE):
-        case (GL_LUMINANCE_ALPHA): {
+        case (GL_LUMINANCE_ALPHA):
+        case (GL_ETC1_RGB8_OES):
+        case (GL_ETC1_ALPHA4_RGB8_DMP): {
 
         } break;
 
@@ -276,7 +480,14 @@ void glTexImage2D( GLenum target, GLint level, GLint internalFormat, GLsizei wid
         return;
     }
 
-    if((GLenum)internalFormat != format) {
+    // the compressed formats are encoded from any upload, in whole 8x8 tiles of blocks
+    GPU_TEXCOLOR compressed;
+    if(gl_compressed_texel(internalFormat, compressed)) {
+        if(width & 7 || height & 7) {
+            setError(GL_INVALID_VALUE);
+            return;
+        }
+    } else if((GLenum)internalFormat != format) {
         setError(GL_INVALID_OPERATION);
         return;
     }
@@ -288,13 +499,13 @@ void glTexImage2D( GLenum target, GLint level, GLint internalFormat, GLsizei wid
     }
 
     if((type == GL_UNSIGNED_SHORT_4_4_4_4 || type == GL_UNSIGNED_SHORT_5_5_5_1)
-       && (format != GL_RGBA
+       && format != GL_RGBA
 #ifndef SPEC_GLES
-       || format != GL_BGRA
+       && format != GL_BGRA
 #else
-       || format != GL_BGRA_EXT
+       && format != GL_BGRA_EXT
 #endif
-           ) ) {
+           ) {
         setError(GL_INVALID_OPERATION);
         return;
     }
@@ -304,93 +515,27 @@ void glTexImage2D( GLenum target, GLint level, GLint internalFormat, GLsizei wid
 
     if (!text) return;
 
-    text->unpackedColorBuffer = (GLubyte*)linearAlloc(sizeof(GLubyte) * 4 * width * height);
+    u32 size = gl_pixel_size(format, type);
+    if (!size) return;
+
+    // kept in the format the texture unit samples natively, only RGBA8 still takes 4 bytes a texel
+    GPU_TEXCOLOR texel = gl_texel_format(format, type);
+    bool compress = gl_compressed_texel(internalFormat, texel);
+    g_state->device->wait_texture(*text);
+    linearFree(text->unpackedColorBuffer);
+    text->unpackedColorBuffer = (GLubyte*)linearAlloc(gfx_image_size(texel, width, height));
     text->width = width;
     text->height = height;
-    text->format = format;
+    text->format = compress ? (texel == GPU_ETC1A4 ? GL_RGBA : GL_RGB) : format;
+    text->texelFormat = texel;
 
-    if(pixels) {
-        unsigned int accum = 0;
-        //TODO implement unpacking for more texture formats
+    if(pixels && compress) {
+        gl_compress_image(text->unpackedColorBuffer, texel, (const GLubyte*)pixels, format, type, width, height);
+    } else if(pixels) {
+        u32 stride = gl_row_size(width, size);
         for(GLsizei y = 0; y < height; y++) {
-            for(GLsizei x = 0; x < width; x++) {
-                switch(format) {
-                    case (GL_RGBA): {
-                        if(type == GL_UNSIGNED_BYTE) {
-                            int index = (x + y * width) * 4;
-                            GLubyte* bpixels = (GLubyte*)pixels;
-                            text->unpackedColorBuffer[index] = bpixels[accum];
-                            text->unpackedColorBuffer[index + 1] = bpixels[accum + 1];
-                            text->unpackedColorBuffer[index + 2] = bpixels[accum + 2];
-                            text->unpackedColorBuffer[index + 3] = bpixels[accum + 3];
-                            accum += 4;
-                        }
-                        else if (type == GL_UNSIGNED_SHORT_5_5_5_1) {
-                            int index = (x + y * width) * 4;
-                            GLushort pixel = ((GLushort*)pixels)[accum];
-                            float R = (float)((pixel >> 11) & 0b11111) / 31.0f;
-                            float G = (float)((pixel >> 6) & 0b11111) / 31.0f;
-                            float B = (float)((pixel >> 1) & 0b11111) / 31.0f;
-                            text->unpackedColorBuffer[index + 0] = (GLubyte)(R *  255.0f);
-                            text->unpackedColorBuffer[index + 1] = (GLubyte)(G *  255.0f);
-                            text->unpackedColorBuffer[index + 2] = (GLubyte)(B *  255.0f);
-                            text->unpackedColorBuffer[index + 3] = 0xFF * (pixel & 1);
-                            accum ++;
-                        }
-                    } break;
-#ifndef SPEC_GLES
-                  case (GL_BGRA):
-#else
-                  case (GL_BGRA_EXT):
-#endif
-                  {
-                    if(type == GL_UNSIGNED_BYTE) {
-                      int index = (x + y * width) * 4;
-                      GLubyte* bpixels = (GLubyte*)pixels;
-                      text->unpackedColorBuffer[index + 3] = bpixels[accum + 0];
-                      text->unpackedColorBuffer[index + 2] = bpixels[accum + 1];
-                      text->unpackedColorBuffer[index + 1] = bpixels[accum + 2];
-                      text->unpackedColorBuffer[index + 0] = bpixels[accum + 3];
-                      accum += 4;
-                    }
-                    else if (type == GL_UNSIGNED_SHORT_5_5_5_1) {
-                      int index = (x + y * width) * 4;
-                      GLushort pixel = ((GLushort*)pixels)[accum];
-                      float R = (float)((pixel >> 11) & 0b11111) / 31.0f;
-                      float G = (float)((pixel >> 6) & 0b11111) / 31.0f;
-                      float B = (float)((pixel >> 1) & 0b11111) / 31.0f;
-                      text->unpackedColorBuffer[index + 3] = (GLubyte)(R *  255.0f);
-                      text->unpackedColorBuffer[index + 2] = (GLubyte)(G *  255.0f);
-                      text->unpackedColorBuffer[index + 1] = (GLubyte)(B *  255.0f);
-                      text->unpackedColorBuffer[index + 0] = 0xFF * (pixel & 1);
-                      accum ++;
-                    }
-                  } break;
-
-                    case (GL_ALPHA): {
-                        if(type == GL_UNSIGNED_BYTE) {
-                            int index = (x + y * width) * 4;
-                            GLubyte* bpixels = (GLubyte*)pixels;
-                            text->unpackedColorBuffer[index] = 0x00;
-                            text->unpackedColorBuffer[index + 1] = 0x00;
-                            text->unpackedColorBuffer[index + 2] = 0x00;
-                            text->unpackedColorBuffer[index + 3] = bpixels[accum];
-                            accum++;
-                        }
-                    } break;
-#ifndef DISABLE_ERRORS
-                    default: {
-
-                        setError(GL_INVALID_VALUE);
-                        return;
-                    } break;
-#endif
-                }
-            }
-
-            while(accum % g_state->unpackAlignment != 0) {
-                accum++;
-            }
+            gl_unpack_row(text->unpackedColorBuffer + y * width * gfx_texel_size(texel), texel,
+                          (const GLubyte*)pixels + y * stride, format, type, width);
         }
     }
     g_state->device->repack_texture(*text);
@@ -464,98 +609,106 @@ void glTexSubImage2D( GLenum target, GLint level, GLint xoffset, GLint yoffset,
 
     gfx_texture* text = getTexture(g_state->currentBoundTexture);
 
+    // compressed textures are only ever replaced whole
+    u32 size = gl_pixel_size(format, type);
+    if (!text || !size || !text->unpackedColorBuffer || !gfx_texel_size(text->texelFormat)) {
 #ifndef DISABLE_ERRORS
-    if (!text) {
         setError(GL_INVALID_OPERATION);
+#endif
+        return;
+    }
+
+#ifndef DISABLE_ERRORS
+    if (xoffset < 0 || yoffset < 0 || width < 0 || height < 0 ||
+        xoffset + width > text->width || yoffset + height > text->height) {
+        setError(GL_INVALID_VALUE);
         return;
     }
 #endif
 
+    g_state->device->wait_texture(*text);
     if(pixels) {
-        unsigned int accum = 0;
-        //TODO implement unpacking for more texture formats
-        for(GLsizei y = yoffset; y < yoffset + height && y < text->height; ++y) {
-            for(GLsizei x = xoffset; x < yoffset + width && x < text->width; ++x) {
-                switch(format) {
-                    case (GL_RGBA): {
-                        if(type == GL_UNSIGNED_BYTE) {
-                            int index = (x + y * text->width) * 4;
-                            int srcindex = ((x - xoffset) + y * width) * 4;
-                            GLubyte* bpixels = (GLubyte*)pixels;
-                            text->unpackedColorBuffer[index] = bpixels[srcindex];
-                            text->unpackedColorBuffer[index + 1] = bpixels[srcindex + 1];
-                            text->unpackedColorBuffer[index + 2] = bpixels[srcindex + 2];
-                            text->unpackedColorBuffer[index + 3] = bpixels[srcindex + 3];
-                            accum += 4;
-                        }
-                        else if (type == GL_UNSIGNED_SHORT_5_5_5_1) {
-                            int index = (x + y * width) * 4;
-                            GLushort pixel = ((GLushort*)pixels)[accum];
-                            float R = (float)((pixel >> 11) & 0b11111) / 31.0f;
-                            float G = (float)((pixel >> 6) & 0b11111) / 31.0f;
-                            float B = (float)((pixel >> 1) & 0b11111) / 31.0f;
-                            text->unpackedColorBuffer[index + 0] = (GLubyte)(R *  255.0f);
-                            text->unpackedColorBuffer[index + 1] = (GLubyte)(G *  255.0f);
-                            text->unpackedColorBuffer[index + 2] = (GLubyte)(B *  255.0f);
-                            text->unpackedColorBuffer[index + 3] = 0xFF * (pixel & 1);
-                            accum ++;
-                        }
-                    } break;
-
-#ifndef SPEC_GLES
-                  case (GL_BGRA):
-#else
-                  case (GL_BGRA_EXT):
-#endif
-                  {
-                    if(type == GL_UNSIGNED_BYTE) {
-                      int index = (x + y * width) * 4;
-                      GLubyte* bpixels = (GLubyte*)pixels;
-                      text->unpackedColorBuffer[index + 3] = bpixels[accum + 0];
-                      text->unpackedColorBuffer[index + 2] = bpixels[accum + 1];
-                      text->unpackedColorBuffer[index + 1] = bpixels[accum + 2];
-                      text->unpackedColorBuffer[index + 0] = bpixels[accum + 3];
-                      accum += 4;
-                    }
-                    else if (type == GL_UNSIGNED_SHORT_5_5_5_1) {
-                      int index = (x + y * width) * 4;
-                      GLushort pixel = ((GLushort*)pixels)[accum];
-                      float R = (float)((pixel >> 11) & 0b11111) / 31.0f;
-                      float G = (float)((pixel >> 6) & 0b11111) / 31.0f;
-                      float B = (float)((pixel >> 1) & 0b11111) / 31.0f;
-                      text->unpackedColorBuffer[index + 3] = (GLubyte)(R *  255.0f);
-                      text->unpackedColorBuffer[index + 2] = (GLubyte)(G *  255.0f);
-                      text->unpackedColorBuffer[index + 1] = (GLubyte)(B *  255.0f);
-                      text->unpackedColorBuffer[index + 0] = 0xFF * (pixel & 1);
-                      accum ++;
-                    }
-                  } break;
-
-                    case (GL_ALPHA): {
-                        if(type == GL_UNSIGNED_BYTE) {
-                            int index = (x + y * text->width) * 4;
-                            int srcindex = ((x - xoffset) + y * width);
-                            GLubyte* bpixels = (GLubyte*)pixels;
-                            text->unpackedColorBuffer[index] = 0x00;
-                            text->unpackedColorBuffer[index + 1] = 0x00;
-                            text->unpackedColorBuffer[index + 2] = 0x00;
-                            text->unpackedColorBuffer[index + 3] = bpixels[srcindex];
-                            accum++;
-                        }
-                    } break;
-                        
-                }
-            }
-            
-            while(accum % g_state->unpackAlignment != 0) {
-                accum++;
-            }
+        u32 texelSize = gfx_texel_size(text->texelFormat);
+        u32 stride = gl_row_size(width, size);
+        for(GLsizei y = yoffset; y < yoffset + height; ++y) {
+            const GLubyte *src = (const GLubyte*)pixels + (y - yoffset) * stride;
+            GLubyte *dst = text->unpackedColorBuffer + (y * text->width + xoffset) * texelSize;
+            gl_unpack_row(dst, text->texelFormat, src, format, type, width);
         }
     }
-    
+
     g_state->device->repack_texture(*text);
 }
 
+void glCompressedTexImage2D( GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data ) {
+    CHECK_NULL(g_state);
+
+#ifndef DISABLE_LISTS
+    if (g_state->withinNewEndListBlock && g_state->displayListCallDepth == 0) {
+        gfx_command comm;
+        comm.type = gfx_command::COMPRESSED_TEX_IMAGE_2D;
+        comm.enum1 = target;
+        comm.int1 = level;
+        comm.enum2 = internalformat;
+        comm.size1 = width;
+        comm.size2 = height;
+        comm.int3 = border;
+        comm.uint1 = imageSize;
+        comm.voidp = (GLvoid *)data;
+        getList(g_state->currentDisplayList)->commands.push_back(comm);
+    }
+
+    CHECK_COMPILE_AND_EXECUTE(g_state);
+#endif
+
+    GPU_TEXCOLOR texel;
+#ifndef DISABLE_ERRORS
+    if(target != GL_TEXTURE_2D || !gl_compressed_texel(internalformat, texel)) {
+        setError(GL_INVALID_ENUM);
+        return;
+    }
+
+    // the PICA samples the blocks in 8x8 tiles
+    if(level < 0 || level > log2(IMPL_MAX_TEXTURE_SIZE)
+       || width < 0 || height < 0
+       || width > IMPL_MAX_TEXTURE_SIZE
+       || height > IMPL_MAX_TEXTURE_SIZE
+       || width & 7
+       || height & 7
+       || border != 0
+       || (u32)imageSize != gfx_image_size(texel, width, height)) {
+        setError(GL_INVALID_VALUE);
+        return;
+    }
+#else
+    if (!gl_compressed_texel(internalformat, texel)) return;
+#endif
+
+    gfx_texture* text = getTexture(g_state->currentBoundTexture);
+
+    if (!text) return;
+
+    g_state->device->wait_texture(*text);
+    linearFree(text->unpackedColorBuffer);
+    text->unpackedColorBuffer = (GLubyte*)linearAlloc(gfx_image_size(texel, width, height));
+    text->width = width;
+    text->height = height;
+    text->format = texel == GPU_ETC1A4 ? GL_RGBA : GL_RGB;
+    text->texelFormat = texel;
+
+    if(data) memcpy(text->unpackedColorBuffer, data, gfx_image_size(texel, width, height));
+    g_state->device->repack_texture(*text);
+}
+
+void glCompressedTexSubImage2D( GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLsizei imageSize, const GLvoid *data ) {
+    CHECK_NULL(g_state);
+
+    // neither ETC format allows updating part of an image
+#ifndef DISABLE_ERRORS
+    setError(GL_INVALID_OPERATION);
+#endif
+}
+
 void glPixelStorei( GLenum pname, GLint param ) {
     CHECK_NULL(g_state);
 
@@ -711,6 +864,7 @@ void glTexParameteri( GLenum target, GLenum pname, GLint param ) {
         } break;
             
     }
+    g_state->dirty |= GFX_DIRTY_TEXTURE;
 }
 
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "glImpl.h"
+#include <cstring>
 
 extern gfx_state *g_state;
 
@@ -11,6 +12,16 @@ gfx_display_list *getList(GLuint name);
 
 #ifndef SPEC_GLES
 
+/* attributes the current state reads, lists keep all of them since they may be called in any state */
+static u8 vertex_attributes() {
+#ifndef DISABLE_LISTS
+    if (g_state->withinNewEndListBlock && g_state->displayListCallDepth == 0) return GFX_VERTEX_ALL;
+#endif
+    u8 format = g_state->enableLighting ? GFX_VERTEX_NORMAL : GFX_VERTEX_COLOR;
+    if (g_state->enableTexture2D) format |= GFX_VERTEX_TEXCOORD;
+    return format;
+}
+
 void glBegin( GLenum mode ) {
     CHECK_NULL(g_state);
 
@@ -22,6 +33,7 @@ void glBegin( GLenum mode ) {
         getList(g_state->currentDisplayList)->commands.push_back(comm);
 
         g_state->vertexDrawMode = mode;
+        g_state->device->stream_begin(GFX_VERTEX_ALL);
     }
 
     CHECK_COMPILE_AND_EXECUTE(g_state);
@@ -53,6 +65,7 @@ void glBegin( GLenum mode ) {
 
     g_state->vertexDrawMode = mode;
     g_state->withinBeginEndBlock = GL_TRUE;
+    g_state->device->stream_begin(vertex_attributes());
 }
 
 void glEnd( void ) {
@@ -62,12 +75,13 @@ void glEnd( void ) {
     if (g_state->withinNewEndListBlock && g_state->displayListCallDepth == 0) {
         gfx_command comm;
         comm.type = gfx_command::END;
-        comm.vdata_units = g_state->vertexBuffer.size();
+        comm.vdata_units = g_state->device->stream.count;
+        comm.uint1 = g_state->device->stream.format;
         comm.vdata = g_state->device->cache_vertex_list(&comm.vdata_size);
         getList(g_state->currentDisplayList)->commands.push_back(comm);
 
         if (g_state->newDisplayListMode == GL_COMPILE) {
-            g_state->vertexBuffer.clear();
+            g_state->device->stream.count = 0;
             return;
         }
     }
@@ -95,10 +109,11 @@ void glEnd( void ) {
 
 #ifndef DISABLE_LISTS
     } else {
-        g_state->device->render_vertices_vbo(projectionMatrix, modelvieMatrix, g_state->endVBOData, g_state->endVBOUnits);
+        g_state->device->render_vertices_vbo(projectionMatrix, modelvieMatrix, g_state->endVBOData, g_state->endVBOUnits,
+                                             g_state->endVBOFormat, *g_state->endVBOConstant);
+        g_state->device->stream.count = 0;
     }
 #endif
-    g_state->vertexBuffer.clear();
 }
 
 void glTexCoord1f( GLfloat s ) {
@@ -178,18 +193,23 @@ void glVertex3f( GLfloat x, GLfloat y, GLfloat z ) {
 void glVertex4f( GLfloat x, GLfloat y, GLfloat z, GLfloat w ) {
     CHECK_NULL(g_state);
 
-    vertex result = vertex(vec4(x, y, z, w),
-                           vec4(g_state->currentVertexColor),
-                           vec4(g_state->currentTextureCoord),
-                           vec4(g_state->currentVertexNormal));
-    if (g_state->vertexDrawMode == GL_QUADS && g_state->vertexBuffer.size() % 6 == 3) {
-        int index = g_state->vertexBuffer.size() - 1;
-        vertex s2 = vertex(g_state->vertexBuffer[index]);
-        vertex s0 = vertex(g_state->vertexBuffer[index - 2]);
-        g_state->vertexBuffer.push(s0);
-        g_state->vertexBuffer.push(s2);
+    gfx_device *device = g_state->device;
+    gfx_vertex_stream& stream = device->stream;
+    if (stream.count == 0) {
+        stream.constant = g_state->currentAttributes();
+    } else if (stream.attributes != stream.format) {
+        // attributes are kept out of the vertices until they change inside the block
+        u8 varied = 0;
+        const gfx_vertex_attributes& c = stream.constant;
+        if (memcmp(&c.texCoord, &g_state->currentTextureCoord, sizeof(vec4))) varied |= GFX_VERTEX_TEXCOORD;
+        if (memcmp(&c.color, &g_state->currentVertexColor, sizeof(vec4))) varied |= GFX_VERTEX_COLOR;
+        if (memcmp(&c.normal, &g_state->currentVertexNormal, sizeof(vec4))) varied |= GFX_VERTEX_NORMAL;
+        varied &= stream.attributes & ~stream.format;
+        if (varied) device->stream_widen(stream.format | varied);
     }
-    g_state->vertexBuffer.push(result);
+
+    u8 *v = device->stream_vertices(1);
+    if (v) gfx_pack_vertex(v, stream.format, x, y, z, g_state->currentAttributes());
 }
 
 #endif // SPEC_GLES
@@ -207,15 +227,29 @@ void glNormal3f( GLfloat nx, GLfloat ny, GLfloat nz ) {
     g_state->currentVertexNormal = vec4(nx, ny, nz, 1.0);
 }
 
+static void setClientArray(gfx_array id, GLint size, GLenum type, GLsizei stride, const GLvoid *pointer) {
+  gfx_client_array& array = g_state->clientArrays[id];
+  array.size = size;
+  array.type = type;
+  array.stride = stride;
+  array.pointer = pointer;
+  array.buffer = g_state->arrayBuffer;
+  ++g_state->arraysGeneration;
+}
+
 void glVertexPointer (GLint size, GLenum type, GLsizei stride, const GLvoid *pointer) {
   CHECK_NULL(g_state);
 
 #ifndef DISABLE_ERRORS
   if (size < 2 || size > 4) {
     setError(GL_INVALID_VALUE);
+    return;
   }
 
   switch (type) {
+#ifdef SPEC_GLES
+    case GL_BYTE:
+#endif
     case GL_SHORT:
 #if !defined(SPEC_GLES) || defined(SPEC_GLES2)
     case GL_INT:
@@ -231,22 +265,132 @@ void glVertexPointer (GLint size, GLenum type, GLsizei stride, const GLvoid *poi
 
     default:
       setError(GL_INVALID_ENUM);
+      return;
   }
 
-  if (stride < 0)
+  if (stride < 0) {
     setError(GL_INVALID_VALUE);
+    return;
+  }
 #endif
 
-  g_state->vertexPtrSize = size;
-  g_state->vertexPtrType = type;
-  g_state->vertexPtrStride = stride;
-  g_state->vertexPtr = pointer;
+  setClientArray(GFX_ARRAY_VERTEX, size, type, stride, pointer);
 }
 
-void glDrawArrays (GLenum mode, GLint first, GLsizei count) {
+void glColorPointer (GLint size, GLenum type, GLsizei stride, const GLvoid *pointer) {
   CHECK_NULL(g_state);
 
 #ifndef DISABLE_ERRORS
+#ifdef SPEC_GLES
+  if (size != 4) {
+#else
+  if (size < 3 || size > 4) {
+#endif
+    setError(GL_INVALID_VALUE);
+    return;
+  }
+
+  switch (type) {
+    case GL_UNSIGNED_BYTE:
+    case GL_FLOAT:
+#ifndef SPEC_GLES
+    case GL_BYTE:
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT:
+    case GL_INT:
+    case GL_UNSIGNED_INT:
+    case GL_DOUBLE:
+#endif
+    {
+
+    } break;
+
+    default:
+      setError(GL_INVALID_ENUM);
+      return;
+  }
+
+  if (stride < 0) {
+    setError(GL_INVALID_VALUE);
+    return;
+  }
+#endif
+
+  setClientArray(GFX_ARRAY_COLOR, size, type, stride, pointer);
+}
+
+void glTexCoordPointer (GLint size, GLenum type, GLsizei stride, const GLvoid *pointer) {
+  CHECK_NULL(g_state);
+
+#ifndef DISABLE_ERRORS
+#ifdef SPEC_GLES
+  if (size < 2 || size > 4) {
+#else
+  if (size < 1 || size > 4) {
+#endif
+    setError(GL_INVALID_VALUE);
+    return;
+  }
+
+  switch (type) {
+#ifdef SPEC_GLES
+    case GL_BYTE:
+#else
+    case GL_INT:
+    case GL_DOUBLE:
+#endif
+    case GL_SHORT:
+    case GL_FLOAT:
+    {
+
+    } break;
+
+    default:
+      setError(GL_INVALID_ENUM);
+      return;
+  }
+
+  if (stride < 0) {
+    setError(GL_INVALID_VALUE);
+    return;
+  }
+#endif
+
+  setClientArray(GFX_ARRAY_TEXCOORD, size, type, stride, pointer);
+}
+
+void glNormalPointer (GLenum type, GLsizei stride, const GLvoid *pointer) {
+  CHECK_NULL(g_state);
+
+#ifndef DISABLE_ERRORS
+  switch (type) {
+    case GL_BYTE:
+    case GL_SHORT:
+    case GL_FLOAT:
+#ifndef SPEC_GLES
+    case GL_INT:
+    case GL_DOUBLE:
+#endif
+    {
+
+    } break;
+
+    default:
+      setError(GL_INVALID_ENUM);
+      return;
+  }
+
+  if (stride < 0) {
+    setError(GL_INVALID_VALUE);
+    return;
+  }
+#endif
+
+  setClientArray(GFX_ARRAY_NORMAL, 3, type, stride, pointer);
+}
+
+#ifndef DISABLE_ERRORS
+static bool validDrawMode(GLenum mode) {
   switch(mode) {
     case (GL_POINTS):
     case (GL_LINES):
@@ -255,18 +399,37 @@ void glDrawArrays (GLenum mode, GLint first, GLsizei count) {
     case (GL_TRIANGLES):
     case (GL_TRIANGLE_STRIP):
     case (GL_TRIANGLE_FAN):
-    {
+#ifndef SPEC_GLES
+    case (GL_QUADS):
+    case (GL_QUAD_STRIP):
+    case (GL_POLYGON):
+#endif
+      return true;
+  }
+  return false;
+}
+#endif
 
-    } break;
+void glDrawArrays (GLenum mode, GLint first, GLsizei count) {
+  CHECK_NULL(g_state);
 
-    default: {
-      setError(GL_INVALID_ENUM);
-    } break;
+#ifndef DISABLE_ERRORS
+  if (!validDrawMode(mode)) {
+    setError(GL_INVALID_ENUM);
+    return;
   }
+#endif
 
-  if (count < 0)
+  // the device reads the arrays from first on as an unsigned index
+  if (first < 0 || count < 0) {
+#ifndef DISABLE_ERRORS
     setError(GL_INVALID_VALUE);
 #endif
+    return;
+  }
+
+  // without positions there is nothing to draw
+  if (!g_state->clientArrays[GFX_ARRAY_VERTEX].enabled || !count) return;
 
   mat4 projectionMatrix = g_state->projectionMatrixStack[g_state->currentProjectionMatrix];
   mat4 modelvieMatrix = g_state->modelviewMatrixStack[g_state->currentModelviewMatrix];
@@ -274,4 +437,92 @@ void glDrawArrays (GLenum mode, GLint first, GLsizei count) {
 
 }
 
+/* end ~0u leaves finding the range of the indices to the device, when it needs it at all */
+static void drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLuint start, GLuint end) {
+#ifndef DISABLE_ERRORS
+  if (!validDrawMode(mode) || !gfx_index_size(type)) {
+    setError(GL_INVALID_ENUM);
+    return;
+  }
+
+  if (count < 0) {
+    setError(GL_INVALID_VALUE);
+    return;
+  }
+#endif
+
+  if (!g_state->clientArrays[GFX_ARRAY_VERTEX].enabled || count <= 0) return;
+
+  // with an element array buffer bound, indices is an offset into it
+  if (g_state->elementArrayBuffer) {
+    gfx_buffer *buf = g_state->getBuffer(g_state->elementArrayBuffer);
+    if (!buf || !buf->data) return;
+    indices = buf->data + (uintptr_t)indices;
+  }
+  if (!indices) return;
+
+  mat4 projectionMatrix = g_state->projectionMatrixStack[g_state->currentProjectionMatrix];
+  mat4 modelviewMatrix = g_state->modelviewMatrixStack[g_state->currentModelviewMatrix];
+  g_state->device->render_elements_array(mode, count, type, indices, start, end, projectionMatrix, modelviewMatrix);
+}
+
+void glDrawElements (GLenum mode, GLsizei count, GLenum type, const GLvoid *indices) {
+  CHECK_NULL(g_state);
+
+  drawElements(mode, count, type, indices, 0, ~0u);
+}
+
+#ifndef SPEC_GLES
+void glDrawRangeElements (GLenum mode, GLuint start, GLuint end, GLsizei count, GLenum type, const GLvoid *indices) {
+  CHECK_NULL(g_state);
+
+#ifndef DISABLE_ERRORS
+  if (end < start) {
+    setError(GL_INVALID_VALUE);
+    return;
+  }
+#endif
+
+  drawElements(mode, count, type, indices, start, end);
+}
+#endif
+
+#ifndef SPEC_GLES
+void glLockArraysEXT (GLint first, GLsizei count) {
+  CHECK_NULL(g_state);
+
+#ifndef DISABLE_ERRORS
+  if (first < 0 || count <= 0) {
+    setError(GL_INVALID_VALUE);
+    return;
+  }
+
+  if (g_state->lockCount) {
+    setError(GL_INVALID_OPERATION);
+    return;
+  }
+#endif
+
+  // draws until the unlock reuse what the device stages now
+  g_state->lockFirst = first;
+  g_state->lockCount = count;
+  g_state->device->lock_arrays(first, count);
+}
+
+void glUnlockArraysEXT (void) {
+  CHECK_NULL(g_state);
+
+#ifndef DISABLE_ERRORS
+  if (!g_state->lockCount) {
+    setError(GL_INVALID_OPERATION);
+    return;
+  }
+#endif
+
+  g_state->lockFirst = 0;
+  g_state->lockCount = 0;
+  g_state->device->unlock_arrays();
+}
+#endif
+
 } // extern "C"
@@ -0,0 +1,95 @@
+#include "glImpl.h"
+#include <cstdlib>
+
+extern gfx_state *g_state;
+
+/* object 0 is the default one gfx_state starts out with */
+static gfx_vertex_array *getBindableVertexArray(GLuint name) {
+    return name ? g_state->getVertexArray(name) : &g_state->defaultVertexArray;
+}
+
+/* moves the arrays of the bound object back into it */
+static void saveVertexArray(gfx_vertex_array& vao) {
+    for (u32 i = 0; i < GFX_ARRAY_COUNT; ++i) vao.clientArrays[i] = g_state->clientArrays[i];
+    vao.elementArrayBuffer = g_state->elementArrayBuffer;
+    vao.generation = g_state->arraysGeneration;
+    vao.cache = g_state->arraysCache;
+}
+
+static void loadVertexArray(const gfx_vertex_array& vao) {
+    for (u32 i = 0; i < GFX_ARRAY_COUNT; ++i) g_state->clientArrays[i] = vao.clientArrays[i];
+    g_state->elementArrayBuffer = vao.elementArrayBuffer;
+    g_state->arraysGeneration = vao.generation;
+    g_state->arraysCache = vao.cache;
+}
+
+extern "C"
+{
+
+GLboolean glIsVertexArrayOES( GLuint array ) {
+    CHECK_NULL(g_state, GL_FALSE);
+
+    return array != 0 && g_state->getVertexArray(array) ? GL_TRUE : GL_FALSE;
+}
+
+void glGenVertexArraysOES( GLsizei n, GLuint *arrays ) {
+    CHECK_NULL(g_state);
+
+#ifndef DISABLE_ERRORS
+    if (n < 0) {
+        setError(GL_INVALID_VALUE);
+        return;
+    }
+#endif
+
+    for (GLsizei i = 0; i < n; ++i) {
+        GLuint aname = rand() + 1;
+        while (g_state->vertexArrays.contains(gfx_vertex_array(aname))) {
+            aname = rand() + 1;
+        }
+        arrays[i] = aname;
+
+        g_state->vertexArrays.push(gfx_vertex_array(aname));
+    }
+}
+
+void glBindVertexArrayOES( GLuint array ) {
+    CHECK_NULL(g_state);
+
+    gfx_vertex_array *vao = getBindableVertexArray(array);
+    if (!vao) {
+#ifndef DISABLE_ERRORS
+        setError(GL_INVALID_OPERATION);
+#endif
+        return;
+    }
+    if (array == g_state->vertexArray) return;
+
+    saveVertexArray(*getBindableVertexArray(g_state->vertexArray));
+    loadVertexArray(*vao);
+    g_state->vertexArray = array;
+}
+
+void glDeleteVertexArraysOES( GLsizei n, const GLuint *arrays ) {
+    CHECK_NULL(g_state);
+
+#ifndef DISABLE_ERRORS
+    if (n < 0) {
+        setError(GL_INVALID_VALUE);
+        return;
+    }
+#endif
+
+    for (GLsizei i = 0; i < n; ++i) {
+        if (!arrays[i] || !g_state->getVertexArray(arrays[i])) continue;
+
+        // deleting the bound object reverts to the default one
+        if (g_state->vertexArray == arrays[i]) glBindVertexArrayOES(0);
+
+        gfx_vertex_array *vao = g_state->getVertexArray(arrays[i]);
+        g_state->device->free_vertex_array(*vao);
+        g_state->vertexArrays.erase(vao);
+    }
+}
+
+} // extern "C"
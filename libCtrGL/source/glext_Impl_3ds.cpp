@@ -29,4 +29,5 @@ GLAPI void APIENTRY glScissorMode( GLenum mode ) {
 #endif
 
     g_state->device->ext_state.scissorMode = glext_scissor_mode(mode);
+    g_state->dirty |= GFX_DIRTY_SCISSOR;
 }
@@ -46,8 +46,8 @@ void GPU_SetViewport(u32* depthBuffer, u32* colorBuffer, u32 x, u32 y, u32 w, u3
 
 	u32 f116e=0x01000000|(((h-1)&0xFFF)<<12)|(w&0xFFF);
 
-	param[0x0]=((u32)depthBuffer)>>3;
-	param[0x1]=((u32)colorBuffer)>>3;
+	param[0x0]=((u32)(uintptr_t)depthBuffer)>>3;
+	param[0x1]=((u32)(uintptr_t)colorBuffer)>>3;
 	param[0x2]=f116e;
 	GPUCMD_AddIncrementalWrites(GPUREG_DEPTHBUFFER_LOC, param, 0x00000003);
 
@@ -145,21 +145,21 @@ void GPU_SetTexture(GPU_TEXUNIT unit, u32* data, u16 width, u16 height, u32 para
 	{
 	case GPU_TEXUNIT0:
 		GPUCMD_AddWrite(GPUREG_TEXUNIT0_TYPE, colorType);
-		GPUCMD_AddWrite(GPUREG_TEXUNIT0_ADDR1, ((u32)data)>>3);
+		GPUCMD_AddWrite(GPUREG_TEXUNIT0_ADDR1, ((u32)(uintptr_t)data)>>3);
 		GPUCMD_AddWrite(GPUREG_TEXUNIT0_DIM, (width<<16)|height);
 		GPUCMD_AddWrite(GPUREG_TEXUNIT0_PARAM, param);
 		break;
 
 	case GPU_TEXUNIT1:
 		GPUCMD_AddWrite(GPUREG_TEXUNIT1_TYPE, colorType);
-		GPUCMD_AddWrite(GPUREG_TEXUNIT1_ADDR, ((u32)data)>>3);
+		GPUCMD_AddWrite(GPUREG_TEXUNIT1_ADDR, ((u32)(uintptr_t)data)>>3);
 		GPUCMD_AddWrite(GPUREG_TEXUNIT1_DIM, (width<<16)|height);
 		GPUCMD_AddWrite(GPUREG_TEXUNIT1_PARAM, param);
 		break;
 
 	case GPU_TEXUNIT2:
 		GPUCMD_AddWrite(GPUREG_TEXUNIT2_TYPE, colorType);
-		GPUCMD_AddWrite(GPUREG_TEXUNIT2_ADDR, ((u32)data)>>3);
+		GPUCMD_AddWrite(GPUREG_TEXUNIT2_ADDR, ((u32)(uintptr_t)data)>>3);
 		GPUCMD_AddWrite(GPUREG_TEXUNIT2_DIM, (width<<16)|height);
 		GPUCMD_AddWrite(GPUREG_TEXUNIT2_PARAM, param);
 		break;
@@ -192,7 +192,7 @@ void GPU_SetAttributeBuffers(u8 totalAttributes, u32* baseAddress, u64 attribute
 
 	memset(param, 0x00, 0x28*4);
 
-	param[0x0]=((u32)baseAddress)>>3;
+	param[0x0]=((u32)(uintptr_t)baseAddress)>>3;
 	param[0x1]=attributeFormats&0xFFFFFFFF;
 	param[0x2]=((totalAttributes-1)<<28)|((attributeMask&0xFFF)<<16)|((attributeFormats>>32)&0xFFFF);
 
@@ -219,13 +219,13 @@ void GPU_SetAttributeBuffers(u8 totalAttributes, u32* baseAddress, u64 attribute
 	GPUCMD_AddMaskedWrite(GPUREG_VSH_INPUTBUFFER_CONFIG, 0xB, 0xA0000000|(totalAttributes-1));
 	GPUCMD_AddWrite(GPUREG_VSH_NUM_ATTR, (totalAttributes-1));
 
-    u32 permutationArray[] = {attributePermutation&0xFFFFFFFF, (attributePermutation>>32)&0xFFFF};
+    u32 permutationArray[] = {(u32)(attributePermutation&0xFFFFFFFF), (u32)((attributePermutation>>32)&0xFFFF)};
 	GPUCMD_AddIncrementalWrites(GPUREG_VSH_ATTRIBUTES_PERMUTATION_LOW, permutationArray, 2);
 }
 
 void GPU_SetAttributeBuffersAddress(u32* baseAddress)
 {
-	GPUCMD_AddWrite(GPUREG_ATTRIBBUFFERS_LOC, ((u32)baseAddress)>>3);
+	GPUCMD_AddWrite(GPUREG_ATTRIBBUFFERS_LOC, ((u32)(uintptr_t)baseAddress)>>3);
 }
 
 void GPU_SetFaceCulling(GPU_CULLMODE mode)
@@ -276,24 +276,36 @@ void GPU_DrawArray(GPU_Primitive_t primitive, u32 first, u32 count)
 	GPUCMD_AddWrite(GPUREG_FRAMEBUFFER_FLUSH, 0x00000001);
 }
 
-void GPU_DrawElements(GPU_Primitive_t primitive, u32* indexArray, u32 n)
+void GPU_DrawElements(GPU_Primitive_t primitive, u32* indexArray, u32 n, bool shortIndices)
 {
+	//indexed triangle lists go through the geometry primitive mode, like citro3d's C3D_DrawElements
+	bool triangles = primitive == GPU_TRIANGLES;
 	//set primitive type
-	GPUCMD_AddMaskedWrite(GPUREG_PRIMITIVE_CONFIG, 0x2, primitive);
+	GPUCMD_AddMaskedWrite(GPUREG_PRIMITIVE_CONFIG, 0x2, triangles ? GPU_GEOMETRY_PRIM : primitive);
 	GPUCMD_AddMaskedWrite(GPUREG_RESTART_PRIMITIVE, 0x2, 0x00000001);
-	//index buffer (TODO : support multiple types)
-	GPUCMD_AddWrite(GPUREG_INDEXBUFFER_CONFIG, 0x80000000|((u32)indexArray));
+	//index buffer, bit 31 selects u16 indices over u8
+	GPUCMD_AddWrite(GPUREG_INDEXBUFFER_CONFIG, (shortIndices ? 0x80000000 : 0)|((u32)(uintptr_t)indexArray & 0x0FFFFFFF));
 	//pass number of vertices
 	GPUCMD_AddWrite(GPUREG_NUMVERTICES, n);
 
 	GPUCMD_AddWrite(GPUREG_VERTEX_OFFSET, 0x00000000);
 
-	GPUCMD_AddMaskedWrite(GPUREG_GEOSTAGE_CONFIG, 0x2, 0x00000100);
-	GPUCMD_AddMaskedWrite(GPUREG_GEOSTAGE_CONFIG2, 0x2, 0x00000100);
+	//triangle element mode, only for the draw itself
+	if(triangles)
+	{
+		GPUCMD_AddMaskedWrite(GPUREG_GEOSTAGE_CONFIG, 0x2, 0x00000100);
+		GPUCMD_AddMaskedWrite(GPUREG_GEOSTAGE_CONFIG2, 0x2, 0x00000100);
+	}
 
 	GPUCMD_AddMaskedWrite(GPUREG_START_DRAW_FUNC0, 0x1, 0x00000000);
 	GPUCMD_AddWrite(GPUREG_DRAWELEMENTS, 0x00000001);
 	GPUCMD_AddMaskedWrite(GPUREG_START_DRAW_FUNC0, 0x1, 0x00000001);
+
+	if(triangles)
+	{
+		GPUCMD_AddMaskedWrite(GPUREG_GEOSTAGE_CONFIG, 0x2, 0x00000000);
+		GPUCMD_AddMaskedWrite(GPUREG_GEOSTAGE_CONFIG2, 0x2, 0x00000000);
+	}
 	GPUCMD_AddWrite(GPUREG_VTX_FUNC, 0x00000001);
 
 	// CHECKME: does this one also require GPUREG_FRAMEBUFFER_FLUSH at the end?
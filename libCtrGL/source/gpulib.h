@@ -227,9 +227,10 @@ void GPU_DrawArray(GPU_Primitive_t primitive, u32 first, u32 count);
  * @param primitive Primitive to draw.
  * @param indexArray Array of vertex indices to use.
  * @param n Number of vertices to draw.
+ * @param shortIndices Whether the indices are u16 rather than u8.
  * @deprecated
  */
-void GPU_DrawElements(GPU_Primitive_t primitive, u32* indexArray, u32 n);
+void GPU_DrawElements(GPU_Primitive_t primitive, u32* indexArray, u32 n, bool shortIndices);
 
 /**
  * @brief Finishes drawing.
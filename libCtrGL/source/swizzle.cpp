@@ -0,0 +1,127 @@
+#include "swizzle.h"
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* texel (x, y) of a tile sits at the Morton index with the bits y2 x2 y1 x1 y0 x0, so a row lands as 4 pairs of
+   texels at 0, 4, 16 and 20 past its first one, and the pairs of two neighbouring rows make runs of 4 */
+static u32 row_offset(u32 y) {
+    return ((y & 1) << 1) | ((y & 2) << 2) | ((y & 4) << 3);
+}
+
+/* one band of 8 rows, any texel size, a pair at a time */
+template <u32 size>
+static void swizzle_band(const u8 *const rows[8], u8 *dst, u32 width) {
+    for (u32 x = 0; x < width; x += 8, dst += 64 * size) {
+        for (u32 y = 0; y < 8; ++y) {
+            const u8 *s = rows[y] + x * size;
+            u8 *d = dst + row_offset(y) * size;
+            memcpy(d, s, 2 * size);
+            memcpy(d + 4 * size, s + 2 * size, 2 * size);
+            memcpy(d + 16 * size, s + 4 * size, 2 * size);
+            memcpy(d + 20 * size, s + 6 * size, 2 * size);
+        }
+    }
+}
+
+#if defined(__SSE2__)
+// rows are interleaved a pair of texels at a time, so every store is a whole run
+
+template <>
+void swizzle_band<4>(const u8 *const rows[8], u8 *dst, u32 width) {
+    for (u32 x = 0; x < width; x += 8, dst += 64 * 4) {
+        for (u32 y = 0; y < 8; y += 2) {
+            const __m128i *a = (const __m128i *)(rows[y] + x * 4);
+            const __m128i *b = (const __m128i *)(rows[y + 1] + x * 4);
+            __m128i a0 = _mm_loadu_si128(a), a1 = _mm_loadu_si128(a + 1);
+            __m128i b0 = _mm_loadu_si128(b), b1 = _mm_loadu_si128(b + 1);
+            __m128i *d = (__m128i *)(dst + row_offset(y) * 4);
+            _mm_storeu_si128(d, _mm_unpacklo_epi64(a0, b0));
+            _mm_storeu_si128(d + 1, _mm_unpackhi_epi64(a0, b0));
+            _mm_storeu_si128(d + 4, _mm_unpacklo_epi64(a1, b1));
+            _mm_storeu_si128(d + 5, _mm_unpackhi_epi64(a1, b1));
+        }
+    }
+}
+
+template <>
+void swizzle_band<2>(const u8 *const rows[8], u8 *dst, u32 width) {
+    for (u32 x = 0; x < width; x += 8, dst += 64 * 2) {
+        for (u32 y = 0; y < 8; y += 2) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(rows[y] + x * 2));
+            __m128i b = _mm_loadu_si128((const __m128i *)(rows[y + 1] + x * 2));
+            __m128i *d = (__m128i *)(dst + row_offset(y) * 2);
+            _mm_storeu_si128(d, _mm_unpacklo_epi32(a, b));
+            _mm_storeu_si128(d + 2, _mm_unpackhi_epi32(a, b));
+        }
+    }
+}
+
+// 4 rows of 8 bit texels fill the runs of 16 of a half tile
+template <>
+void swizzle_band<1>(const u8 *const rows[8], u8 *dst, u32 width) {
+    for (u32 x = 0; x < width; x += 8, dst += 64) {
+        for (u32 y = 0; y < 8; y += 4) {
+            __m128i a = _mm_loadl_epi64((const __m128i *)(rows[y] + x));
+            __m128i b = _mm_loadl_epi64((const __m128i *)(rows[y + 1] + x));
+            __m128i c = _mm_loadl_epi64((const __m128i *)(rows[y + 2] + x));
+            __m128i e = _mm_loadl_epi64((const __m128i *)(rows[y + 3] + x));
+            __m128i ab = _mm_unpacklo_epi16(a, b), ce = _mm_unpacklo_epi16(c, e);
+            __m128i *d = (__m128i *)(dst + row_offset(y));
+            _mm_storeu_si128(d, _mm_unpacklo_epi64(ab, ce));
+            _mm_storeu_si128(d + 1, _mm_unpackhi_epi64(ab, ce));
+        }
+    }
+}
+
+#elif defined(__ARM_FEATURE_SIMD32)
+// the wider texels are plain word moves already, PKHBT and PKHTB merge the 8 bit pairs of two rows into one word
+
+template <>
+void swizzle_band<1>(const u8 *const rows[8], u8 *dst, u32 width) {
+    for (u32 x = 0; x < width; x += 8, dst += 64) {
+        for (u32 y = 0; y < 8; y += 2) {
+            const u32 *a = (const u32 *)(rows[y] + x);
+            const u32 *b = (const u32 *)(rows[y + 1] + x);
+            u32 *d = (u32 *)(dst + row_offset(y));
+            for (u32 i = 0; i < 2; ++i) {
+                u32 lo, hi;
+                __asm__("pkhbt %0, %1, %2, lsl #16" : "=r"(lo) : "r"(a[i]), "r"(b[i]));
+                __asm__("pkhtb %0, %1, %2, asr #16" : "=r"(hi) : "r"(b[i]), "r"(a[i]));
+                d[i * 4] = lo;
+                d[i * 4 + 1] = hi;
+            }
+        }
+    }
+}
+#endif
+
+void swizzle_image(const u8 *src, u8 *dst, u32 width, u32 height, u32 size) {
+    if (!src || !dst) return;
+
+    u32 stride = width * size;
+    for (u32 y = 0; y < height; y += 8, dst += 8 * stride) {
+        const u8 *rows[8];
+        for (u32 i = 0; i < 8; ++i) rows[i] = src + (height - 1 - y - i) * stride;
+        switch (size) {
+            case 1: swizzle_band<1>(rows, dst, width); break;
+            case 2: swizzle_band<2>(rows, dst, width); break;
+            case 3: swizzle_band<3>(rows, dst, width); break;
+            case 4: swizzle_band<4>(rows, dst, width); break;
+        }
+    }
+}
+
+bool transfer_format(GPU_TEXCOLOR format, GX_TRANSFER_FORMAT& transfer) {
+    switch (format) {
+        case GPU_RGBA8: transfer = GX_TRANSFER_FMT_RGBA8; return true;
+        case GPU_RGB8: transfer = GX_TRANSFER_FMT_RGB8; return true;
+        case GPU_RGB565: transfer = GX_TRANSFER_FMT_RGB565; return true;
+        case GPU_RGBA5551: transfer = GX_TRANSFER_FMT_RGB5A1; return true;
+        case GPU_RGBA4: transfer = GX_TRANSFER_FMT_RGBA4; return true;
+        default: break;
+    }
+    return false;
+}
@@ -0,0 +1,20 @@
+#ifndef SWIZZLE_H
+#define SWIZZLE_H
+
+#include <3ds.h>
+#include <3ds/gpu/gx.h>
+
+/* copies an image of 1 to 4 byte texels into the PICA's 8x8 tiles, texels in Morton order inside a tile. GL images
+   start at the bottom and the tiles at the top, so the rows are flipped on the way. width and height are multiples
+   of 8 and rows start 4 byte aligned */
+void swizzle_image(const u8 *src, u8 *dst, u32 width, u32 height, u32 size);
+
+// linear GL rows in, bottom row first, tiles out the way swizzle_image writes them
+#define TEXTURE_TRANSFER_FLAGS \
+  (GX_TRANSFER_FLIP_VERT(1) | GX_TRANSFER_OUT_TILED(1) | GX_TRANSFER_RAW_COPY(0) | \
+  GX_TRANSFER_SCALING(GX_TRANSFER_SCALE_NO))
+
+/* transfer engine format that holds the texels unchanged, false for the ones it can't write */
+bool transfer_format(GPU_TEXCOLOR format, GX_TRANSFER_FORMAT& transfer);
+
+#endif